@@ -18,120 +18,93 @@
 #pragma once
 
 #include "Cumulus.h"
-#include "Poco/UnbufferedStreamBuf.h"
-#include <sstream>
+#include "Poco/StreamUtil.h"
+#include <istream>
+#include <cstring>
 
 namespace Cumulus {
 
-class StringBuf : public std::stringbuf {
-public:
-	const char*  data();
-};
-
-inline const char* StringBuf::data() {
-	return gptr();
-}
-
-class BinaryBuffer : public Poco::UnbufferedStreamBuf {
-       
+// Contiguous buffer taken from BufferPool, the writings are pointer increments on it
+class BinaryBuffer : public std::streambuf {
 public:
 	BinaryBuffer();
 	~BinaryBuffer();
+
 	Poco::UInt32		size();
 	const Poco::UInt8*	data();
+	// direct writing, without the stream layer
+	void				write(const Poco::UInt8* data,Poco::UInt32 size);
 
 private:
 	std::streampos seekpos(std::streampos sp,std::ios_base::openmode which = std::ios_base::in | std::ios_base::out);
 	std::streampos seekoff(std::streamoff off, std::ios_base::seekdir way, std::ios_base::openmode which = std::ios_base::in | std::ios_base::out);
-	std::streamsize xsputn(const char_type* s, std::streamsize n);
-	std::streamsize xsgetn(char_type* p, std::streamsize count);
-#if defined(POCO_OS_FAMILY_WINDOWS)
-	std::streamsize _Xsgetn_s(char_type * _Ptr,size_t _Ptr_size, std::streamsize _Count);
-#endif
+	int_type	overflow(int_type ch);
+	int_type	underflow();
 
-	int_type readFromDevice();
-	int_type writeToDevice(char_type);
+	void		reserve(Poco::UInt32 size);
 
-	StringBuf  _buf;
+	Poco::UInt8*	_pBuffer;
+	Poco::UInt32	_capacity;
 };
 
 inline const Poco::UInt8* BinaryBuffer::data() {
-	return (const Poco::UInt8*)_buf.data();
+	return (const Poco::UInt8*)gptr();
 }
 
-inline BinaryBuffer::int_type BinaryBuffer::writeToDevice(char_type ch) {
-	return _buf.sputc(ch);
+inline Poco::UInt32 BinaryBuffer::size() {
+	return pptr()>gptr() ? (Poco::UInt32)(pptr()-gptr()) : 0;
 }
 
-inline std::streamsize BinaryBuffer::xsputn (const char_type* s, std::streamsize n){
-        return _buf.sputn(s,n);
+inline void BinaryBuffer::write(const Poco::UInt8* data,Poco::UInt32 size) {
+	if((Poco::UInt32)(epptr()-pptr())<size)
+		reserve((Poco::UInt32)(pptr()-pbase())+size);
+	std::memcpy(pptr(),data,size);
+	pbump(size);
 }
 
 inline std::streampos BinaryBuffer::seekpos(std::streampos sp,std::ios_base::openmode which) {
-       return _buf.pubseekpos(sp,which);
-}
-
-inline std::streampos BinaryBuffer::seekoff(std::streamoff off, std::ios_base::seekdir way, std::ios_base::openmode which) {
-        return _buf.pubseekoff(off,way,which);
-}
-
-inline std::streamsize BinaryBuffer::xsgetn(char_type* p,std::streamsize count) {
-        return _buf.sgetn(p,count);
+	return seekoff(std::streamoff(sp),std::ios_base::beg,which);
 }
 
-#if defined(POCO_OS_FAMILY_WINDOWS) && _MSC_VER<1600
-inline std::streamsize BinaryBuffer::_Xsgetn_s(char_type * _Ptr,size_t _Ptr_size, std::streamsize _Count) {
-        return _buf._Sgetn_s(_Ptr,_Ptr_size,_Count);
-}
-#endif
-
-
 class BinaryIOS: public virtual std::ios {
-       
 public:
-        BinaryBuffer* rdbuf();
+	BinaryBuffer* rdbuf();
 
 protected:
-        BinaryIOS();
-        ~BinaryIOS();
+	BinaryIOS();
+	~BinaryIOS();
 
 private:
-        BinaryBuffer  _buf;
+	BinaryBuffer  _buf;
 };
 
 inline BinaryBuffer* BinaryIOS::rdbuf() {
-        return &_buf;
+	return &_buf;
 }
 
-
-
 class BinaryStream : public BinaryIOS, public std::iostream {
 public:
-      BinaryStream();
-      ~BinaryStream();
-
-	  Poco::UInt32			size();
-	  const Poco::UInt8*	data();
-
-      void            clear();
-	  void            resetReading(Poco::UInt32 position);
-	  void			  resetWriting(Poco::UInt32 position);
-      bool            empty();
-private:
+	BinaryStream();
+	~BinaryStream();
+
+	Poco::UInt32			size();
+	const Poco::UInt8*		data();
+	void					clear();
+	void					resetReading(Poco::UInt32 position);
+	void					resetWriting(Poco::UInt32 position);
+	bool					empty();
 };
 
 inline Poco::UInt32 BinaryStream::size() {
-      return rdbuf()->size();
+	return rdbuf()->size();
 }
 
-
 inline const Poco::UInt8* BinaryStream::data() {
 	return rdbuf()->data();
 }
 
-
 inline bool BinaryStream::empty() {
-        return size()==0;
+	return size()==0;
 }
 
 
@@ -19,7 +19,9 @@
 
 #include "Cumulus.h"
 #include "Address.h"
+#include "BinaryStream.h"
 #include "Poco/BinaryWriter.h"
+#include "Poco/ByteOrder.h"
 #include "Poco/Net/SocketAddress.h"
 
 namespace Cumulus {
@@ -28,6 +30,8 @@ namespace Cumulus {
 class BinaryWriter : public Poco::BinaryWriter {
 public:
 	BinaryWriter(std::ostream& ostr);
+	// writes straight in the buffer of the stream
+	BinaryWriter(BinaryStream& stream);
 	virtual ~BinaryWriter();
 
 	void writeRaw(const Poco::UInt8* value,Poco::UInt32 size);
@@ -46,28 +50,46 @@ public:
 	void writeAddress(const Poco::Net::SocketAddress& address,bool publicFlag);
 
 	static BinaryWriter BinaryWriterNull;
+private:
+	BinaryBuffer*	_pBuffer;
 };
 
 inline void BinaryWriter::writeRaw(const Poco::UInt8* value,Poco::UInt32 size) {
-	Poco::BinaryWriter::writeRaw((char*)value,size);
+	if(_pBuffer)
+		_pBuffer->write(value,size);
+	else
+		Poco::BinaryWriter::writeRaw((char*)value,size);
 }
 inline void BinaryWriter::writeRaw(const char* value,Poco::UInt32 size) {
-	Poco::BinaryWriter::writeRaw(value,size);
+	writeRaw((const Poco::UInt8*)value,size);
 }
 inline void BinaryWriter::writeRaw(const std::string& value) {
-	Poco::BinaryWriter::writeRaw(value);
+	writeRaw((const Poco::UInt8*)value.c_str(),value.size());
 }
 
 inline void BinaryWriter::write8(Poco::UInt8 value) {
-	(*this) << value;
+	if(_pBuffer)
+		_pBuffer->write(&value,1);
+	else
+		(*this) << value;
 }
 
 inline void BinaryWriter::write16(Poco::UInt16 value) {
-	(*this) << value;
+	if(!_pBuffer) {
+		(*this) << value;
+		return;
+	}
+	value = Poco::ByteOrder::toNetwork(value);
+	_pBuffer->write((const Poco::UInt8*)&value,sizeof(value));
 }
 
 inline void BinaryWriter::write32(Poco::UInt32 value) {
-	(*this) << value;
+	if(!_pBuffer) {
+		(*this) << value;
+		return;
+	}
+	value = Poco::ByteOrder::toNetwork(value);
+	_pBuffer->write((const Poco::UInt8*)&value,sizeof(value));
 }
 
 } // namespace Cumulus
@@ -0,0 +1,58 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#include "Poco/Mutex.h"
+#include <vector>
+
+namespace Cumulus {
+
+#define BUFFERPOOL_CLASSES	3 // 256 B, 4 KB and 64 KB slabs, beyond a buffer is allocated for itself
+
+class BufferPool {
+public:
+	// size is rounded up to the capacity really given
+	static Poco::UInt8*		Acquire(Poco::UInt32& size);
+	static void				Release(Poco::UInt8* pBuffer,Poco::UInt32 size);
+
+	// statistics by size class, the index BUFFERPOOL_CLASSES is for the oversized buffers
+	static Poco::UInt32		ClassSize(Poco::UInt8 index);
+	static Poco::UInt64		Allocations(Poco::UInt8 index);
+	static Poco::UInt64		Recycled(Poco::UInt8 index);
+	static Poco::UInt32		Free(Poco::UInt8 index);
+
+private:
+	static Poco::UInt8		ClassIndex(Poco::UInt32 size);
+
+	static Poco::FastMutex				_Mutex;
+	static std::vector<Poco::UInt8*>	_Free[BUFFERPOOL_CLASSES];
+	static Poco::UInt64					_Allocations[BUFFERPOOL_CLASSES+1];
+	static Poco::UInt64					_Recycled[BUFFERPOOL_CLASSES+1];
+};
+
+inline Poco::UInt64 BufferPool::Allocations(Poco::UInt8 index) {
+	return index>BUFFERPOOL_CLASSES ? 0 : _Allocations[index];
+}
+
+inline Poco::UInt64 BufferPool::Recycled(Poco::UInt8 index) {
+	return index>BUFFERPOOL_CLASSES ? 0 : _Recycled[index];
+}
+
+
+} // namespace Cumulus
@@ -33,6 +33,7 @@ public:
 	void			initFlowWriter(FlowWriter& flowWriter){}
 	void			close(){}
 	void			resetFlowWriter(FlowWriter& flowWriter){}
+	void			scheduleFlowWriter(FlowWriter& flowWriter){}
 	bool			failed() const{return true;}
 	bool			canWriteFollowing(FlowWriter& flowWriter){return false;}
 	PacketWriter&	writer(){return WriterNull;}
@@ -22,11 +22,10 @@
 #include "Peer.h"
 #include "FlowWriter.h"
 #include "Invoker.h"
+#include <vector>
 
 namespace Cumulus {
 
-class Packet;
-class Fragment;
 class Flow {
 public:
 	Flow(Poco::UInt64 id,const std::string& signature,const std::string& name,Peer& peer,Invoker& invoker,BandWriter& band);
@@ -36,7 +35,9 @@ public:
 
 	virtual void		fragmentHandler(Poco::UInt64 stage,Poco::UInt64 deltaNAck,PacketReader& fragment,Poco::UInt8 flags);
 	
-	void				commit();
+	bool				commit();
+	void				acknowledge();
+	bool				acknowledgmentDelayed() const;
 
 	void				fail(const std::string& error);
 
@@ -58,7 +59,9 @@ protected:
 	const Poco::UInt64		stage;
 	
 private:
-	void		 fragmentSortedHandler(Poco::UInt64 stage,PacketReader& fragment,Poco::UInt8 flags);
+	void		 fragmentSortedHandler(Poco::UInt64 stage,PacketReader& fragment,Poco::UInt8 flags,std::vector<Poco::UInt8>* pData=NULL,Poco::UInt32 fragments=1);
+	bool		 sortFragments(Poco::UInt64 stage,bool following);
+	void		 messageSortedHandler(PacketReader& message);
 	
 	virtual void		commitHandler();
 	Message::Type		unpack(PacketReader& reader);
@@ -68,8 +71,37 @@ private:
 	std::string			_error;
 
 	// Receiving
-	Packet*								_pPacket;
-	std::map<Poco::UInt64,Fragment*>	_fragments;
+	class Packet {
+	public:
+		Packet() : fragments(0) {}
+		void			add(PacketReader& fragment);
+		void			add(std::vector<Poco::UInt8>& data,Poco::UInt32 fragments);
+		void			reset();
+		Poco::UInt8*	data();
+		Poco::UInt32	size() const;
+
+		const Poco::UInt32			fragments;
+	private:
+		std::vector<Poco::UInt8>	_buffer;
+	};
+
+	struct Fragment {
+		Fragment() : stage(0),flags(0),head(0),size(0) {}
+		Poco::UInt64				stage; // 0 when the slot is free
+		Poco::UInt8					flags;
+		Poco::UInt64				head; // stage of the slot which holds the data, the following parts of a message are appended to it
+		Poco::UInt32				size;
+		std::vector<Poco::UInt8>	data;
+	};
+
+	Packet					_packet;
+	std::vector<Fragment>	_fragments; // reorder window indexed by stage modulo its size
+	Poco::UInt32			_fragmentsCount;
+	Poco::UInt32			_fragmentsBytes;
+
+	// Acknowledgment
+	Poco::UInt32			_packetsUnacknowledged;
+	bool					_acknowledgeNow;
 };
 
 inline const std::string& Flow::error() {
@@ -80,7 +112,19 @@ inline bool Flow::consumed() {
 	return _completed;
 }
 
+inline bool Flow::acknowledgmentDelayed() const {
+	return _packetsUnacknowledged>0;
+}
+
 inline void Flow::commitHandler() {
 }
 
+inline Poco::UInt8* Flow::Packet::data() {
+	return _buffer.empty() ? NULL : &_buffer[0];
+}
+
+inline Poco::UInt32 Flow::Packet::size() const {
+	return _buffer.size();
+}
+
 } // namespace Cumulus
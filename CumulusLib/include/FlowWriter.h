@@ -24,6 +24,8 @@
 #include "AMFObjectWriter.h"
 #include "Trigger.h"
 #include "BandWriter.h"
+#include <vector>
+#include <set>
 
 #define MESSAGE_HEADER			0x80
 #define MESSAGE_WITH_AFTERPART  0x10 
@@ -31,12 +33,27 @@
 #define MESSAGE_ABANDONMENT		0x02
 #define MESSAGE_END				0x01
 
+#define FLOWWRITER_QUANTUM		1024
+
 namespace Cumulus {
 
 class Invoker;
 class FlowWriter {
 	friend class Flow;
 public:
+	enum OverflowPolicy {
+		DROP_OLDEST=0, // drops the oldest media messages waiting
+		DROP_UNTIL_KEYFRAME, // same thing, but video restarts on a key frame
+		CLOSE_FLOW // fails the flow writer
+	};
+
+	enum Priority {
+		CONTROL=0,
+		AUDIO,
+		VIDEO,
+		DATA
+	};
+
 	FlowWriter(const std::string& signature,BandWriter& band);
 	virtual ~FlowWriter();
 
@@ -46,12 +63,29 @@ public:
 	const std::string		signature;
 	bool					reliable;
 
+	// memory budget of audio and video writers (bytes waiting and bytes sent not yet acknowledged), 0 for unlimited,
+	// only media can be dropped so the other writers ignore it
+	const Poco::UInt32		budget;
+	OverflowPolicy			overflowPolicy;
+
+	// partial reliability, the messages are abandoned after this time in ms, 0 for never
+	Poco::UInt32			timeToLive;
+
+	// the band writes the writers by priority, then by deficit round-robin with this weight
+	Priority				priority;
+	Poco::UInt8				weight;
+	bool					media() const;
+
+	// forward error correction, one fragment in "redundancy" is sent again in a following packet, 0 disables it
+	Poco::UInt8				redundancy;
+
 	template<class FlowWriterType>
 	FlowWriterType& newFlowWriter() {
 		return *(new FlowWriterType(signature,_band));
 	}
 
 	void			flush(bool full=false);
+	bool			send(Poco::UInt32 quantum);
 
 	void			acknowledgment(PacketReader& reader);
 	virtual void	manage(Invoker& invoker);
@@ -61,6 +95,10 @@ public:
 	void			clear();
 	void			close();
 	bool			consumed();
+	bool			windowClosed() const;
+
+	Poco::UInt32	bufferedBytes() const;
+	Poco::UInt32	overflow(Poco::UInt32 bytes);
 
 	Poco::UInt64	stage();
 
@@ -90,8 +128,17 @@ private:
 
 	virtual void			ackMessageHandler(Poco::UInt32 ackCount,Poco::UInt32 lostCount,BinaryReader& content,Poco::UInt32 available,Poco::UInt32 size);
 	virtual void			reset(Poco::UInt32 count){}
+	virtual void			overflowHandler(Poco::UInt32 dropped,bool failed){}
+	virtual void			recoveryHandler(Poco::UInt32 recovered){}
 	void					raiseMessage();
 	MessageBuffered&		createBufferedMessage();
+	bool					write(Poco::UInt32* pDeficit);
+	void					measure();
+	void					expire();
+	void					abandon(Message& message,Poco::UInt64 stage);
+	void					drop(std::list<Message*>::iterator& it);
+	void					writeRedundancy();
+	static Poco::UInt8		MediaType(Message& message,bool& keyFrame);
 
 	BandWriter&				_band;
 	bool					_closed;
@@ -107,6 +154,29 @@ private:
 	Poco::UInt32			_ackCount;
 	Poco::UInt32			_repeatable;
 
+	// Receiver window
+	Poco::UInt32			_window; // 0 until the first acknowledgment
+	Poco::UInt32			_bytesInFlight;
+
+	// Budget
+	Poco::UInt32			_bytesQueued;
+	Message*				_pLastMeasured;
+	bool					_waitKeyFrame;
+
+	// Scheduling
+	bool					_scheduled;
+	Poco::UInt32			_deficit;
+
+	// Redundancy, stages to repeat proactively
+	Poco::UInt8				_redundancyCount;
+	std::vector<Poco::UInt64>	_redundantStages;
+	std::set<Poco::UInt64>	_redundantSent; // stages repeated proactively, not yet acknowledged
+	std::set<Poco::UInt64>	_redundantLost; // the same ones reported lost by the receiver and not repeated since
+
+	// Abandonment, counts to report on the invoker
+	Poco::UInt32			_abandonedMessages;
+	Poco::UInt64			_abandonedBytes;
+
 	// For single thread AMF response!
 	double					_callbackHandle;
 	std::string				_obj;
@@ -115,6 +185,10 @@ private:
 	static MessageNull		_MessageNull;
 };
 
+inline bool FlowWriter::media() const {
+	return priority==AUDIO || priority==VIDEO;
+}
+
 inline bool FlowWriter::closed() {
 	return _closed;
 }
@@ -131,6 +205,14 @@ inline AMFObjectWriter FlowWriter::writeErrorResponse(const  std::string& code,c
 	return writeAMFResponse("_error",code,description);
 }
 
+inline bool FlowWriter::windowClosed() const {
+	return _window>0 && _bytesInFlight>=_window;
+}
+
+inline Poco::UInt32 FlowWriter::bufferedBytes() const {
+	return _bytesQueued+_bytesInFlight;
+}
+
 inline Poco::UInt64 FlowWriter::stage() {
 	return _stage;
 }
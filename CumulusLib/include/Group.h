@@ -19,7 +19,9 @@
 
 #include "Cumulus.h"
 #include "Peer.h"
-#include <map>
+#include "Entities.h"
+#include <vector>
+#include <list>
 #include <cstring>
 
 namespace Cumulus {
@@ -35,16 +37,17 @@ public:
     GroupIterator operator ++() { ++_it; return *this; }
 	GroupIterator operator --(int count) { std::advance(_it,count); return *this; }
     GroupIterator operator --() { --_it; return *this; }
-    Client*		  operator *() { if(_pPeers && _it!=_pPeers->end()) return _it->second; return NULL; }
+    Client*		  operator *() { if(_pPeers && _it!=_pPeers->end()) return *_it; return NULL; }
 private:
-	GroupIterator(std::map<Poco::UInt32,Peer*>& peers,bool end=false) : _pPeers(&peers),_it(end ? peers.end() : peers.begin()) { }
-	std::map<Poco::UInt32,Peer*>*				_pPeers; 
-	std::map<Poco::UInt32,Peer*>::const_iterator _it;
+	GroupIterator(std::list<Peer*>& peers,bool end=false) : _pPeers(&peers),_it(end ? peers.end() : peers.begin()) { }
+	std::list<Peer*>*					_pPeers; 
+	std::list<Peer*>::const_iterator	_it;
 };
 
 
 class Group : public Entity {
 	friend class Peer;
+	friend class GroupStrategy;
 public:
 	Group(const Poco::UInt8* id) {
 		std::memcpy((Poco::UInt8*)this->id,id,ID_SIZE);
@@ -54,37 +57,29 @@ public:
 	}
 
 	typedef GroupIterator Iterator;
+	typedef Entities<Peer>::Map RingMap;
 
 	Iterator begin();
 	Iterator end();
 	Poco::UInt32  size();
 
-	static Poco::UInt32 Distance(Iterator& it0,Iterator& it1);
-	static void Advance(Iterator& it,Poco::UInt32 count);
-
 private:
-	std::map<Poco::UInt32,Peer*> 	_peers;
+	std::vector<Peer*>		_peers; // dense, for the random picks, a leaving peer is replaced by the last one
+	std::list<Peer*>		_members; // in the joining order
+	RingMap					_ring; // by peer id
 };
 
 
 inline Group::Iterator Group::begin() {
-	return GroupIterator(_peers);
+	return GroupIterator(_members);
 }
 
 inline Group::Iterator Group::end() {
-	return GroupIterator(_peers,true);
+	return GroupIterator(_members,true);
 }
 
 inline Poco::UInt32 Group::size() {
 	return _peers.size();
 }
 
-inline Poco::UInt32 Group::Distance(Iterator& it0,Iterator& it1) {
-	return distance(it0._it,it1._it);
-}
-
-inline void Group::Advance(Iterator& it,Poco::UInt32 count) {
-	advance(it._it,count);
-}
-
 } // namespace Cumulus
@@ -0,0 +1,82 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#include "Group.h"
+#include <vector>
+#include <list>
+
+namespace Cumulus {
+
+// Introduces a member of a group to the joining peer, returns false if it has failed
+// (introductions cap reached, no writer, already introduced), the strategy tries then an other member
+class GroupIntroducer {
+public:
+	virtual bool	introduce(Peer& member)=0;
+};
+
+// Chooses the members of a group to introduce to a peer which joins it
+class GroupStrategy {
+public:
+	virtual ~GroupStrategy(){}
+
+	// "peer" is not yet a member of "group", the neighbors are introduced by order of preference
+	virtual void	neighbors(Group& group,const Peer& peer,GroupIntroducer& introducer)=0;
+	// "peer" has just left "group", gives the member to introduce to an other one to repair the mesh,
+	// "itFollowing" is the member which followed "peer" in the joining order
+	virtual bool	repair(Group& group,const Peer& peer,std::list<Peer*>::const_iterator itFollowing,Peer*& pMember,Peer*& pTarget)=0;
+
+	static GroupStrategy&	Recent;
+	static GroupStrategy&	Ring;
+
+protected:
+	static const std::vector<Peer*>&	Peers(Group& group);
+	static const std::list<Peer*>&		Members(Group& group);
+	static const Group::RingMap&		RingMap(Group& group);
+};
+
+// The 5 last members joined, plus one random
+class RecentGroupStrategy : public GroupStrategy {
+public:
+	void	neighbors(Group& group,const Peer& peer,GroupIntroducer& introducer);
+	bool	repair(Group& group,const Peer& peer,std::list<Peer*>::const_iterator itFollowing,Peer*& pMember,Peer*& pTarget);
+};
+
+// The nearest members in the ring of peer ids (2 successors, 2 predecessors),
+// plus the successors of id+1/2, id+1/4, ... of the ring as long as the group is large
+class RingGroupStrategy : public GroupStrategy {
+public:
+	void	neighbors(Group& group,const Peer& peer,GroupIntroducer& introducer);
+	bool	repair(Group& group,const Peer& peer,std::list<Peer*>::const_iterator itFollowing,Peer*& pMember,Peer*& pTarget);
+};
+
+inline const std::vector<Peer*>& GroupStrategy::Peers(Group& group) {
+	return group._peers;
+}
+
+inline const std::list<Peer*>& GroupStrategy::Members(Group& group) {
+	return group._members;
+}
+
+inline const Group::RingMap& GroupStrategy::RingMap(Group& group) {
+	return group._ring;
+}
+
+
+} // namespace Cumulus
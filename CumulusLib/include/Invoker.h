@@ -18,7 +18,7 @@
 #pragma once
 
 #include "Cumulus.h"
-#include "Group.h"
+#include "GroupStrategy.h"
 #include "Streams.h"
 #include "Entities.h"
 #include "SocketManager.h"
@@ -31,6 +31,8 @@ class Invoker : public Entity,public TaskHandler {
 	friend class Peer; // Peer manage _clients and _groups list!
 	friend class FlowStream; // FlowStream manage _streams list!
 	friend class FlowConnection; // FlowConnection manage _streams list!
+	friend class Publication; // Publication and its FanOut jobs count the fan-outs in progress
+	friend class FanOut;
 public:
 	// invocations
 	Entities<Client>		clients;
@@ -48,12 +50,38 @@ public:
 	void					clearBannedList();
 	bool					isBanned(const Poco::Net::IPAddress& ip);
 
+	// waits the end of the publication fan-outs handed off to the pool threads,
+	// required before to touch a listener session on the main thread
+	void					waitFanOuts();
+
 	
 
 	// properties
 	const Poco::UInt32		udpBufferSize;
 	const Poco::UInt32		keepAlivePeer;
 	const Poco::UInt32		keepAliveServer;
+	const Poco::UInt32		fanOutThreshold;
+	const Poco::UInt32		reorderWindow;
+	const Poco::UInt32		ackPackets;
+	const Poco::UInt32		ackDelay;
+	const Poco::UInt32		receiveBuffer;
+	const Poco::UInt32		writerBudget;
+	const Poco::UInt32		sessionBudget;
+	const Poco::UInt64		memoryCeiling;
+	const FlowWriter::OverflowPolicy	overflowPolicy;
+	const Poco::UInt32		audioTimeToLive;
+	const Poco::UInt32		videoTimeToLive;
+	const Poco::UInt16		mtu; // packet size maximum for the path MTU discovery
+	GroupStrategy* const	pGroupStrategy;
+	const Poco::UInt16		groupIntroductions; // times by minute that a same member can be introduced, 0 for unlimited
+	const Poco::UInt8		fecLostRate; // lost rate in percent from which media fragments are sent with redundancy
+
+	// statistics
+	const Poco::UInt64		acks;
+	const Poco::UInt64		dataPackets;
+	const Poco::UInt64		bufferedBytes;
+	const Poco::UInt64		abandonedMessages;
+	const Poco::UInt64		abandonedBytes;
 
 protected:
 	Invoker(Poco::UInt32 threads);
@@ -61,6 +89,10 @@ protected:
 
 private:
 	virtual Peer&													myself()=0;
+	void															onHandled();
+
+	Poco::AtomicCounter												_fanOuts;
+	Poco::Event														_fanOutsDone;
 	std::map<std::string,Publication*>								_publications;
 	Streams															_streams;
 	std::set<const Publication*>									_publishers;
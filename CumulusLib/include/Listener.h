@@ -37,9 +37,10 @@ public:
 
 	void sampleAccess(bool audio,bool video) const;
 
-	void pushAudioPacket(Poco::UInt32 time,PacketReader& packet); 
-	void pushVideoPacket(Poco::UInt32 time,PacketReader& packet);
-	void pushDataPacket(const std::string& name,PacketReader& packet);
+	// "shared" when the packet is read by other threads, it is never written in place for an unbuffered writing then
+	void pushAudioPacket(Poco::UInt32 time,PacketReader& packet,const Publication* pLayer=NULL,bool shared=false); 
+	void pushVideoPacket(Poco::UInt32 time,PacketReader& packet,const Publication* pLayer=NULL,bool shared=false);
+	void pushDataPacket(const std::string& name,PacketReader& packet,const Publication* pLayer=NULL,bool shared=false);
 
 	void flush();
 
@@ -55,12 +56,18 @@ public:
 	const QualityOfService&	videoQOS() const;
 	const QualityOfService&	audioQOS() const;
 
-	void init(const Client& client);
+	void init(const Client& client,Poco::UInt32 audioTimeToLive=0,Poco::UInt32 videoTimeToLive=0,Poco::UInt8 fecLostRate=0);
+	const Client* client() const;
+
+	const Publication*	layer() const;
+	void				resetLayer(const Publication& layer);
 
 private:
 	Poco::UInt32 	computeTime(Poco::UInt32 time);
+	bool			switchLayer(const Publication& layer,Poco::UInt32 time,bool keyFrame);
 
 	void			writeBounds();
+	void			closeOnOverflow();
 	void			writeBound(FlowWriter& writer);
 
 	bool					_unbuffered;
@@ -75,7 +82,20 @@ private:
 	FlowWriter&				_writer;
 	AudioWriter*			_pAudioWriter;
 	VideoWriter*			_pVideoWriter;
+	const Client*			_pClient;
+
+	const Publication*		_pLayer;
+	const Publication*		_pNextLayer;
+	Poco::Timestamp			_layerTime;
 };
 
+inline const Publication* Listener::layer() const {
+	return _pLayer;
+}
+
+inline const Client* Listener::client() const {
+	return _pClient;
+}
+
 
 } // namespace Cumulus
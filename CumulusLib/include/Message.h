@@ -24,6 +24,7 @@
 #include "BinaryReader.h"
 #include "MemoryStream.h"
 #include "Poco/Buffer.h"
+#include "Poco/Timestamp.h"
 #include <list>
 
 namespace Cumulus {
@@ -48,6 +49,8 @@ public:
 
 	std::map<Poco::UInt32,Poco::UInt64>		fragments;
 	const bool								repeatable;
+	const Poco::UInt32						bytes; // content size, known once the message is flushed
+	Poco::Timestamp::TimeVal				deadline; // abandoned after this time, 0 for never
 
 private:
 	virtual	Poco::UInt32	init(Poco::UInt32 position)=0;
@@ -77,6 +80,12 @@ public:
 	MessageBuffered(bool repeatable=true);
 	virtual ~MessageBuffered();
 
+	// the memory of the messages deleted after acknowledgment is reused by the next ones
+	static void*		operator new(std::size_t size);
+	static void			operator delete(void* pMemory,std::size_t size);
+	static Poco::UInt64	Allocations;
+	static Poco::UInt64	Recycled;
+
 	AMFWriter			amfWriter;
 	BinaryWriter		rawWriter;
 	
@@ -32,7 +32,9 @@ class Handler;
 class Publication;
 class Listener;
 class Member;
+class PeerIntroducer;
 class Peer : public Client {
+	friend class PeerIntroducer;
 public:
 	Peer(Handler& handler);
 	virtual ~Peer();
@@ -73,6 +75,7 @@ private:
 	void onJoinGroup(Group& group);
 	void onUnjoinGroup(std::map<Group*,Member*>::iterator it);
 	bool writeId(Group& group,Peer& peer,FlowWriter* pWriter);
+	bool introduce(Group& group);
 
 	Handler&						_handler;
 	std::map<Group*,Member*>		_groups;
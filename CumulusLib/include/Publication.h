@@ -20,12 +20,17 @@
 #include "Cumulus.h"
 #include "Listeners.h"
 #include "Peer.h"
+#include "PoolThread.h"
+#include "Poco/Mutex.h"
+#include <vector>
 
 namespace Cumulus {
 
+class Invoker;
 class Publication {
+	friend class FanOut;
 public:
-	Publication(const std::string& name);
+	Publication(const std::string& name,Invoker& invoker);
 	virtual ~Publication();
 
 	Poco::UInt32			publisherId() const;
@@ -49,7 +54,24 @@ public:
 	void					removeListener(Peer& peer,Poco::UInt32 id);
 
 	void					flush();
+	// waits the end of the fan-outs handed off to the pool threads, before to touch a listener session
+	void					waitFanOut();
+
+	// simulcast, a publication can group several layers ("name@layer" publications)
+	void					addLayer(Publication& layer);
+	void					removeLayer(Publication& layer);
+	Poco::UInt32			layers() const;
+	const Publication*		selectLayer(const Publication* pCurrent,const QualityOfService& qos) const;
+
+	// average and peak duration of the listeners fan-out, in microseconds
+	Poco::UInt32			fanOutLatency() const;
+	Poco::UInt32			fanOutPeakLatency() const;
 private:
+	void					fanOut(Poco::UInt8 type,Poco::UInt32 time,const std::string& name,PacketReader* pPacket,const Publication* pLayer=NULL);
+	void					buildShards();
+	void					fanOutDone(Poco::Int64 elapsed);
+
+	Invoker&							_invoker;
 	Peer*								_pPublisher;
 	FlowWriter*							_pController;
 	bool								_firstKeyFrame;
@@ -59,8 +81,31 @@ private:
 
 	QualityOfService					_videoQOS;
 	QualityOfService					_audioQOS;
+
+	std::vector<Publication*>			_layers;
+	Publication*						_pSimulcast;
+
+	std::vector<std::vector<Listener*> >	_shards;
+	std::vector<PoolThread*>			_shardThreads; // a shard stays on the same thread to keep the order of its packets
+	bool								_shardsChanged;
+	Poco::FastMutex						_fanOutMutex;
+	Poco::Int64							_fanOutTime;
+	Poco::Int64							_fanOutCount;
+	Poco::Int64							_fanOutPeak;
 };
 
+inline Poco::UInt32 Publication::layers() const {
+	return _layers.size();
+}
+
+inline Poco::UInt32 Publication::fanOutLatency() const {
+	return (Poco::UInt32)(_fanOutCount>0 ? (_fanOutTime/_fanOutCount) : 0);
+}
+
+inline Poco::UInt32 Publication::fanOutPeakLatency() const {
+	return (Poco::UInt32)_fanOutPeak;
+}
+
 inline const QualityOfService& Publication::audioQOS() const {
 	return _audioQOS;
 }
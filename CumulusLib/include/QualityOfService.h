@@ -19,11 +19,12 @@
 
 #include "Cumulus.h"
 #include "Poco/Timestamp.h"
-#include <list>
 
 namespace Cumulus {
 
-class Sample;
+#define QOS_BUCKETS			50
+#define QOS_BUCKET_DURATION	100000 // 100 ms, so 5 seconds of sampling
+
 class QualityOfService {
 public:
 	QualityOfService();
@@ -33,6 +34,7 @@ public:
 	void reset();
 
 	const Poco::UInt32	droppedFrames;
+	const Poco::UInt32	recoveredFragments; // lost fragments received thanks to their redundant copy
 	const double		lostRate;
 	const double		byteRate;
 	const double		congestionRate;
@@ -40,8 +42,20 @@ public:
 
 	static QualityOfService QualityOfServiceNull;
 private:
+	struct Bucket {
+		Poco::UInt32	samples;
+		Poco::UInt32	received;
+		Poco::UInt32	lost;
+		Poco::UInt32	size;
+		Poco::Int64		latencyGradient;
+	};
+
+	void				clearBucket(Bucket& bucket);
+
 	bool				_fullSample;
-	std::list<Sample*>	_samples;
+	Bucket				_buckets[QOS_BUCKETS];
+	Poco::Int64			_bucket;
+	Poco::UInt32		_samples;
 	Poco::UInt32		_prevTime;
 	Poco::UInt32		_size;
 	Poco::Timestamp		_reception;
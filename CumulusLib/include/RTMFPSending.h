@@ -21,12 +21,14 @@
 #include "AESEngine.h"
 #include "PacketWriter.h"
 #include "WorkThread.h"
+#include "Poco/Buffer.h"
 #include "Poco/Net/DatagramSocket.h"
 
 namespace Cumulus {
 
 class RTMFPServer;
 class RTMFPSending : public WorkThread {
+	Poco::Buffer<Poco::UInt8>	_buffer; // first member, "packet" is built on it, sized with the server MTU
 public:
 	RTMFPSending(RTMFPServer & server);
 	~RTMFPSending();
@@ -41,7 +43,6 @@ public:
 private:
 	void						run();
 
-	Poco::UInt8					_buffer[PACKETSEND_SIZE];
 	RTMFPServer & _server;
 };
 
@@ -25,13 +25,14 @@
 #include "Handler.h"
 #include "Poco/Net/DatagramSocket.h"
 #include "Poco/Net/SocketAddress.h"
+#include <set>
 
 
 namespace Cumulus {
 
 class RTMFPServerParams {
 public:
-	RTMFPServerParams() : port(RTMFP_DEFAULT_PORT),udpBufferSize(0),threadPriority(Poco::Thread::PRIO_HIGH),pCirrus(NULL),middle(false),keepAlivePeer(10),keepAliveServer(15), shellPort(0) {	
+	RTMFPServerParams() : port(RTMFP_DEFAULT_PORT),udpBufferSize(0),threadPriority(Poco::Thread::PRIO_HIGH),pCirrus(NULL),middle(false),keepAlivePeer(10),keepAliveServer(15), shellPort(0),fanOutThreshold(0),reorderWindow(128),ackPackets(2),ackDelay(50),receiveBuffer(1024),writerBudget(0),sessionBudget(0),memoryCeiling(0),overflowPolicy(FlowWriter::DROP_OLDEST),audioTimeToLive(0),videoTimeToLive(0),mtu(1440),fecLostRate(0),pGroupStrategy(&GroupStrategy::Recent),groupIntroductions(0) {	
 	}
 	Poco::UInt16				port;
 	Poco::UInt32				udpBufferSize;
@@ -42,6 +43,21 @@ public:
 	Poco::UInt16				keepAlivePeer;
 	Poco::UInt16				keepAliveServer;
 	Poco::UInt16 				shellPort;
+	Poco::UInt32				fanOutThreshold;
+	Poco::UInt32				reorderWindow;
+	Poco::UInt32				ackPackets;
+	Poco::UInt32				ackDelay;
+	Poco::UInt32				receiveBuffer;
+	Poco::UInt32				writerBudget;
+	Poco::UInt32				sessionBudget;
+	Poco::UInt32				memoryCeiling;
+	FlowWriter::OverflowPolicy	overflowPolicy;
+	Poco::UInt32				audioTimeToLive;
+	Poco::UInt32				videoTimeToLive;
+	Poco::UInt16				mtu;
+	Poco::UInt8					fecLostRate;
+	GroupStrategy*				pGroupStrategy;
+	Poco::UInt16				groupIntroductions;
 };
 
 class MainSockets : public SocketManager,private TaskHandler {
@@ -56,6 +72,8 @@ private:
 class RTMFPServer : private Gateway,protected Handler,private Startable,private SocketHandler {
 	friend class RTMFPManager;
 	friend class RTMFPReceiving;
+	friend class RTMFPSending;
+	friend class ServerSession;
 public:
 	RTMFPServer(Poco::UInt32 threads=0);
 	virtual ~RTMFPServer();
@@ -68,10 +86,12 @@ public:
 
 	const Poco::Net::DatagramSocket & shellSocket();
 
-	void status_string(std::string & s); 
+	virtual void status_string(std::string & s); 
 
 protected:
 	virtual void    manage();
+	// at each wake-up of the manager, every ackDelay ms when the acknowledgments are delayed, else every second
+	virtual void	tick(){}
 
 public:
 	Poco::Int64 rcvpTm, rcvpCnt, psndTm, psndCnt;
@@ -89,6 +109,9 @@ private:
 	Poco::UInt8		p2pHandshake(const std::string& tag,PacketWriter& response,const Poco::Net::SocketAddress& address,const Poco::UInt8* peerIdWanted);
 	Session&		createSession(const Peer& peer,Cookie& cookie);
 	void			destroySession(Session& session);
+	void			delayAcks(Session& session);
+	void			flushAcks();
+	void			manageMemory();
 
 	void			onReadable(Poco::Net::Socket& socket);
 	void			onError(const Poco::Net::Socket& socket,const std::string& error);
@@ -107,6 +130,7 @@ private:
 	bool							_middle;
 	Target*							_pCirrus;
 	Sessions						_sessions;
+	std::set<Poco::UInt32>			_delayedAcks;
 //	MainSockets						_mainSockets;
 	int  tm_5m;	
 };
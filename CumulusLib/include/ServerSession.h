@@ -57,8 +57,12 @@ public:
 	PacketWriter&		writer();
 	bool				failed() const;
 	void				manage();
+	void				flushAcks();
 	void				kill();
 
+	Poco::UInt32		bufferedBytes() const;
+	Poco::UInt32		shed(Poco::UInt32 bytes);
+
 	void				p2pHandshake(const Poco::Net::SocketAddress& address,const std::string& tag,Poco::UInt32 times,Session* pSession);
 
 	Poco::UInt32	helloAttempt(const std::string& tag);
@@ -97,12 +101,17 @@ private:
 	// Implementation of BandWriter
 	void				initFlowWriter(FlowWriter& flowWriter);
 	void				resetFlowWriter(FlowWriter& flowWriter);
+	void				scheduleFlowWriter(FlowWriter& flowWriter);
 	bool				canWriteFollowing(FlowWriter& flowWriter);
 	void				close();
 
 	PacketWriter&		writeMessage(Poco::UInt8 type,Poco::UInt16 length,FlowWriter* pFlowWriter=NULL);
 
 	bool				keepAlive();
+	void				manageMTU();
+	void				probeMTU();
+	void				writeAcks();
+	void				writeFlowWriters();
 
 	FlowWriter*			flowWriter(Poco::UInt64 id);
 	Flow&				flow(Poco::UInt64 id);
@@ -111,16 +120,37 @@ private:
 	bool								_failed;
 	Poco::UInt8							_timesFailed;
 	Poco::UInt8							_timesKeepalive;
+	bool								_acksDelayed;
+	Poco::UInt32						_bufferedBytes;
+
+	// Path MTU discovery
+	Poco::UInt16						_mtu;
+	Poco::UInt16						_mtuCeiling;
+	Poco::UInt16						_mtuProbe;
+	Poco::UInt8							_mtuProbeAttempts;
+	Poco::UInt32						_mtuProbeId;
+	bool								_probingMTU;
+	Poco::Timestamp						_mtuTime;
 
 	std::map<Poco::UInt64,Flow*>		_flows;
 	FlowNull*							_pFlowNull;
 	std::map<Poco::UInt64,FlowWriter*>	_flowWriters;
 	FlowWriter*							_pLastFlowWriter;
+	std::vector<FlowWriter*>			_flowWritersScheduled;
+	bool								_writing;
 	Poco::UInt64						_nextFlowWriterId;
 
 	std::map<std::string,Attempt*>		_helloAttempts;
 };
 
+inline Poco::UInt32 ServerSession::bufferedBytes() const {
+	return _bufferedBytes;
+}
+
+inline void ServerSession::scheduleFlowWriter(FlowWriter& flowWriter) {
+	_flowWritersScheduled.push_back(&flowWriter);
+}
+
 inline void ServerSession::close() {
 	failSignal();
 }
@@ -52,6 +52,9 @@ public:
 	bool				nextDumpAreMiddle;
 
 	virtual void		manage(){}
+	virtual void		flushAcks(){}
+	virtual Poco::UInt32	bufferedBytes() const {return 0;}
+	virtual Poco::UInt32	shed(Poco::UInt32 bytes) {return 0;}
 
 	bool				setEndPoint(Poco::Net::DatagramSocket& socket,const Poco::Net::SocketAddress& address);
 	void				decode(Poco::AutoPtr<RTMFPReceiving>& pRTMFPSending);
@@ -65,6 +68,8 @@ public:
 protected:
 	void				send(Poco::UInt32 farId,Poco::Net::DatagramSocket& socket,const Poco::Net::SocketAddress& receiver,AESEngine::Type type=AESEngine::DEFAULT);
 
+	RTMFPServer&		server();
+
 	AESEngine			aesDecrypt;
 	AESEngine			aesEncrypt;
 	Invoker&			invoker;
@@ -103,6 +108,10 @@ inline void Session::send(AESEngine::Type type) {
 }
 
 
+inline RTMFPServer& Session::server() {
+	return _server;
+}
+
 inline PacketWriter& Session::writer() {
 	return _pRTMFPSending->packet;
 }
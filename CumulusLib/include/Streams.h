@@ -24,9 +24,10 @@
 
 namespace Cumulus {
 
+class Invoker;
 class Streams {
 public:
-	Streams(std::map<std::string,Publication*>&	publications);
+	Streams(std::map<std::string,Publication*>&	publications,Invoker& invoker);
 	virtual ~Streams();
 
 	Poco::UInt32	create();
@@ -38,10 +39,14 @@ public:
 	void					unsubscribe(Peer& peer,Poco::UInt32 id,const std::string& name);
 
 private:
+	// "name@layer" is a simulcast layer of "name" when "layer" is a short identifier (letters, digits, '_' or '-')
+	static bool				SimulcastName(const std::string& name,std::string& simulcast);
+
 	Publications::Iterator	createPublication(const std::string& name);
 	void					destroyPublication(const Publications::Iterator& it);
 
 	std::map<std::string,Publication*>&	_publications;
+	Invoker&							_invoker;
 	std::set<Poco::UInt32>				_streams;
 	Poco::UInt32						_nextId;
 };
@@ -25,6 +25,7 @@ class TaskHandler;
 class Task {
 public:
 	Task(TaskHandler * handler=NULL);
+	virtual ~Task(){}
 	void associateHandler(TaskHandler * handler);
 
 	virtual void	handle()=0;
@@ -43,6 +43,8 @@ protected:
 	void giveHandleEx(bool wakeup=true);
 private:
 	virtual void requestHandle()=0;
+	// called on the handling thread after each task
+	virtual void onHandled() {}
 
 	Poco::FastMutex			_mutex;
 	Poco::FastMutex			_mutexWait;
@@ -16,65 +16,109 @@
 */
 
 #include "BinaryStream.h"
-#include "Util.h"
-#include "Poco/StreamCopier.h"
+#include "BufferPool.h"
+#include <cstring>
 
 using namespace std;
 using namespace Poco;
 
 namespace Cumulus {
 
-
-BinaryBuffer::BinaryBuffer() {
+BinaryBuffer::BinaryBuffer() : _pBuffer(NULL),_capacity(0) {
 }
+
 BinaryBuffer::~BinaryBuffer() {
+	BufferPool::Release(_pBuffer,_capacity);
 }
 
+void BinaryBuffer::reserve(UInt32 size) {
+	if(size<=_capacity)
+		return;
+	if(size<(_capacity*2))
+		size = _capacity*2;
+	UInt8* pBuffer = BufferPool::Acquire(size);
+	UInt32 reading = gptr()-eback();
+	UInt32 writing = pptr()-pbase();
+	if(_pBuffer) {
+		memcpy(pBuffer,_pBuffer,_capacity); // the whole capacity, bytes after the writing position can be rewritten
+		BufferPool::Release(_pBuffer,_capacity);
+	}
+	_pBuffer = pBuffer;
+	_capacity = size;
+	char* pBase = (char*)_pBuffer;
+	setp(pBase,pBase+_capacity);
+	pbump(writing);
+	setg(pBase,pBase+reading,pBase+(writing>reading ? writing : reading));
+}
+
+BinaryBuffer::int_type BinaryBuffer::overflow(int_type ch) {
+	if(traits_type::eq_int_type(ch,traits_type::eof()))
+		return traits_type::not_eof(ch);
+	reserve(_capacity+1);
+	*pptr() = traits_type::to_char_type(ch);
+	pbump(1);
+	return ch;
+}
 
-BinaryBuffer::int_type BinaryBuffer::readFromDevice() {
-    if(size()==0)
-		return EOF;
-    return _buf.sbumpc();
+BinaryBuffer::int_type BinaryBuffer::underflow() {
+	// the readable part goes until the writing position
+	if(gptr()>=pptr())
+		return traits_type::eof();
+	setg(eback(),gptr(),pptr());
+	return traits_type::to_int_type(*gptr());
 }
 
-Poco::UInt32 BinaryBuffer::size() {
-	streamoff result = _buf.pubseekoff(0,std::ios_base::cur,std::ios_base::out) - _buf.pubseekoff(0,std::ios_base::cur,std::ios_base::in);
-	if(result<0)
-		result=0;
-	return (UInt32)result;
+streampos BinaryBuffer::seekoff(streamoff off,ios_base::seekdir way,ios_base::openmode which) {
+	streamoff reading = gptr()-eback();
+	streamoff writing = pptr()-pbase();
+	streamoff position = -1;
+	if(which&ios_base::in) {
+		position = off + (way==ios_base::cur ? reading : (way==ios_base::end ? writing : 0));
+		if(position<0 || position>_capacity)
+			return streampos(streamoff(-1));
+		reading = position;
+	}
+	if(which&ios_base::out) {
+		position = off + (way==ios_base::cur ? writing : (way==ios_base::end ? writing : 0));
+		if(position<0 || position>_capacity)
+			return streampos(streamoff(-1));
+		writing = position;
+		char* pBase = (char*)_pBuffer;
+		setp(pBase,pBase+_capacity);
+		pbump((int)writing);
+	}
+	char* pBase = (char*)_pBuffer;
+	setg(pBase,pBase+reading,pBase+(writing>reading ? writing : reading));
+	return streampos(position);
 }
 
 BinaryIOS::BinaryIOS() {
 	poco_ios_init(&_buf);
 }
+
 BinaryIOS::~BinaryIOS() {
 }
 
-
 BinaryStream::BinaryStream() : iostream(rdbuf()) {
 }
 
 BinaryStream::~BinaryStream() {
-       
 }
 
 void BinaryStream::clear() {
-    // vider le stream buf
-	StreamCopier::copyStream(*this,Util::NullOutputStream);
-    rdbuf()->pubseekoff(0,ios::beg);
+	rdbuf()->pubseekoff(0,ios::beg);
 	iostream::clear();
 }
 
 void BinaryStream::resetReading(UInt32 position) {
 	rdbuf()->pubseekoff(position,ios::beg,ios_base::in);
-    iostream::clear();
+	iostream::clear();
 }
 
 void BinaryStream::resetWriting(UInt32 position) {
 	rdbuf()->pubseekoff(position,ios::beg,ios_base::out);
-    iostream::clear();
+	iostream::clear();
 }
 
 
-
 } // namespace Cumulus
@@ -26,7 +26,10 @@ namespace Cumulus {
 
 BinaryWriter BinaryWriter::BinaryWriterNull(Util::NullOutputStream);
 
-BinaryWriter::BinaryWriter(ostream& ostr) : Poco::BinaryWriter(ostr,BinaryWriter::NETWORK_BYTE_ORDER) {
+BinaryWriter::BinaryWriter(ostream& ostr) : Poco::BinaryWriter(ostr,BinaryWriter::NETWORK_BYTE_ORDER),_pBuffer(NULL) {
+}
+
+BinaryWriter::BinaryWriter(BinaryStream& stream) : Poco::BinaryWriter(stream,BinaryWriter::NETWORK_BYTE_ORDER),_pBuffer(stream.rdbuf()) {
 }
 
 
@@ -0,0 +1,84 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "BufferPool.h"
+
+using namespace std;
+using namespace Poco;
+
+namespace Cumulus {
+
+static const UInt32 ClassSizes[BUFFERPOOL_CLASSES] = {256,4096,65536};
+static const UInt32 ClassFreeMax[BUFFERPOOL_CLASSES] = {4096,512,32}; // free slabs kept at most, beyond they are deleted
+
+FastMutex		BufferPool::_Mutex;
+vector<UInt8*>	BufferPool::_Free[BUFFERPOOL_CLASSES];
+UInt64			BufferPool::_Allocations[BUFFERPOOL_CLASSES+1] = {0};
+UInt64			BufferPool::_Recycled[BUFFERPOOL_CLASSES+1] = {0};
+
+UInt8 BufferPool::ClassIndex(UInt32 size) {
+	UInt8 index=0;
+	while(index<BUFFERPOOL_CLASSES && size>ClassSizes[index])
+		++index;
+	return index;
+}
+
+UInt32 BufferPool::ClassSize(UInt8 index) {
+	return index<BUFFERPOOL_CLASSES ? ClassSizes[index] : 0;
+}
+
+UInt32 BufferPool::Free(UInt8 index) {
+	if(index>=BUFFERPOOL_CLASSES)
+		return 0;
+	ScopedLock<FastMutex> lock(_Mutex);
+	return _Free[index].size();
+}
+
+UInt8* BufferPool::Acquire(UInt32& size) {
+	UInt8 index = ClassIndex(size);
+	if(index<BUFFERPOOL_CLASSES)
+		size = ClassSizes[index];
+	{
+		ScopedLock<FastMutex> lock(_Mutex);
+		if(index<BUFFERPOOL_CLASSES && !_Free[index].empty()) {
+			UInt8* pBuffer = _Free[index].back();
+			_Free[index].pop_back();
+			++_Recycled[index];
+			return pBuffer;
+		}
+		++_Allocations[index];
+	}
+	return new UInt8[size];
+}
+
+void BufferPool::Release(UInt8* pBuffer,UInt32 size) {
+	if(!pBuffer)
+		return;
+	UInt8 index = ClassIndex(size);
+	if(index<BUFFERPOOL_CLASSES && size==ClassSizes[index]) {
+		ScopedLock<FastMutex> lock(_Mutex);
+		vector<UInt8*>& slabs(_Free[index]);
+		if(slabs.size()<ClassFreeMax[index]) {
+			slabs.push_back(pBuffer);
+			return;
+		}
+	}
+	delete [] pBuffer;
+}
+
+
+} // namespace Cumulus
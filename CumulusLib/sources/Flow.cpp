@@ -18,61 +18,54 @@
 #include "Flow.h"
 #include "Logs.h"
 #include "Util.h"
+#include "RTMFP.h"
 #include "Poco/NumberFormatter.h"
 #include <cstring>
 
 using namespace std;
 using namespace Poco;
 
-namespace Cumulus {
-
-
-class Packet {
-public:
-	Packet(PacketReader& fragment) : fragments(1),_pMessage(NULL),_buffer((string::size_type)fragment.available()) {
-		if(_buffer.size()>0)
-			memcpy(&_buffer[0],fragment.current(),_buffer.size());
-	}
-	~Packet() {
-		if(_pMessage)
-			delete _pMessage;
-	}
+// reassembly buffers keep their capacity from a message to the other, until this bound
+#define RETAINED_CAPACITY	65536
+// first reservation of a message which comes in several fragments
+#define MESSAGE_RESERVE		(RTMFP_MAX_PACKET_LENGTH*8)
 
-	void add(PacketReader& fragment) {
-		string::size_type old = _buffer.size();
-		_buffer.resize(old + (string::size_type)fragment.available());
-		if(_buffer.size()>old)
-			memcpy(&_buffer[old],fragment.current(),(size_t)fragment.available());
-		++(UInt16&)fragments;
-	}
+namespace Cumulus {
 
-	PacketReader* release() {
-		if(_pMessage) {
-			ERROR("Packet already released!");
-			return _pMessage;
-		}
-		_pMessage = new PacketReader(_buffer.size()==0 ? NULL : &_buffer[0],_buffer.size());
-		(UInt16&)_pMessage->fragments = fragments;
-		return _pMessage;
-	}
+static void Recycle(vector<UInt8>& data) {
+	if(data.capacity()>RETAINED_CAPACITY)
+		vector<UInt8>().swap(data);
+	else
+		data.clear();
+}
 
-	const UInt32	fragments;
-private:
-	vector<UInt8>	_buffer;
-	PacketReader*  _pMessage;
-};
+void Flow::Packet::add(PacketReader& fragment) {
+	UInt32 old = _buffer.size();
+	if(fragments==0 && _buffer.capacity()<MESSAGE_RESERVE)
+		_buffer.reserve(MESSAGE_RESERVE);
+	_buffer.resize(old + fragment.available());
+	if(_buffer.size()>old)
+		memcpy(&_buffer[old],fragment.current(),fragment.available());
+	++(UInt32&)fragments;
+}
 
+void Flow::Packet::add(vector<UInt8>& data,UInt32 fragments) {
+	// buffered fragments which start the message are taken without copy, the slot gets the capacity of the buffer in exchange
+	if(_buffer.empty())
+		_buffer.swap(data);
+	else
+		_buffer.insert(_buffer.end(),data.begin(),data.end());
+	Recycle(data);
+	(UInt32&)this->fragments += fragments;
+}
 
-class Fragment : public Buffer<UInt8> {
-public:
-	Fragment(PacketReader& data,UInt8 flags) : flags(flags),Buffer<UInt8>(data.available()) {
-		data.readRaw(begin(),size());
-	}
-	Poco::UInt8					flags;
-};
+void Flow::Packet::reset() {
+	Recycle(_buffer);
+	(UInt32&)fragments = 0;
+}
 
 
-Flow::Flow(UInt64 id,const string& signature,const string& name,Peer& peer,Invoker& invoker,BandWriter& band) : id(id),stage(0),peer(peer),invoker(invoker),_completed(false),_pPacket(NULL),_band(band),writer(*new FlowWriter(signature,band)) {
+Flow::Flow(UInt64 id,const string& signature,const string& name,Peer& peer,Invoker& invoker,BandWriter& band) : id(id),stage(0),peer(peer),invoker(invoker),_completed(false),_fragmentsCount(0),_fragmentsBytes(0),_packetsUnacknowledged(0),_acknowledgeNow(false),_band(band),writer(*new FlowWriter(signature,band)) {
 	if(writer.flowId==0)
 		((UInt64&)writer.flowId)=id;
 	// create code prefix for a possible response
@@ -91,17 +84,10 @@ void Flow::complete() {
 	if(!writer.signature.empty()) // writer.signature.empty() == FlowNull instance, not display the message in FullNull case
 		DEBUG("Flow %s consumed",NumberFormatter::format(id).c_str());
 
-	// delete fragments
-	map<UInt64,Fragment*>::const_iterator it;
-	for(it=_fragments.begin();it!=_fragments.end();++it)
-		delete it->second;
-	_fragments.clear();
-
-	// delete receive buffer
-	if(_pPacket) {
-		delete _pPacket;
-		_pPacket=NULL;
-	}
+	// release fragments and receive buffer
+	vector<Fragment>().swap(_fragments);
+	_fragmentsCount = _fragmentsBytes = 0;
+	_packet.reset();
 
 	_completed=true;
 }
@@ -143,30 +129,56 @@ Message::Type Flow::unpack(PacketReader& reader) {
 	return type;
 }
 
-void Flow::commit() {
+bool Flow::commit() {
+	// Acknowledgment delayed while the packets are received in order,
+	// immediate on loss, repetition or completion
+	++_packetsUnacknowledged;
+	bool delayed = !_acknowledgeNow && !_completed && _packetsUnacknowledged<invoker.ackPackets && !writer.signature.empty();
+	if(!delayed)
+		acknowledge();
+
+	commitHandler();
+	writer.flush();
+	return delayed;
+}
+
+void Flow::acknowledge() {
+	_packetsUnacknowledged = 0;
+	_acknowledgeNow = false;
+	++(UInt64&)invoker.acks;
 
 	// Lost informations!
 	UInt32 size = 0;
 	list<UInt64> lost;
 	UInt64 current=stage;
-	UInt32 count=0;
-	map<UInt64,Fragment*>::const_iterator it=_fragments.begin();
-	while(it!=_fragments.end()) {
-		current = it->first-current-2;
+	UInt32 found=0;
+	UInt64 last = stage+_fragments.size();
+	for(UInt64 buffered=stage+1;found<_fragmentsCount && buffered<=last;++buffered) {
+		if(_fragments[buffered%_fragments.size()].stage!=buffered)
+			continue;
+		current = buffered-current-2;
 		size += Util::Get7BitValueSize(current);
 		lost.push_back(current);
-		current = it->first;
-		while(++it!=_fragments.end() && it->first==(++current))
+		UInt32 count=0;
+		++found;
+		while(buffered<last && _fragments[(buffered+1)%_fragments.size()].stage==(buffered+1)) {
+			++buffered;
+			++found;
 			++count;
+		}
 		size += Util::Get7BitValueSize(count);
 		lost.push_back(count);
-		--current;
-		count=0;
+		current = buffered;
 	}
 
-	UInt32 bufferSize = _pPacket ? ((_pPacket->fragments>0x3F00) ? 0 : (0x3F00-_pPacket->fragments)) : 0x7F;
+	// Free receiving space in blocks of 1024 bytes, what is reordered or reassembled takes place.
+	// 0 is kept for the negative acknowledgment of FlowNull, a real flow advertises at least one block
+	UInt32 buffered = _fragmentsBytes+_packet.size();
+	UInt32 bufferSize = buffered<invoker.receiveBuffer ? ((invoker.receiveBuffer-buffered)/1024) : 0;
 	if(writer.signature.empty())
 		bufferSize=0;
+	else if(bufferSize==0)
+		bufferSize=1;
 
 	PacketWriter& ack = _band.writeMessage(0x51,Util::Get7BitValueSize(id)+Util::Get7BitValueSize(bufferSize)+Util::Get7BitValueSize(stage)+size);
 	UInt32 pos = ack.position();
@@ -177,9 +189,6 @@ void Flow::commit() {
 	list<UInt64>::const_iterator it2;
 	for(it2=lost.begin();it2!=lost.end();++it2)
 		ack.write7BitLongValue(*it2);
-
-	commitHandler();
-	writer.flush();
 }
 
 void Flow::fragmentHandler(UInt64 stage,UInt64 deltaNAck,PacketReader& fragment,UInt8 flags) {
@@ -192,6 +201,7 @@ void Flow::fragmentHandler(UInt64 stage,UInt64 deltaNAck,PacketReader& fragment,
 
 	if(stage < nextStage) {
 		DEBUG("Stage %s on flow %s has already been received",NumberFormatter::format(stage).c_str(),NumberFormatter::format(id).c_str());
+		_acknowledgeNow = true; // our acknowledgment has certainly been lost
 		return;
 	}
 
@@ -201,57 +211,113 @@ void Flow::fragmentHandler(UInt64 stage,UInt64 deltaNAck,PacketReader& fragment,
 	}
 	
 	if(this->stage < (stage-deltaNAck)) {
-		map<UInt64,Fragment*>::iterator it=_fragments.begin();
-		while(it!=_fragments.end()) {
-			if( it->first > stage) 
-				break;
-			// leave all stages <= stage
-			PacketReader reader(it->second->begin(),it->second->size());
-			fragmentSortedHandler(it->first,reader,it->second->flags);
-			if(it->second->flags&MESSAGE_END) {
-				complete();
-				return; // to prevent a crash bug!! (double fragments deletion)
-			}
-			delete it->second;
-			_fragments.erase(it++);
-		}
-
+		// leave all stages <= stage
+		if(!sortFragments(stage,false) || this->stage>=stage)
+			return;
 		nextStage = stage;
+		_acknowledgeNow = true;
+	}
+
+	if(stage>nextStage && (stage-this->stage)>invoker.reorderWindow) {
+		// reorder window overflow, the oldest missing stages are considered as lost to make room
+		UInt64 base = stage-invoker.reorderWindow;
+		DEBUG("Reorder window overflow on flow %s, stages until %s abandoned",NumberFormatter::format(id).c_str(),NumberFormatter::format(base).c_str());
+		if(!sortFragments(base,false))
+			return;
+		_acknowledgeNow = true;
+		if(this->stage<base) {
+			lostFragmentsHandler((UInt32)(base-this->stage));
+			(UInt64&)this->stage = base;
+			_packet.reset();
+		}
+		if(!sortFragments(base,true) || this->stage>=stage)
+			return;
+		nextStage = this->stage+1;
 	}
 	
 	if(stage>nextStage) {
 		// not following stage, bufferizes the stage
-		map<UInt64,Fragment*>::iterator it = _fragments.lower_bound(stage);
-		if(it==_fragments.end() || it->first!=stage) {
-			if(it!=_fragments.begin())
-				--it;
-			_fragments.insert(it,pair<UInt64,Fragment*>(stage,new Fragment(fragment,flags)));
-			if(_fragments.size()>100)
-				DEBUG("_fragments.size()=%s",NumberFormatter::format(_fragments.size()).c_str());
+		_acknowledgeNow = true;
+		if(_fragments.empty())
+			_fragments.resize(invoker.reorderWindow);
+		Fragment& buffered = _fragments[stage%_fragments.size()];
+		if(buffered.stage!=stage) {
+			if(buffered.stage==0)
+				++_fragmentsCount;
+			else
+				_fragmentsBytes -= buffered.size;
+			buffered.stage = stage;
+			buffered.flags = flags;
+			buffered.size = fragment.available();
+			// a following part of the message buffered in the previous stage is appended to it,
+			// so the reassembly has nothing more to copy
+			Fragment& previous = _fragments[(stage-1)%_fragments.size()];
+			if(previous.stage==(stage-1) && (previous.flags&MESSAGE_WITH_AFTERPART) && (flags&MESSAGE_WITH_BEFOREPART) && !((previous.flags|flags)&MESSAGE_ABANDONMENT)) {
+				buffered.head = previous.head;
+				vector<UInt8>& data(_fragments[buffered.head%_fragments.size()].data);
+				data.insert(data.end(),fragment.current(),fragment.current()+fragment.available());
+			} else {
+				buffered.head = stage;
+				buffered.data.assign(fragment.current(),fragment.current()+fragment.available());
+			}
+			_fragmentsBytes += buffered.size;
 		} else
 			DEBUG("Stage %s on flow %s has already been received",NumberFormatter::format(stage).c_str(),NumberFormatter::format(id).c_str());
 	} else {
-		fragmentSortedHandler(nextStage++,fragment,flags);
-		if(flags&MESSAGE_END)
+		fragmentSortedHandler(nextStage,fragment,flags);
+		if(flags&MESSAGE_END) {
 			complete();
-		map<UInt64,Fragment*>::iterator it=_fragments.begin();
-		while(it!=_fragments.end()) {
-			if( it->first > nextStage)
-				break;
-			PacketReader reader(it->second->begin(),it->second->size());
-			fragmentSortedHandler(nextStage++,reader,it->second->flags);
-			if(it->second->flags&MESSAGE_END) {
-				complete();
-				return; // to prevent a crash bug!! (double fragments deletion)
-			}
-			delete it->second;
-			_fragments.erase(it++);
+			return;
 		}
+		sortFragments(nextStage,true);
+	}
+}
 
+bool Flow::sortFragments(UInt64 stage,bool following) {
+	// delivers the buffered stages <= stage, and the contiguous following ones if wanted
+	UInt64 last = this->stage+_fragments.size();
+	for(UInt64 current=this->stage+1;_fragmentsCount>0 && current<=last;++current) {
+		Fragment& buffered = _fragments[current%_fragments.size()];
+		if(buffered.stage!=current) {
+			if(current>stage)
+				break;
+			continue;
+		}
+		if(current>stage && (!following || current!=this->stage+1))
+			break;
+		buffered.stage = 0;
+		--_fragmentsCount;
+		_fragmentsBytes -= buffered.size;
+		_acknowledgeNow = true;
+		UInt8 flags = buffered.flags;
+		// the following parts of the message appended to this slot are delivered with it
+		UInt32 fragments = 1;
+		while((current+fragments)<=last) {
+			Fragment& next = _fragments[(current+fragments)%_fragments.size()];
+			if(next.stage!=(current+fragments) || next.head!=current)
+				break;
+			flags = (flags&~(MESSAGE_WITH_AFTERPART|MESSAGE_END)) | (next.flags&(MESSAGE_WITH_AFTERPART|MESSAGE_END));
+			next.stage = 0;
+			--_fragmentsCount;
+			_fragmentsBytes -= next.size;
+			++fragments;
+		}
+		PacketReader reader(buffered.data.empty() ? NULL : &buffered.data[0],buffered.data.size());
+		fragmentSortedHandler(current,reader,flags,&buffered.data,fragments);
+		if(flags&MESSAGE_END) {
+			complete();
+			return false;
+		}
+		if(_completed)
+			return false;
+		Recycle(buffered.data);
+		current += fragments-1;
 	}
+	return true;
 }
 
-void Flow::fragmentSortedHandler(UInt64 stage,PacketReader& fragment,UInt8 flags) {
+void Flow::fragmentSortedHandler(UInt64 stage,PacketReader& fragment,UInt8 flags,vector<UInt8>* pData,UInt32 fragments) {
+	// "fragments" following stages from "stage", reassembled in "pData" when they come from the reorder window
 	if(stage<=this->stage) {
 		ERROR("Stage %s not sorted on flow %s",NumberFormatter::format(stage).c_str(),NumberFormatter::format(id).c_str());
 		return;
@@ -259,60 +325,64 @@ void Flow::fragmentSortedHandler(UInt64 stage,PacketReader& fragment,UInt8 flags
 	if(stage>(this->stage+1)) {
 		// not following stage!
 		UInt32 lostCount = (UInt32)(stage-this->stage-1);
-		(UInt64&)this->stage = stage;
-		if(_pPacket) {
-			delete _pPacket;
-			_pPacket = NULL;
-		}
+		(UInt64&)this->stage = stage+fragments-1;
+		_packet.reset();
 		if(flags&MESSAGE_WITH_BEFOREPART) {
-			lostFragmentsHandler(lostCount+1);
+			lostFragmentsHandler(lostCount+fragments);
 			return;
 		}
 		lostFragmentsHandler(lostCount);
 	} else
-		(UInt64&)this->stage = stage;
+		(UInt64&)this->stage = stage+fragments-1;
 
 	// If MESSAGE_ABANDONMENT, content is not the right normal content!
 	if(flags&MESSAGE_ABANDONMENT) {
-		if(_pPacket) {
-			delete _pPacket;
-			_pPacket = NULL;
-		}
+		_packet.reset();
 		return;
 	}
 
-	PacketReader* pMessage(&fragment);
 	if(flags&MESSAGE_WITH_BEFOREPART){
-		if(!_pPacket) {
+		if(_packet.fragments==0) {
 			WARN("A received message tells to have a 'beforepart' and nevertheless partbuffer is empty, certainly some packets were lost");
-			lostFragmentsHandler(1);
-			delete _pPacket;
-			_pPacket = NULL;
+			lostFragmentsHandler(fragments);
 			return;
 		}
 		
-		_pPacket->add(fragment);
+		if(pData)
+			_packet.add(*pData,fragments);
+		else
+			_packet.add(fragment);
 
 		if(flags&MESSAGE_WITH_AFTERPART)
 			return;
 
-		pMessage = _pPacket->release();
+		PacketReader message(_packet.data(),_packet.size());
+		(UInt32&)message.fragments = _packet.fragments;
+		messageSortedHandler(message);
 	} else if(flags&MESSAGE_WITH_AFTERPART) {
-		if(_pPacket) {
+		if(_packet.fragments>0) {
 			ERROR("A received message tells to have not 'beforepart' and nevertheless partbuffer exists");
-			lostFragmentsHandler(_pPacket->fragments);
-			delete _pPacket;
+			lostFragmentsHandler(_packet.fragments);
+			_packet.reset();
 		}
-		_pPacket = new Packet(fragment);
+		if(pData)
+			_packet.add(*pData,fragments);
+		else
+			_packet.add(fragment);
 		return;
-	}
+	} else
+		messageSortedHandler(fragment);
+
+	_packet.reset();
+}
 
-	Message::Type type = unpack(*pMessage);
+void Flow::messageSortedHandler(PacketReader& message) {
+	Message::Type type = unpack(message);
 
 	if(type!=Message::EMPTY) {
 		writer._callbackHandle = 0;
 		string name;
-		AMFReader amf(*pMessage);
+		AMFReader amf(message);
 		if(type==Message::AMF_WITH_HANDLER || type==Message::AMF) {
 			amf.read(name);
 			if(type==Message::AMF_WITH_HANDLER) {
@@ -329,13 +399,13 @@ void Flow::fragmentSortedHandler(UInt64 stage,PacketReader& fragment,UInt8 flags
 					messageHandler(name,amf);
 					break;
 				case Message::AUDIO:
-					audioHandler(*pMessage);
+					audioHandler(message);
 					break;
 				case Message::VIDEO:
-					videoHandler(*pMessage);
+					videoHandler(message);
 					break;
 				default:
-					rawHandler(type,*pMessage);
+					rawHandler(type,message);
 			}
 		} catch(Exception& ex) {
 			_error = "flow error, " + ex.displayText();
@@ -346,12 +416,6 @@ void Flow::fragmentSortedHandler(UInt64 stage,PacketReader& fragment,UInt8 flags
 		}
 	}
 	writer._callbackHandle = 0;
-
-	if(_pPacket) {
-		delete _pPacket;
-		_pPacket=NULL;
-	}
-	
 }
 
 void Flow::messageHandler(const std::string& name,AMFReader& message) {
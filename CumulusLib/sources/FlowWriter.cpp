@@ -16,6 +16,8 @@
 */
 
 #include "FlowWriter.h"
+#include "Invoker.h"
+#include "RTMFP.h"
 #include "Util.h"
 #include "Logs.h"
 #include "Poco/NumberFormatter.h"
@@ -29,14 +31,18 @@ namespace Cumulus {
 MessageNull FlowWriter::_MessageNull;
 
 
-FlowWriter::FlowWriter(const string& signature,BandWriter& band) : reliable(true),critical(false),id(0),_stage(0),_stageAck(0),_closed(false),_callbackHandle(0),_resetCount(0),_transaction(false),flowId(0),_band(band),signature(signature),_repeatable(0),_lostCount(0),_ackCount(0) {
+FlowWriter::FlowWriter(const string& signature,BandWriter& band) : reliable(true),critical(false),id(0),_stage(0),_stageAck(0),_closed(false),_callbackHandle(0),_resetCount(0),_transaction(false),flowId(0),_band(band),signature(signature),_repeatable(0),_lostCount(0),_ackCount(0),_window(0),_bytesInFlight(0),budget(0),overflowPolicy(DROP_OLDEST),_bytesQueued(0),_pLastMeasured(NULL),_waitKeyFrame(false),timeToLive(0),_abandonedMessages(0),_abandonedBytes(0),priority(CONTROL),weight(1),_scheduled(false),_deficit(0),redundancy(0),_redundancyCount(0) {
 	band.initFlowWriter(*this);
 }
 
 FlowWriter::FlowWriter(FlowWriter& flowWriter) :
 		id(flowWriter.id),critical(false),_transaction(false),
 		_stage(flowWriter._stage),_stageAck(flowWriter._stageAck),
-		_ackCount(flowWriter._ackCount),_lostCount(flowWriter._lostCount),
+		_ackCount(flowWriter._ackCount),_lostCount(flowWriter._lostCount),_window(0),_bytesInFlight(0),
+		budget(0),overflowPolicy(DROP_OLDEST),_bytesQueued(0),_pLastMeasured(NULL),_waitKeyFrame(false),
+		timeToLive(0),_abandonedMessages(0),_abandonedBytes(0),
+		priority(flowWriter.priority),weight(flowWriter.weight),_scheduled(false),_deficit(0),
+		redundancy(0),_redundancyCount(0),
 		_closed(false),_callbackHandle(0),_resetCount(0),reliable(flowWriter.reliable),
 		flowId(0),_band(flowWriter._band),signature(flowWriter.signature) {
 	close();
@@ -59,6 +65,8 @@ void FlowWriter::clear() {
 		delete pMessage;
 		_messages.pop_front();
 	}
+	_bytesQueued=0;
+	_pLastMeasured=NULL;
 	while(!_messagesSent.empty()) {
 		pMessage = _messagesSent.front();
 		_lostCount += pMessage->fragments.size();
@@ -67,9 +75,13 @@ void FlowWriter::clear() {
 		delete pMessage;
 		_messagesSent.pop_front();
 	}
+	_bytesInFlight=0;
+	_redundantStages.clear();
+	_redundantSent.clear();
+	_redundantLost.clear();
 	if(_stage>0) {
 		createBufferedMessage(); // Send a MESSAGE_ABANDONMENT just in the case where the receiver has been created
-		flush();
+		write(NULL); // immediatly, it can be the deletion
 		_trigger.stop();
 	}
 }
@@ -97,7 +109,7 @@ void FlowWriter::close() {
 
 void FlowWriter::acknowledgment(PacketReader& reader) {
 
-	UInt64 bufferSize = reader.read7BitLongValue(); // TODO use this value in reliability mechanism?
+	UInt64 bufferSize = reader.read7BitLongValue(); // free space of the receiver, in blocks of 1024 bytes
 	
 	if(bufferSize==0) {
 		// In fact here, we should send a 0x18 message (with id flow),
@@ -106,6 +118,11 @@ void FlowWriter::acknowledgment(PacketReader& reader) {
 		return;
 	}
 
+	expire();
+
+	bool closed = windowClosed();
+	_window = bufferSize>(0xFFFFFFFF/1024) ? 0xFFFFFFFF : (UInt32)(bufferSize*1024);
+
 	UInt64 stageAckPrec = _stageAck;
 	UInt64 stageReaden = reader.read7BitLongValue();
 	UInt64 stage = _stageAck+1;
@@ -132,6 +149,7 @@ void FlowWriter::acknowledgment(PacketReader& reader) {
 
 	UInt64 lostCount = 0;
 	UInt64 lostStage = 0;
+	UInt32 recovered = 0;
 	bool repeated = false;
 	bool header = true;
 	bool stop=false;
@@ -151,8 +169,14 @@ void FlowWriter::acknowledgment(PacketReader& reader) {
 			
 			// ACK
 			if(_stageAck>=stage) {
+				UInt32 fragment(itFrag->first);
 				message.fragments.erase(message.fragments.begin());
 				itFrag=message.fragments.begin();
+				UInt32 fragmentSize = (itFrag==message.fragments.end() ? message.bytes : itFrag->first) - fragment;
+				_bytesInFlight = _bytesInFlight>fragmentSize ? (_bytesInFlight-fragmentSize) : 0;
+				// reported lost and never repeated, so its redundant copy is what the receiver got
+				if(!_redundantLost.empty() && _redundantLost.erase(stage)>0)
+					++recovered;
 				++_ackCount;
 				++stage;
 				continue;
@@ -216,6 +240,8 @@ void FlowWriter::acknowledgment(PacketReader& reader) {
 			}
 
 			repeated = true;
+			if(!_redundantSent.empty() && _redundantSent.count(stage)>0)
+				_redundantLost.insert(stage);
 			// Don't repeate before that the receiver receives the itFrag->second sending stage
 			if(itFrag->second >= maxStageRecv) {
 				++stage;
@@ -229,6 +255,7 @@ void FlowWriter::acknowledgment(PacketReader& reader) {
 			// Repeat message
 
 			DEBUG("FlowWriter %s : stage %s repeated",NumberFormatter::format(id).c_str(),NumberFormatter::format(stage).c_str());
+			_redundantLost.erase(stage);
 			UInt32 available;
 			UInt32 fragment(itFrag->first);
 			BinaryReader& content = message.reader(fragment,available);
@@ -288,16 +315,31 @@ void FlowWriter::acknowledgment(PacketReader& reader) {
 	if(lostCount>0 && reader.available()>0)
 		ERROR("Some lost information received have not been yet sent on flowWriter %s",NumberFormatter::format(id).c_str());
 
+	if(!_redundantSent.empty()) {
+		_redundantSent.erase(_redundantSent.begin(),_redundantSent.upper_bound(_stageAck));
+		_redundantLost.erase(_redundantLost.begin(),_redundantLost.upper_bound(_stageAck));
+	}
+	if(recovered>0)
+		recoveryHandler(recovered);
+
 
 	// rest messages repeatable?
 	if(_repeatable==0)
 		_trigger.stop();
 	else if(_stageAck>stageAckPrec || repeated)
 		_trigger.reset();
+
+	// window reopened, resume the waiting messages
+	if(!_messages.empty() && !windowClosed()) {
+		if(closed)
+			DEBUG("Window reopened on flowWriter %s",NumberFormatter::format(id).c_str());
+		flush();
+	}
 }
 
 void FlowWriter::manage(Invoker& invoker) {
 	if(!consumed() && !_band.failed()) {
+		expire();
 		try {
 			if(_trigger.raise())
 				raiseMessage();
@@ -309,6 +351,60 @@ void FlowWriter::manage(Invoker& invoker) {
 	if(critical && _closed)
 		throw Exception("Main flow writer closed, session is closing");
 	flush();
+
+	if(_abandonedMessages>0) {
+		(UInt64&)invoker.abandonedMessages += _abandonedMessages;
+		(UInt64&)invoker.abandonedBytes += _abandonedBytes;
+		_abandonedMessages=0;
+		_abandonedBytes=0;
+	}
+}
+
+void FlowWriter::expire() {
+	if(timeToLive==0 || _repeatable==0)
+		return;
+	// messages are sent in the order of their deadline
+	Timestamp::TimeVal now = Timestamp().epochMicroseconds();
+	UInt64 stage = _stageAck+1;
+	list<Message*>::const_iterator it;
+	for(it=_messagesSent.begin();it!=_messagesSent.end();++it) {
+		Message& message(**it);
+		if(message.deadline==0 || now<message.deadline)
+			break;
+		if(message.repeatable && !message.fragments.empty())
+			abandon(message,stage);
+		stage += message.fragments.size();
+	}
+	if(_repeatable==0)
+		_trigger.stop();
+}
+
+void FlowWriter::abandon(Message& message,UInt64 stage) {
+	// Repetitions stop, and each stage not acknowledged is sent again empty
+	// with MESSAGE_ABANDONMENT to allow the receiver to skip it
+	DEBUG("FlowWriter %s : message %s abandoned",NumberFormatter::format(id).c_str(),NumberFormatter::format(stage).c_str());
+	(bool&)message.repeatable = false;
+	--_repeatable;
+	++_abandonedMessages;
+	_abandonedBytes += message.bytes;
+
+	UInt32 available;
+	BinaryReader& content = message.reader(available);
+	bool header = true;
+	for(UInt32 i=0;i<message.fragments.size();++i) {
+		UInt32 size = 4;
+		if(!header && size>_band.writer().available()) {
+			_band.flush(false);
+			header=true;
+		}
+		if(header)
+			size+=headerSize(stage);
+		if(size>_band.writer().available())
+			_band.flush(false);
+		size-=3;  // type + timestamp removed, before the "writeMessage"
+		flush(_band.writeMessage(header ? 0x10 : 0x11,(UInt16)size),stage++,0,header,content,0);
+		header=false;
+	}
 }
 
 UInt32 FlowWriter::headerSize(UInt64 stage) { // max size header = 50
@@ -436,12 +532,73 @@ void FlowWriter::flush(bool full) {
 	if(_messagesSent.size()>100)
 		DEBUG("_messagesSent.size()=%s",NumberFormatter::format(_messagesSent.size()).c_str());
 
+	measure();
+	if(!_scheduled && !_messages.empty()) {
+		// the band writes the messages on its next flush, by order of priority
+		_scheduled=true;
+		_band.scheduleFlowWriter(*this);
+	}
+
+	if(budget>0 && media() && bufferedBytes()>budget)
+		overflow(budget);
+
+	if(full)
+		_band.flush();
+}
+
+bool FlowWriter::send(UInt32 quantum) {
+	_deficit += quantum*(weight>0 ? weight : 1);
+	if(write(&_deficit))
+		return true;
+	_deficit=0;
+	_scheduled=false;
+	return false;
+}
+
+bool FlowWriter::write(UInt32* pDeficit) {
+	// returns true when the deficit stops the writing
+	measure();
+	Timestamp::TimeVal now = timeToLive>0 ? Timestamp().epochMicroseconds() : 0;
+
+	if(!_redundantStages.empty())
+		writeRedundancy();
+
 	// flush
 	bool header = !_band.canWriteFollowing(*this);
 
-	list<Message*>::const_iterator it=_messages.begin();
+	list<Message*>::iterator it=_messages.begin();
 	while(it!=_messages.end()) {
+		// stop while the receiver window is full, a following acknowledgment will resume
+		if(windowClosed())
+			return false;
 		Message& message(**it);
+
+		if(message.deadline>0 && now>=message.deadline) {
+			// expired before to be sent
+			++_abandonedMessages;
+			_abandonedBytes += message.bytes;
+			drop(it);
+			continue;
+		}
+
+		if(_waitKeyFrame) {
+			// video restarts on a key frame after an overflow
+			bool keyFrame;
+			if(MediaType(message,keyFrame)==Message::VIDEO) {
+				if(!keyFrame) {
+					drop(it);
+					continue;
+				}
+				_waitKeyFrame=false;
+			}
+		}
+
+		if(pDeficit) {
+			if(message.bytes>*pDeficit)
+				return true;
+			*pDeficit -= message.bytes;
+		}
+
 		if(message.repeatable) {
 			++_repeatable;
 			_trigger.start();
@@ -477,11 +634,19 @@ void FlowWriter::flush(bool full) {
 				flags |= MESSAGE_WITH_BEFOREPART;
 
 			bool head = header;
-			if(size>packet.available()) {
+			UInt32 limit = packet.available();
+			if(message.repeatable) {
+				// The path MTU can fall back before a repetition, and a stage can't be fragmented again:
+				// a repeatable fragment, with its full header, has to fit in a packet of the minimal MTU (11 bytes of session header)
+				UInt32 maxSize = RTMFP_MAX_PACKET_LENGTH-11-(header ? 0 : this->headerSize(_stage));
+				if(limit>maxSize)
+					limit = maxSize;
+			}
+			if(size>limit) {
 				// the packet will change! The message will be fragmented.
 				flags |= MESSAGE_WITH_AFTERPART;
-				contentSize = packet.available()-(size-contentSize);
-				size=packet.available();
+				contentSize = limit-(size-contentSize);
+				size=limit;
 				header=true;
 			} else
 				header=false; // the packet stays the same!
@@ -492,17 +657,169 @@ void FlowWriter::flush(bool full) {
 
 			message.fragments[fragments] = _stage;
 			available -= contentSize;
+			if(redundancy>0 && message.repeatable && ++_redundancyCount>=redundancy) {
+				_redundancyCount=0;
+				_redundantStages.push_back(_stage);
+			}
 			fragments += contentSize;
 
 		} while(available>0);
 
+		_bytesQueued -= message.bytes;
+		if(&message==_pLastMeasured)
+			_pLastMeasured=NULL;
+		(UInt32&)message.bytes = fragments;
+		_bytesInFlight += fragments;
 		_messagesSent.push_back(&message);
 		_messages.pop_front();
 		it=_messages.begin();
 	}
+	return false;
+}
 
-	if(full)
-		_band.flush();
+void FlowWriter::writeRedundancy() {
+	// Fragments sent in the previous packets are sent again before to be lost,
+	// the receiver ignores the duplicated stages, so any peer supports it
+	list<Message*>::const_iterator it=_messagesSent.begin();
+	UInt64 stage = _stageAck+1;
+	UInt64 lastStage = 0;
+	vector<UInt64>::const_iterator itStage;
+	for(itStage=_redundantStages.begin();itStage!=_redundantStages.end();++itStage) {
+		if(*itStage<stage)
+			continue; // already acknowledged
+		while(it!=_messagesSent.end() && !(*it)->fragments.empty() && *itStage>=(stage+(*it)->fragments.size())) {
+			stage += (*it)->fragments.size();
+			++it;
+		}
+		if(it==_messagesSent.end() || (*it)->fragments.empty())
+			break;
+		Message& message(**it);
+		if(!message.repeatable)
+			continue; // abandoned
+
+		map<UInt32,UInt64>::const_iterator itFrag=message.fragments.begin();
+		for(UInt64 i=stage;i<*itStage;++i)
+			++itFrag;
+		UInt32 available;
+		UInt32 fragment(itFrag->first);
+		BinaryReader& content = message.reader(fragment,available);
+		UInt32 contentSize = available;
+		++itFrag;
+
+		// Compute flags
+		UInt8 flags = 0;
+		if(fragment>0)
+			flags |= MESSAGE_WITH_BEFOREPART; // fragmented
+		if(itFrag!=message.fragments.end()) {
+			flags |= MESSAGE_WITH_AFTERPART;
+			contentSize = itFrag->first - fragment;
+		}
+
+		bool header = lastStage==0 || *itStage!=(lastStage+1);
+		UInt32 size = contentSize+4;
+		if(!header && size>_band.writer().available()) {
+			_band.flush(false);
+			header=true;
+		}
+		if(header)
+			size+=headerSize(*itStage);
+		if(size>_band.writer().available())
+			_band.flush(false);
+
+		// Write packet
+		size-=3;  // type + timestamp removed, before the "writeMessage"
+		flush(_band.writeMessage(header ? 0x10 : 0x11,(UInt16)size)
+			,*itStage,flags,header,content,contentSize);
+		_redundantSent.insert(*itStage);
+		lastStage = *itStage;
+	}
+	_redundantStages.clear();
+}
+
+void FlowWriter::measure() {
+	// sizes the messages queued since the last time, and gives them their deadline
+	Timestamp::TimeVal deadline = timeToLive>0 ? (Timestamp().epochMicroseconds()+(Timestamp::TimeVal)timeToLive*1000) : 0;
+	list<Message*>::reverse_iterator it;
+	for(it=_messages.rbegin();it!=_messages.rend() && *it!=_pLastMeasured;++it) {
+		UInt32 size(0);
+		(*it)->reader(size);
+		(UInt32&)(*it)->bytes = size;
+		(*it)->deadline = deadline;
+		_bytesQueued += size;
+	}
+	_pLastMeasured = _messages.empty() ? NULL : _messages.back();
+}
+
+void FlowWriter::drop(list<Message*>::iterator& it) {
+	Message* pMessage = *it;
+	_bytesQueued -= pMessage->bytes;
+	if(pMessage==_pLastMeasured) {
+		// the previous one becomes the last measured
+		list<Message*>::iterator itPrev(it);
+		_pLastMeasured = it==_messages.begin() ? NULL : *(--itPrev);
+	}
+	delete pMessage;
+	it = _messages.erase(it);
+}
+
+UInt8 FlowWriter::MediaType(Message& message,bool& keyFrame) {
+	UInt32 size(0);
+	BinaryReader& reader = message.reader(size);
+	keyFrame = true;
+	if(size<6)
+		return 0;
+	UInt8 type = reader.read8();
+	if(type==Message::VIDEO) {
+		reader.read32(); // time
+		keyFrame = (reader.read8()&0xF0) == 0x10;
+	} else if(type!=Message::AUDIO)
+		return 0;
+	return type;
+}
+
+UInt32 FlowWriter::overflow(UInt32 bytes) {
+	measure();
+	UInt32 buffered = bufferedBytes();
+	if(buffered<=bytes)
+		return 0;
+
+	UInt32 dropped=0;
+	if(overflowPolicy!=CLOSE_FLOW) {
+		// drops the oldest media messages not yet sent, the other messages are kept
+		list<Message*>::iterator it=_messages.begin();
+		while(it!=_messages.end() && (bufferedBytes()>bytes || _waitKeyFrame)) {
+			bool keyFrame;
+			UInt8 type = MediaType(**it,keyFrame);
+			if(type==0) {
+				++it;
+				continue;
+			}
+			if(bufferedBytes()<=bytes) {
+				// budget respected, continues only to reach the next video key frame
+				if(type!=Message::VIDEO) {
+					++it;
+					continue;
+				}
+				if(keyFrame) {
+					_waitKeyFrame=false;
+					break;
+				}
+			}
+			if(type==Message::VIDEO && overflowPolicy==DROP_UNTIL_KEYFRAME)
+				_waitKeyFrame=true;
+			drop(it);
+			++dropped;
+		}
+		if(dropped>0)
+			DEBUG("%u messages dropped on flowWriter %s, memory budget exceeded",dropped,NumberFormatter::format(id).c_str());
+	}
+
+	// nothing more to drop
+	bool failed = bufferedBytes()>bytes;
+	if(failed)
+		fail("memory budget exceeded, "+NumberFormatter::format(buffered)+" bytes buffered");
+	overflowHandler(dropped,failed);
+	return buffered>bufferedBytes() ? (buffered-bufferedBytes()) : 0;
 }
 
 void FlowWriter::beginTransaction() {
@@ -0,0 +1,139 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "GroupStrategy.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+using namespace std;
+using namespace Poco;
+
+namespace Cumulus {
+
+#define RING_FINGERS	6
+
+static RecentGroupStrategy	_Recent;
+static RingGroupStrategy	_Ring;
+
+GroupStrategy& GroupStrategy::Recent(_Recent);
+GroupStrategy& GroupStrategy::Ring(_Ring);
+
+void RecentGroupStrategy::neighbors(Group& group,const Peer& peer,GroupIntroducer& introducer) {
+	const list<Peer*>& members(Members(group));
+	list<Peer*>::const_reverse_iterator it;
+	UInt32 count=0;
+	for(it=members.rbegin();it!=members.rend() && count<5;++it) {
+		if(*it!=&peer && introducer.introduce(**it))
+			++count;
+	}
+	// + 1 random!
+	if(it!=members.rend()) {
+		const vector<Peer*>& peers(Peers(group));
+		introducer.introduce(*peers[rand() % peers.size()]);
+	}
+}
+
+bool RecentGroupStrategy::repair(Group& group,const Peer& peer,list<Peer*>::const_iterator itFollowing,Peer*& pMember,Peer*& pTarget) {
+	// gives to the following peer the 6th preceding peer
+	const list<Peer*>& members(Members(group));
+	if(itFollowing==members.end())
+		return false;
+	pTarget = *itFollowing;
+	UInt8 count=6;
+	while(--count!=0 && itFollowing!=members.begin())
+		--itFollowing;
+	if(count!=0)
+		return false;
+	pMember = *itFollowing;
+	return true;
+}
+
+void RingGroupStrategy::neighbors(Group& group,const Peer& peer,GroupIntroducer& introducer) {
+	const Group::RingMap& ring(RingMap(group));
+	if(ring.empty())
+		return;
+
+	// 2 successors and 2 predecessors, walks further on the ring while the introductions fail,
+	// until the two walks meet: on a small ring each member is visited once
+	Group::RingMap::const_iterator itNext = ring.lower_bound(peer.id);
+	Group::RingMap::const_iterator itPrev = itNext;
+	UInt8 successors=0,predecessors=0;
+	UInt32 visited=0;
+	while(visited<ring.size() && (successors<2 || predecessors<2)) {
+		if(successors<2) {
+			if(itNext==ring.end())
+				itNext = ring.begin();
+			if(itNext->second!=&peer && introducer.introduce(*itNext->second))
+				++successors;
+			++itNext;
+			if(++visited==ring.size())
+				break;
+		}
+		if(predecessors<2) {
+			if(itPrev==ring.begin())
+				itPrev = ring.end();
+			--itPrev;
+			if(itPrev->second!=&peer && introducer.introduce(*itPrev->second))
+				++predecessors;
+			++visited;
+		}
+	}
+
+	// fingers, at the half, the quarter, etc. of the ring from the peer id
+	UInt32 size = ring.size()/4;
+	UInt8 target[ID_SIZE];
+	for(UInt8 i=0;i<RING_FINGERS && size>0;++i,size/=2) {
+		memcpy(target,peer.id,ID_SIZE);
+		// adds 2^(255-i) modulo 2^256
+		UInt8 index = i/8;
+		UInt16 carry = 0x80>>(i%8);
+		while(carry>0) {
+			carry += target[index];
+			target[index] = (UInt8)carry;
+			carry >>= 8;
+			if(index==0)
+				break;
+			--index;
+		}
+		Group::RingMap::const_iterator it = ring.lower_bound(target);
+		for(UInt32 j=0;j<ring.size();++j,++it) {
+			if(it==ring.end())
+				it = ring.begin();
+			if(it->second!=&peer && introducer.introduce(*it->second))
+				break;
+		}
+	}
+}
+
+bool RingGroupStrategy::repair(Group& group,const Peer& peer,list<Peer*>::const_iterator itFollowing,Peer*& pMember,Peer*& pTarget) {
+	// gives to the ring predecessor of the leaving peer its ring successor
+	const Group::RingMap& ring(RingMap(group));
+	if(ring.size()<2)
+		return false;
+	Group::RingMap::const_iterator it = ring.lower_bound(peer.id);
+	if(it==ring.end())
+		it = ring.begin();
+	pMember = it->second;
+	if(it==ring.begin())
+		it = ring.end();
+	pTarget = (--it)->second;
+	return true;
+}
+
+
+} // namespace Cumulus
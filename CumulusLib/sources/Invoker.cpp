@@ -24,8 +24,8 @@ using namespace Poco;
 namespace Cumulus {
 
 
-Invoker::Invoker(UInt32 threads) : poolThreads(threads),sockets(*this),clients(_clients),groups(_groups),udpBufferSize(0),_streams(_publications),publications(_publications),
-	keepAliveServer(0),keepAlivePeer(0) {
+Invoker::Invoker(UInt32 threads) : poolThreads(threads),sockets(*this),clients(_clients),groups(_groups),udpBufferSize(0),_streams(_publications,*this),publications(_publications),
+	keepAliveServer(0),keepAlivePeer(0),fanOutThreshold(0),reorderWindow(128),ackPackets(1),ackDelay(0),receiveBuffer(0x7F*1024),writerBudget(0),sessionBudget(0),memoryCeiling(0),overflowPolicy(FlowWriter::DROP_OLDEST),audioTimeToLive(0),videoTimeToLive(0),mtu(0),fecLostRate(0),pGroupStrategy(&GroupStrategy::Recent),groupIntroductions(0),acks(0),dataPackets(0),bufferedBytes(0),abandonedMessages(0),abandonedBytes(0) {
 	DEBUG("%u threads available in the server poolthreads",poolThreads.threadsAvailable());
 }
 
@@ -41,6 +41,16 @@ Invoker::~Invoker() {
 		delete it2->second;
 }
 
+void Invoker::onHandled() {
+	// a task never lets a fan-out running for the next one
+	waitFanOuts();
+}
+
+void Invoker::waitFanOuts() {
+	while(_fanOuts.value()>0)
+		_fanOutsDone.wait();
+}
+
 Publication& Invoker::publish(const string& name) {
 	UInt32 stream = _streams.create();
 	try {
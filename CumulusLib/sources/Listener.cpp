@@ -27,7 +27,7 @@ namespace Cumulus {
 
 class StreamWriter : public FlowWriter {
 public:
-	StreamWriter(UInt8 type,const string& signature,BandWriter& band) : FlowWriter(signature,band),_type(type),reseted(false),pClient(NULL) {	}
+	StreamWriter(UInt8 type,const string& signature,BandWriter& band) : FlowWriter(signature,band),_type(type),reseted(false),overflowed(false),pClient(NULL),fecLostRate(0) {	}
 	~StreamWriter() {}
 
 	void write(UInt32 time,PacketReader& data,bool unbuffered) {
@@ -57,13 +57,22 @@ public:
 
 	QualityOfService	qos;
 	bool				reseted;
+	bool				overflowed;
 	const Client*		pClient;
+	UInt8				fecLostRate; // lost rate in percent from which the redundancy starts, 0 disables it
 
 private:
 	void ackMessageHandler(UInt32 ackCount,UInt32 lostCount,BinaryReader& content,UInt32 available,UInt32 size) {
 		if(available==0 || content.read8()!=_type)
 			return;
 		qos.add(content.read32(),ackCount,lostCount,size,pClient ? pClient->ping : 0);
+		if(fecLostRate==0)
+			return;
+		// repeats twice more fragments than the lost ones
+		if(qos.lostRate*100<fecLostRate)
+			redundancy = 0;
+		else
+			redundancy = qos.lostRate>=0.5 ? 1 : (UInt8)(0.5/qos.lostRate);
 	}
 
 	// call on FlowWriter failed, we must rewritting bound infos
@@ -72,23 +81,33 @@ private:
 		qos.reset();
 	}
 
+	void overflowHandler(UInt32 dropped,bool failed) {
+		(UInt32&)qos.droppedFrames += dropped;
+		if(failed)
+			overflowed=true;
+	}
+
+	void recoveryHandler(UInt32 recovered) {
+		(UInt32&)qos.recoveredFragments += recovered;
+	}
+
 	UInt8 _type;
 };
 
 class AudioWriter : public StreamWriter {
 public:
-	AudioWriter(const string& signature,BandWriter& band) : StreamWriter(0x08,signature,band){}
+	AudioWriter(const string& signature,BandWriter& band) : StreamWriter(0x08,signature,band){priority=AUDIO;}
 };
 
 class VideoWriter : public StreamWriter {
 public:
-	VideoWriter(const string& signature,BandWriter& band) : StreamWriter(0x09,signature,band){}
+	VideoWriter(const string& signature,BandWriter& band) : StreamWriter(0x09,signature,band){priority=VIDEO;}
 };
 
 Listener::Listener(UInt32 id,Publication& publication,FlowWriter& writer,bool unbuffered) :
 	_unbuffered(unbuffered),_writer(writer),_boundId(0),audioSampleAccess(false),videoSampleAccess(false),
 	id(id),publication(publication),_firstKeyFrame(false),receiveAudio(true),receiveVideo(true),
-	_pAudioWriter(NULL),_pVideoWriter(NULL),
+	_pAudioWriter(NULL),_pVideoWriter(NULL),_pClient(NULL),_pLayer(NULL),_pNextLayer(NULL),
 	_time(0),_deltaTime(0),_addingTime(0) {
 }
 
@@ -99,15 +118,20 @@ Listener::~Listener() {
 		_pVideoWriter->close();
 }
 
-void Listener::init(const Client& client) {
+void Listener::init(const Client& client,UInt32 audioTimeToLive,UInt32 videoTimeToLive,UInt8 fecLostRate) {
+	_pClient = &client;
 	if(!_pAudioWriter) {
 		_pAudioWriter = &_writer.newFlowWriter<AudioWriter>();
 		_pAudioWriter->pClient = &client;
+		_pAudioWriter->timeToLive = audioTimeToLive;
+		_pAudioWriter->fecLostRate = fecLostRate;
 	} else
 		WARN("Listener %u audio track has already been initialized",id);
 	if(!_pVideoWriter) {
 		_pVideoWriter = &_writer.newFlowWriter<VideoWriter>();
 		_pVideoWriter->pClient = &client;
+		_pVideoWriter->timeToLive = videoTimeToLive;
+		_pVideoWriter->fecLostRate = fecLostRate;
 	} else
 		WARN("Listener %u video track has already been initialized",id);
 	writeBounds();
@@ -148,6 +172,46 @@ UInt32 Listener::computeTime(UInt32 time) {
 	return _time;
 }
 
+void Listener::resetLayer(const Publication& layer) {
+	if(_pNextLayer==&layer)
+		_pNextLayer=NULL;
+	if(_pLayer==&layer)
+		_pLayer=NULL;
+}
+
+bool Listener::switchLayer(const Publication& layer,UInt32 time,bool keyFrame) {
+	if(&layer==_pLayer) {
+		// on each key frame, checks if an other layer fits better (2 sec min between switchs to go down, 10 sec to go up)
+		if(keyFrame && _layerTime.isElapsed(2000000)) {
+			const Publication* pLayer = publication.selectLayer(_pLayer,videoQOS());
+			if(pLayer!=_pLayer && (pLayer->videoQOS().byteRate<_pLayer->videoQOS().byteRate || _layerTime.isElapsed(10000000)))
+				_pNextLayer = pLayer;
+		}
+		return true;
+	}
+	// switch only on a key frame of the wanted layer
+	if(!keyFrame)
+		return false;
+	if(_pLayer) {
+		if(&layer!=_pNextLayer)
+			return false;
+	} else if(&layer!=publication.selectLayer(NULL,videoQOS()))
+		return false;
+
+	if(_time>0) {
+		// timestamps continue from the last one written
+		_deltaTime = time==0 ? 1 : time;
+		_addingTime = _time;
+	}
+	if(_pVideoWriter)
+		_pVideoWriter->qos.reset();
+	DEBUG("Listener %u switches on the layer %s",id,layer.name().c_str());
+	_pLayer = &layer;
+	_pNextLayer = NULL;
+	_layerTime.update();
+	return true;
+}
+
 void Listener::writeBound(FlowWriter& writer) {
 	DEBUG("Writing bound %u on flow writer %s",_boundId,NumberFormatter::format(writer.id).c_str());
 	BinaryWriter& data = writer.writeRawMessage();
@@ -179,9 +243,19 @@ void Listener::stopPublishing(const string& name) {
 }
 
 
-void Listener::pushDataPacket(const string& name,PacketReader& packet) {
+void Listener::closeOnOverflow() {
+	// the listener doesn't read fast enough, its media stop until a new receiveAudio/receiveVideo
+	WARN("Listener %u closed, memory budget exceeded",id);
+	_writer.writeStatusResponse("Play.InsufficientBW","Not enough bandwidth to play " + publication.name());
+	receiveAudio=receiveVideo=false;
+	_firstKeyFrame=false;
+}
+
+void Listener::pushDataPacket(const string& name,PacketReader& packet,const Publication* pLayer,bool shared) {
+	if(pLayer && pLayer!=_pLayer)
+		return;
 	// TODO create _dataWriter ??
-	if(_unbuffered) {
+	if(_unbuffered && !shared) {
 		UInt16 offset = name.size()+9;
 		if(packet.position()>=offset) {
 			packet.reset(packet.position()-offset);
@@ -193,7 +267,9 @@ void Listener::pushDataPacket(const string& name,PacketReader& packet) {
 	StreamCopier::copyStream(packet.stream(),_writer.writeAMFPacket(name).writer.stream());
 }
 
-void Listener::pushVideoPacket(UInt32 time,PacketReader& packet) {
+void Listener::pushVideoPacket(UInt32 time,PacketReader& packet,const Publication* pLayer,bool shared) {
+	if(pLayer && !switchLayer(*pLayer,time,((*packet.current())&0xF0) == 0x10))
+		return;
 	if(!receiveVideo) {
 		_firstKeyFrame=false;
 		return;
@@ -212,27 +288,39 @@ void Listener::pushVideoPacket(UInt32 time,PacketReader& packet) {
 		return;
 	}
 
+	if(_pVideoWriter->overflowed) {
+		_pVideoWriter->overflowed=false;
+		closeOnOverflow();
+		return;
+	}
 	if(_pVideoWriter->reseted) {
 		_pVideoWriter->reseted=false;
 		writeBounds();
 	}
 
-	_pVideoWriter->write(computeTime(time),packet,_unbuffered);
+	_pVideoWriter->write(computeTime(time),packet,_unbuffered && !shared);
 }
 
 
-void Listener::pushAudioPacket(UInt32 time,PacketReader& packet) {
+void Listener::pushAudioPacket(UInt32 time,PacketReader& packet,const Publication* pLayer,bool shared) {
+	if(pLayer && pLayer!=_pLayer)
+		return;
 	if(!receiveAudio)
 		return;
 	if(!_pAudioWriter) {
 		ERROR("Listener %u must be initialized before to be used",id);
 		return;
 	}
+	if(_pAudioWriter->overflowed) {
+		_pAudioWriter->overflowed=false;
+		closeOnOverflow();
+		return;
+	}
 	if(_pAudioWriter->reseted) {
 		_pAudioWriter->reseted=false;
 		writeBounds();
 	}
-	_pAudioWriter->write(computeTime(time),packet,_unbuffered);
+	_pAudioWriter->write(computeTime(time),packet,_unbuffered && !shared);
 }
 
 void Listener::flush() {
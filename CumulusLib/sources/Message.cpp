@@ -16,7 +16,9 @@
 */
 
 #include "Message.h"
+#include "Poco/Mutex.h"
 #include <cstring>
+#include <vector>
 
 using namespace std;
 using namespace Poco;
@@ -24,7 +26,7 @@ using namespace Poco::Net;
 
 namespace Cumulus {
 
-Message::Message(istream& istr,bool repeatable) : _reader(istr),repeatable(repeatable) {
+Message::Message(istream& istr,bool repeatable) : _reader(istr),repeatable(repeatable),bytes(0),deadline(0) {
 	
 }
 
@@ -50,6 +52,39 @@ BinaryReader& Message::memAck(Poco::UInt32& available,Poco::UInt32& size) {
 	return result;
 }
 
+#define MESSAGES_FREE_MAX	4096
+
+static FastMutex		_MessagesMutex;
+static vector<void*>	_Messages; // free memory of MessageBuffered instances
+
+UInt64 MessageBuffered::Allocations(0);
+UInt64 MessageBuffered::Recycled(0);
+
+void* MessageBuffered::operator new(size_t size) {
+	if(size==sizeof(MessageBuffered)) { // not for the subclasses
+		ScopedLock<FastMutex> lock(_MessagesMutex);
+		if(!_Messages.empty()) {
+			void* pMemory = _Messages.back();
+			_Messages.pop_back();
+			++Recycled;
+			return pMemory;
+		}
+		++Allocations;
+	}
+	return ::operator new(size);
+}
+
+void MessageBuffered::operator delete(void* pMemory,size_t size) {
+	if(pMemory && size==sizeof(MessageBuffered)) {
+		ScopedLock<FastMutex> lock(_MessagesMutex);
+		if(_Messages.size()<MESSAGES_FREE_MAX) {
+			_Messages.push_back(pMemory);
+			return;
+		}
+	}
+	::operator delete(pMemory);
+}
+
 MessageBuffered::MessageBuffered(bool repeatable) : rawWriter(_stream),amfWriter(rawWriter),Message(_stream,repeatable) {
 	
 }
@@ -18,6 +18,7 @@
 #include "Peer.h"
 #include "Group.h"
 #include "Handler.h"
+#include "GroupStrategy.h"
 #include "Util.h"
 
 using namespace std;
@@ -27,9 +28,42 @@ namespace Cumulus {
 
 class Member {
 public:
-	Member(Poco::UInt32	index,FlowWriter* pWriter) : index(index),pWriter(pWriter){}
-	const Poco::UInt32	index;
-	FlowWriter*			pWriter;
+	Member(Poco::UInt32	position,list<Peer*>::iterator itMember,FlowWriter* pWriter) : position(position),itMember(itMember),pWriter(pWriter),introductions(0){}
+	Poco::UInt32					position; // in Group::_peers
+	const list<Peer*>::iterator		itMember; // in Group::_members
+	FlowWriter*						pWriter;
+
+	// introductions of this member to the newcomers, by minute
+	Poco::UInt32					introductions;
+	Poco::Timestamp					introductionsTime;
+};
+
+class PeerIntroducer : public GroupIntroducer {
+public:
+	PeerIntroducer(Peer& peer,Group& group,FlowWriter* pWriter) : count(0),pFirst(NULL),_peer(peer),_group(group),_pWriter(pWriter) {}
+
+	bool introduce(Peer& member) {
+		if(&member==&_peer)
+			return false;
+		if(!pFirst)
+			pFirst = &member;
+		// only distinct introductions count, the strategy goes on to an other member
+		if(_introduced.find(&member)!=_introduced.end())
+			return false;
+		if(!member.introduce(_group) || !_peer.writeId(_group,member,_pWriter))
+			return false;
+		_introduced.insert(&member);
+		++count;
+		return true;
+	}
+
+	Poco::UInt32	count;
+	Peer*			pFirst;
+private:
+	Peer&			_peer;
+	Group&			_group;
+	FlowWriter*		_pWriter;
+	set<Peer*>		_introduced;
 };
 
 Peer::Peer(Handler& handler):_handler(handler),connected(false),addresses(1) {
@@ -74,30 +108,29 @@ bool Peer::writeId(Group& group,Peer& peer,FlowWriter* pWriter) {
 	return true;
 }
 
-void Peer::joinGroup(Group& group,FlowWriter* pWriter) {
-	UInt16 count=5;
-	Group::Iterator it0=group.end();
-	while(group.size()>0) {
-		if(group.begin()==it0)
-			break;
-		--it0;
-		Client& client = **it0;
-		if(client==this->id)
-			continue;
-		if(!writeId(group,(Peer&)client,pWriter))
-			continue;
-		if(--count==0)
-			break;
-	}
-	// + 1 random!
-	if(it0!=group.end()) {
-		Group::Iterator itBegin = group.begin();
-		UInt32 distance = Group::Distance(itBegin,it0);
-		if(distance>0) {
-			Group::Advance(itBegin,rand() % distance);
-			writeId(group,(Peer&)**itBegin,pWriter);
-		}
+bool Peer::introduce(Group& group) {
+	if(_handler.groupIntroductions==0)
+		return true;
+	map<Group*,Member*>::const_iterator it = _groups.find(&group);
+	if(it==_groups.end())
+		return false;
+	Member& member(*it->second);
+	if(member.introductionsTime.isElapsed(60000000)) {
+		member.introductions=0;
+		member.introductionsTime.update();
 	}
+	if(member.introductions>=_handler.groupIntroductions)
+		return false;
+	++member.introductions;
+	return true;
+}
+
+void Peer::joinGroup(Group& group,FlowWriter* pWriter) {
+	PeerIntroducer introducer(*this,group,pWriter);
+	_handler.pGroupStrategy->neighbors(group,*this,introducer);
+	// every member has reached its introductions cap, the newcomer must have at least one neighbor
+	if(introducer.count==0 && introducer.pFirst)
+		writeId(group,*introducer.pFirst,pWriter);
 
 	map<Group*,Member*>::iterator it = _groups.lower_bound(&group);
 	if(it!=_groups.end() && it->first==&group)
@@ -106,19 +139,10 @@ void Peer::joinGroup(Group& group,FlowWriter* pWriter) {
 	if(it!=_groups.begin())
 		--it;
 
-	UInt32 index = 0;
-	if(!group._peers.empty()){
-		index = group._peers.rbegin()->first+1;
-		if(index<group._peers.rbegin()->first) {
-			// max index reached, rewritten index!
-			index=0;
-			map<UInt32,Peer*>::iterator it1;
-			for(it1=group._peers.begin();it1!=group._peers.end();++it1)
-				(UInt32&)it1->first = index++;
-		}
-	}
-	group._peers[index] = this;
-	_groups.insert(it,pair<Group*,Member*>(&group,new Member(index,pWriter)));
+	group._peers.push_back(this);
+	group._members.push_back(this);
+	group._ring[id] = this;
+	_groups.insert(it,pair<Group*,Member*>(&group,new Member(group._peers.size()-1,--group._members.end(),pWriter)));
 	onJoinGroup(group);
 }
 
@@ -192,8 +216,19 @@ void Peer::onJoinGroup(Group& group) {
 
 void Peer::onUnjoinGroup(map<Group*,Member*>::iterator it) {
 	Group& group = *it->first;
-	map<UInt32,Peer*>::iterator itPeer = group._peers.find(it->second->index);
-	group._peers.erase(itPeer++);
+	Member& member(*it->second);
+
+	// the last peer takes the place left
+	Peer* pLast = group._peers.back();
+	if(pLast!=this) {
+		group._peers[member.position] = pLast;
+		map<Group*,Member*>::const_iterator itLast = pLast->_groups.find(&group);
+		if(itLast!=pLast->_groups.end())
+			itLast->second->position = member.position;
+	}
+	group._peers.pop_back();
+	group._ring.erase(id);
+	list<Peer*>::iterator itPeer = group._members.erase(member.itMember);
 	delete it->second;
 	_groups.erase(it);
 
@@ -203,14 +238,12 @@ void Peer::onUnjoinGroup(map<Group*,Member*>::iterator it) {
 	if(group.size()==0) {
 		_handler._groups.erase(group.id);
 		delete &group;
-	} else if(itPeer!=group._peers.end()) {
-		// if a peer disconnects of one group, give to its following peer the 6th preceding peer
-		Peer& followingPeer = *itPeer->second;
-		UInt8 count=6;
-		while(--count!=0 && itPeer!=group._peers.begin())
-			--itPeer;
-		if(count==0)
-			itPeer->second->writeId(group,followingPeer,NULL);
+	} else {
+		// if a peer disconnects of one group, repair the mesh around the place left
+		Peer* pMember=NULL;
+		Peer* pTarget=NULL;
+		if(_handler.pGroupStrategy->repair(group,*this,itPeer,pMember,pTarget))
+			pMember->writeId(group,*pTarget,NULL);
 	}
 }
 
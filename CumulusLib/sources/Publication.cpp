@@ -16,8 +16,13 @@
 */
 
 #include "Publication.h"
+#include "Invoker.h"
 #include "Logs.h"
+#include "Poco/Buffer.h"
+#include "Poco/RefCountedObject.h"
+#include "Poco/AtomicCounter.h"
 #include <cstring>
+#include <algorithm>
 
 using namespace std;
 using namespace Poco;
@@ -25,11 +30,99 @@ using namespace Poco;
 
 namespace Cumulus {
 
-Publication::Publication(const string& name):_publisherId(0),_name(name),_firstKeyFrame(false),listeners(_listeners),_pPublisher(NULL),_pController(NULL) {
+// Packet copied once for all the shards of a fan-out, released by the last one
+class FanOutPacket : public RefCountedObject {
+public:
+	FanOutPacket(Publication& publication,PacketReader* pPacket,UInt32 shards) : publication(publication),shards(shards),position(0),buffer(pPacket ? (pPacket->position()+pPacket->available()) : 0) {
+		if(!pPacket)
+			return;
+		position = pPacket->position();
+		memcpy(buffer.begin(),pPacket->current()-position,buffer.size());
+	}
+
+	Publication&		publication;
+	Timestamp			start;
+	AtomicCounter		shards;
+	UInt32				position;
+	Buffer<UInt8>		buffer;
+};
+
+class FanOut : public WorkThread {
+public:
+	FanOut(const vector<Listener*>& listeners,UInt8 type,UInt32 time,const string& name,AutoPtr<FanOutPacket>& pPacket,const Publication* pLayer,Invoker& invoker) : _listeners(listeners),_type(type),_time(time),_name(name),_pPacket(pPacket),_pLayer(pLayer),_invoker(invoker) {
+		++_invoker._fanOuts;
+	}
+	~FanOut() {
+		if(--_invoker._fanOuts==0)
+			_invoker._fanOutsDone.set();
+	}
+
+	// "shared" when other threads read the same packet, it must not be written in place
+	static void Push(const vector<Listener*>& listeners,UInt8 type,UInt32 time,const string& name,PacketReader* pPacket,const Publication* pLayer,bool shared=false) {
+		UInt32 pos = pPacket ? pPacket->position() : 0;
+		vector<Listener*>::const_iterator it;
+		for(it=listeners.begin();it!=listeners.end();++it) {
+			switch(type) {
+				case Message::AUDIO:
+					(*it)->pushAudioPacket(time,*pPacket,pLayer,shared);
+					break;
+				case Message::VIDEO:
+					(*it)->pushVideoPacket(time,*pPacket,pLayer,shared);
+					break;
+				case Message::AMF:
+					(*it)->pushDataPacket(name,*pPacket,pLayer,shared);
+					break;
+				default:
+					(*it)->flush();
+					continue;
+			}
+			pPacket->reset(pos);
+		}
+	}
+
+private:
+	void run() {
+		try {
+			if(_type==Message::AUDIO || _type==Message::VIDEO || _type==Message::AMF) {
+				PacketReader packet(_pPacket->buffer.begin(),_pPacket->buffer.size());
+				packet.reset(_pPacket->position);
+				Push(_listeners,_type,_time,_name,&packet,_pLayer,true);
+			} else
+				Push(_listeners,_type,_time,_name,NULL,_pLayer,true);
+		} catch(Exception& ex) {
+			ERROR("Publication fan-out, %s",ex.displayText().c_str());
+		} catch(exception& ex) {
+			ERROR("Publication fan-out, %s",ex.what());
+		} catch(...) {
+			ERROR("Publication fan-out, unknown error");
+		}
+		if(--_pPacket->shards==0)
+			_pPacket->publication.fanOutDone(_pPacket->start.elapsed());
+	}
+
+	const vector<Listener*>&	_listeners;
+	UInt8						_type;
+	UInt32						_time;
+	const string				_name;
+	AutoPtr<FanOutPacket>		_pPacket;
+	const Publication*			_pLayer;
+	Invoker&					_invoker;
+};
+
+
+Publication::Publication(const string& name,Invoker& invoker):_publisherId(0),_name(name),_firstKeyFrame(false),listeners(_listeners),_pPublisher(NULL),_pController(NULL),
+	_invoker(invoker),_pSimulcast(NULL),_shardsChanged(true),_fanOutTime(0),_fanOutCount(0),_fanOutPeak(0) {
 	DEBUG("New publication %s",_name.c_str());
 }
 
 Publication::~Publication() {
+	_invoker.waitFanOuts();
+	if(_pSimulcast)
+		_pSimulcast->_layers.erase(find(_pSimulcast->_layers.begin(),_pSimulcast->_layers.end(),this));
+	vector<Publication*>::const_iterator itLayer;
+	for(itLayer=_layers.begin();itLayer!=_layers.end();++itLayer)
+		(*itLayer)->_pSimulcast = NULL;
+
 	// delete _listeners!
 	map<UInt32,Listener*>::iterator it;
 	for(it=_listeners.begin();it!=_listeners.end();++it)
@@ -40,6 +133,7 @@ Publication::~Publication() {
 
 
 Listener& Publication::addListener(Peer& peer,UInt32 id,FlowWriter& writer,bool unbuffered) {
+	_invoker.waitFanOuts();
 	map<UInt32,Listener*>::iterator it = _listeners.lower_bound(id);
 	if(it!=_listeners.end() && it->first==id) {
 		WARN("Listener %u is already subscribed for publication %u",id,_publisherId);
@@ -51,9 +145,10 @@ Listener& Publication::addListener(Peer& peer,UInt32 id,FlowWriter& writer,bool
 	string error;
 	if(peer.onSubscribe(*pListener,error)) {
 		_listeners.insert(it,pair<UInt32,Listener*>(id,pListener));
+		_shardsChanged=true;
 		writer.writeStatusResponse("Play.Reset","Playing and resetting " + _name);
 		writer.writeStatusResponse("Play.Start","Started playing " + _name);
-		pListener->init(peer);
+		pListener->init(peer,_invoker.audioTimeToLive,_invoker.videoTimeToLive,_invoker.fecLostRate);
 		return *pListener;
 	}
 	if(error.empty())
@@ -64,6 +159,7 @@ Listener& Publication::addListener(Peer& peer,UInt32 id,FlowWriter& writer,bool
 }
 
 void Publication::removeListener(Peer& peer,UInt32 id) {
+	_invoker.waitFanOuts();
 	map<UInt32,Listener*>::iterator it = _listeners.find(id);
 	if(it==_listeners.end()) {
 		WARN("Listener %u is already unsubscribed of publication %u",id,_publisherId);
@@ -72,6 +168,7 @@ void Publication::removeListener(Peer& peer,UInt32 id) {
 	Listener* pListener = it->second;
 	peer.onUnsubscribe(*pListener);
 	_listeners.erase(it);
+	_shardsChanged=true;
 	delete pListener;
 }
 
@@ -90,8 +187,9 @@ void Publication::closePublisher(const std::string& code,const std::string& desc
 }
 
 void Publication::start(Peer& peer,UInt32 publisherId,FlowWriter* pController) {
-	if(_publisherId!=0) {
-		// has already a publisher
+	_invoker.waitFanOuts();
+	if(_publisherId!=0 || !_layers.empty()) {
+		// has already a publisher, or is a simulcast publication
 		if(pController)
 			pController->writeStatusResponse("Publish.BadName",_name + " is already published");
 		throw Exception(_name + " is already published");
@@ -124,6 +222,7 @@ void Publication::stop(Peer& peer,UInt32 publisherId) {
 		WARN("Unpublish '%s' operation with a %u id different than its publisher %u id",_name.c_str(),publisherId,_publisherId);
 		return;
 	}
+	_invoker.waitFanOuts();
 	map<UInt32,Listener*>::const_iterator it;
 	for(it=_listeners.begin();it!=_listeners.end();++it)
 		it->second->stopPublishing(_name);
@@ -131,16 +230,160 @@ void Publication::stop(Peer& peer,UInt32 publisherId) {
 	peer.onUnpublish(*this);
 	_videoQOS.reset();
 	_audioQOS.reset();
+	{
+		ScopedLock<FastMutex> lock(_fanOutMutex);
+		_fanOutTime=_fanOutCount=_fanOutPeak=0;
+	}
 	_publisherId = 0;
 	_pPublisher=NULL;
 	_pController=NULL;
 	return;
 }
 
-void Publication::flush() {
+void Publication::addLayer(Publication& layer) {
+	if(_publisherId!=0) {
+		WARN("Publication %s is already published, %s can't be one of its simulcast layers",_name.c_str(),layer.name().c_str());
+		return;
+	}
+	if(layer._pSimulcast) {
+		WARN("Publication %s is already a simulcast layer of %s",layer.name().c_str(),layer._pSimulcast->name().c_str());
+		return;
+	}
+	layer._pSimulcast = this;
+	_layers.push_back(&layer);
+	DEBUG("Publication %s is a new simulcast layer of %s",layer.name().c_str(),_name.c_str());
+	if(_layers.size()>1)
+		return;
 	map<UInt32,Listener*>::const_iterator it;
 	for(it=_listeners.begin();it!=_listeners.end();++it)
-		it->second->flush();
+		it->second->startPublishing(_name);
+	flush();
+}
+
+void Publication::removeLayer(Publication& layer) {
+	vector<Publication*>::iterator itLayer = find(_layers.begin(),_layers.end(),&layer);
+	if(itLayer==_layers.end())
+		return;
+	_layers.erase(itLayer);
+	layer._pSimulcast = NULL;
+	map<UInt32,Listener*>::const_iterator it;
+	for(it=_listeners.begin();it!=_listeners.end();++it) {
+		it->second->resetLayer(layer);
+		if(_layers.empty())
+			it->second->stopPublishing(_name);
+	}
+	flush();
+}
+
+const Publication* Publication::selectLayer(const Publication* pCurrent,const QualityOfService& qos) const {
+	// layers are ordered on their real video byte rate
+	const Publication* pLowest=NULL;
+	const Publication* pLower=NULL;
+	const Publication* pHigher=NULL;
+	double rate = pCurrent ? pCurrent->videoQOS().byteRate : 0;
+	vector<Publication*>::const_iterator it;
+	for(it=_layers.begin();it!=_layers.end();++it) {
+		const Publication* pLayer(*it);
+		if(pLayer->publisherId()==0)
+			continue;
+		double layerRate = pLayer->videoQOS().byteRate;
+		if(!pLowest || layerRate<pLowest->videoQOS().byteRate)
+			pLowest = pLayer;
+		if(!pCurrent || pLayer==pCurrent)
+			continue;
+		if(layerRate<rate) {
+			if(!pLower || layerRate>pLower->videoQOS().byteRate)
+				pLower = pLayer;
+		} else if(layerRate>rate && (!pHigher || layerRate<pHigher->videoQOS().byteRate))
+			pHigher = pLayer;
+	}
+	if(!pCurrent)
+		return pLowest;
+	if(qos.lostRate>0.05 || qos.congestionRate>0.1)
+		return pLower ? pLower : pCurrent;
+	if(qos.lostRate==0 && qos.congestionRate<=0)
+		return pHigher ? pHigher : pCurrent;
+	return pCurrent;
+}
+
+void Publication::buildShards() {
+	_shardsChanged=false;
+	_shards.clear();
+	_shardThreads.clear();
+	UInt32 count = _invoker.fanOutThreshold==0 ? 1 : (_listeners.size()+_invoker.fanOutThreshold-1)/_invoker.fanOutThreshold;
+	if(count>_invoker.poolThreads.threadsAvailable())
+		count = _invoker.poolThreads.threadsAvailable();
+	if(count==0)
+		count=1;
+	_shards.resize(count);
+	_shardThreads.resize(count,NULL);
+	// listeners of a same client stay on the same shard, its session is not thread-safe
+	map<const Client*,UInt32> clients;
+	UInt32 next=0;
+	map<UInt32,Listener*>::const_iterator it;
+	for(it=_listeners.begin();it!=_listeners.end();++it) {
+		map<const Client*,UInt32>::iterator itClient = clients.lower_bound(it->second->client());
+		if(itClient==clients.end() || itClient->first!=it->second->client()) {
+			itClient = clients.insert(itClient,pair<const Client*,UInt32>(it->second->client(),next));
+			next = (next+1)%count;
+		}
+		_shards[itClient->second].push_back(it->second);
+	}
+	if(count>1)
+		DEBUG("Publication %s fan-out splitted in %u shards",_name.c_str(),count);
+}
+
+void Publication::fanOut(UInt8 type,UInt32 time,const string& name,PacketReader* pPacket,const Publication* pLayer) {
+	if(_shardsChanged) {
+		// the listeners can change of shard and of thread, the previous fan-outs must be done
+		_invoker.waitFanOuts();
+		buildShards();
+	}
+
+	if(_shards.size()==1) {
+		Timestamp start;
+		FanOut::Push(_shards.front(),type,time,name,pPacket,pLayer);
+		fanOutDone(start.elapsed());
+		return;
+	}
+
+	// Hand-off to the pool threads, the main thread doesn't wait: before to touch again the listener sessions
+	// it calls Invoker::waitFanOuts, at the latest when its current task is handled
+	AutoPtr<FanOutPacket> pShared(new FanOutPacket(*this,pPacket,_shards.size()));
+	for(UInt32 i=0;i<_shards.size();++i) {
+		AutoPtr<FanOut> pJob(new FanOut(_shards[i],type,time,name,pShared,pLayer,_invoker));
+		try {
+			_shardThreads[i] = _invoker.poolThreads.enqueue(pJob.cast<WorkThread>(),_shardThreads[i]);
+		} catch(Exception& ex) {
+			WARN("Publication %s fan-out on the main thread, %s",_name.c_str(),ex.displayText().c_str());
+			// after the previous packets of this shard
+			pJob = NULL;
+			_invoker.waitFanOuts();
+			FanOut::Push(_shards[i],type,time,name,pPacket,pLayer);
+			if(--pShared->shards==0)
+				fanOutDone(pShared->start.elapsed());
+		}
+	}
+}
+
+void Publication::waitFanOut() {
+	_invoker.waitFanOuts();
+}
+
+void Publication::fanOutDone(Int64 elapsed) {
+	ScopedLock<FastMutex> lock(_fanOutMutex);
+	_fanOutTime += elapsed;
+	++_fanOutCount;
+	if(elapsed>_fanOutPeak)
+		_fanOutPeak = elapsed;
+}
+
+void Publication::flush() {
+	fanOut(Message::EMPTY,0,_name,NULL);
+	if(_pSimulcast) {
+		_invoker.waitFanOuts();
+		_pSimulcast->flush();
+	}
 }
 
 void Publication::pushDataPacket(const string& name,PacketReader& packet) {
@@ -148,11 +391,11 @@ void Publication::pushDataPacket(const string& name,PacketReader& packet) {
 		ERROR("Data packet pushed on a publication %u who is idle",_publisherId);
 		return;
 	}
-	int pos = packet.position();
-	map<UInt32,Listener*>::const_iterator it;
-	for(it=_listeners.begin();it!=_listeners.end();++it) {
-		it->second->pushDataPacket(name,packet);
-		packet.reset(pos);
+	fanOut(Message::AMF,0,name,&packet);
+	if(_pSimulcast) {
+		// a listener of the simulcast publication can share its session with a listener of this layer
+		_invoker.waitFanOuts();
+		_pSimulcast->fanOut(Message::AMF,0,name,&packet,this);
 	}
 	_pPublisher->onDataPacket(*this,name,packet);
 }
@@ -163,14 +406,13 @@ void Publication::pushAudioPacket(UInt32 time,PacketReader& packet,UInt32 number
 		return;
 	}
 
-	int pos = packet.position();
 	if(numberLostFragments>0)
 		INFO("%u audio fragments lost on publication %u",numberLostFragments,_publisherId);
 	_audioQOS.add(time,packet.fragments,numberLostFragments,packet.available()+5,_pPublisher ? _pPublisher->ping : 0);
-	map<UInt32,Listener*>::const_iterator it;
-	for(it=_listeners.begin();it!=_listeners.end();++it) {
-		it->second->pushAudioPacket(time,packet);
-		packet.reset(pos);
+	fanOut(Message::AUDIO,time,_name,&packet);
+	if(_pSimulcast) {
+		_invoker.waitFanOuts();
+		_pSimulcast->fanOut(Message::AUDIO,time,_name,&packet,this);
 	}
 	_pPublisher->onAudioPacket(*this,time,packet);
 }
@@ -200,11 +442,10 @@ void Publication::pushVideoPacket(UInt32 time,PacketReader& packet,UInt32 number
 		return;
 	}
 
-	int pos = packet.position();
-	map<UInt32,Listener*>::const_iterator it;
-	for(it=_listeners.begin();it!=_listeners.end();++it) {
-		it->second->pushVideoPacket(time,packet);
-		packet.reset(pos);
+	fanOut(Message::VIDEO,time,_name,&packet);
+	if(_pSimulcast) {
+		_invoker.waitFanOuts();
+		_pSimulcast->fanOut(Message::VIDEO,time,_name,&packet,this);
 	}
 	_pPublisher->onVideoPacket(*this,time,packet);
 }
@@ -18,38 +18,37 @@
 #include "QualityOfService.h"
 #include "Logs.h"
 #include "math.h"
+#include <cstring>
 
 using namespace Poco;
 using namespace std;
 
 namespace Cumulus {
 
-class Sample {
-public:
-	Sample(Timestamp& time,UInt32 received,UInt32 lost,UInt32 size,Int64 latencyGradient) : time(time),received(received),lost(lost),size(size),latencyGradient(latencyGradient) {}
-	~Sample() {}
-	const Timestamp time;
-	const UInt32	received;
-	const UInt32	lost;
-	const UInt32	size;
-	const Int64		latencyGradient;
-};
-
 QualityOfService QualityOfService::QualityOfServiceNull;
 
-QualityOfService::QualityOfService() : lostRate(0),byteRate(0),latency(0),congestionRate(0),_latency(0),_prevTime(0),droppedFrames(0),_num(0),_den(0),_size(0),_latencyGradient(0),_fullSample(false) {
+QualityOfService::QualityOfService() : lostRate(0),byteRate(0),latency(0),congestionRate(0),_latency(0),_prevTime(0),droppedFrames(0),recoveredFragments(0),_num(0),_den(0),_size(0),_latencyGradient(0),_fullSample(false),_bucket(0),_samples(0) {
+	memset(_buckets,0,sizeof(_buckets));
 }
 
 
 QualityOfService::~QualityOfService() {
-	reset();
+}
+
+void QualityOfService::clearBucket(Bucket& bucket) {
+	_samples -= bucket.samples;
+	_den -= (bucket.received+bucket.lost);
+	_num -= bucket.lost;
+	_size -= bucket.size;
+	_latencyGradient -= bucket.latencyGradient;
+	memset(&bucket,0,sizeof(bucket));
 }
 
 void QualityOfService::add(UInt32 time,UInt32 received,UInt32 lost,UInt32 size,UInt32 ping) {
 
 	Int64 latencyGradient = 0;
 
-	if(!_samples.empty()) {
+	if(_samples>0) {
 		if(time>=_prevTime) {
 			UInt32 delta = time-_prevTime;
 			UInt32 deltaReal =  UInt32(_reception.elapsed()/1000);
@@ -62,29 +61,37 @@ void QualityOfService::add(UInt32 time,UInt32 received,UInt32 lost,UInt32 size,U
 	(UInt32&)latency = _latency<0 ? 0 : (UInt32)_latency;
 
 	_prevTime=time;
+	_reception.update();
+
+	// expires the buckets older than 5 seconds, each one is reused as a ring
+	Int64 bucket = _reception.epochMicroseconds()/QOS_BUCKET_DURATION;
+	if(_samples>0 && bucket>_bucket) {
+		if(bucket-_bucket>=QOS_BUCKETS) {
+			for(UInt8 i=0;i<QOS_BUCKETS;++i)
+				clearBucket(_buckets[i]);
+		} else {
+			for(Int64 i=_bucket+1;i<=bucket;++i)
+				clearBucket(_buckets[i%QOS_BUCKETS]);
+		}
+	}
+	if(_samples>0)
+		_fullSample=true;
+	if(bucket>_bucket || _samples==0)
+		_bucket = bucket;
+
+	Bucket& current = _buckets[_bucket%QOS_BUCKETS];
+	++current.samples;
+	current.received += received;
+	current.lost += lost;
+	current.size += size;
+	current.latencyGradient += latencyGradient;
+	++_samples;
 	_num += lost;
 	_den += (lost+received);
 	_size += size;
 	_latencyGradient += latencyGradient;
 	
-	list<Sample*>::iterator it=_samples.begin();
-	while(it!=_samples.end()) {
-		Sample& sample(**it);
-		if(!sample.time.isElapsed(5000000)) { // 5 secondes
-			_fullSample=true;
-			break;
-		}
-		_den -= (sample.received+sample.lost);
-		_num -= sample.lost;
-		_size -= sample.size;
-		_latencyGradient -= sample.latencyGradient;
-		delete *it;
-		_samples.erase(it++);
-	}
-	_reception.update();
-	_samples.push_back(new Sample(_reception,received,lost,size,latencyGradient));
-	
-	UInt32 elapsed = _fullSample ? 5000 : UInt32((*_samples.begin())->time.elapsed()/1000);
+	UInt32 elapsed = _fullSample ? 5000 : 0;
 
 	(double&)byteRate = 0;
 	double congestion = 0;
@@ -110,13 +117,12 @@ void QualityOfService::reset() {
 	(double&)congestionRate = 0;
 	(UInt32&)latency = 0;
 	(UInt32&)droppedFrames = 0;
+	(UInt32&)recoveredFragments = 0;
 	_fullSample=false;
 	_latencyGradient=_latency=0;
-	_size=_num=_den=_prevTime=0;
-	list<Sample*>::iterator it;
-	for(it=_samples.begin();it!=_samples.end();++it)
-		delete (*it);
-	_samples.clear();
+	_size=_num=_den=_prevTime=_samples=0;
+	_bucket=0;
+	memset(_buckets,0,sizeof(_buckets));
 }
 
 
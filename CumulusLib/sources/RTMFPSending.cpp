@@ -26,7 +26,9 @@ using namespace Poco::Net;
 
 namespace Cumulus {
 
-RTMFPSending::RTMFPSending(RTMFPServer & server): _server(server), packet(_buffer,sizeof(_buffer)),id(0),farId(0),pSocket(NULL) {
+RTMFPSending::RTMFPSending(RTMFPServer & server):
+		_buffer(PACKETSEND_SIZE+(server.mtu>RTMFP_MAX_PACKET_LENGTH ? (server.mtu-RTMFP_MAX_PACKET_LENGTH) : 0)),
+		id(0),farId(0),pSocket(NULL),packet(_buffer.begin(),_buffer.size()),_server(server) {
 	packet.clear(6);
 	packet.limit(RTMFP_MAX_PACKET_LENGTH); // set normal limit
 }
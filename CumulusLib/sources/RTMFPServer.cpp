@@ -17,6 +17,7 @@
 
 #include "RTMFPServer.h"
 #include "RTMFP.h"
+#include "BufferPool.h"
 #include "Handshake.h"
 #include "Middle.h"
 #include "PacketWriter.h"
@@ -49,13 +50,19 @@ public:
 		setPriority(Thread::PRIO_LOW);
 		do {
 			waitHandleEx();
-		} while(sleep(1000)!=STOP);
+		} while(sleep(_server.ackPackets>1 ? _server.ackDelay : 1000)!=STOP);
 	}
 private:
 	void handle() {
+		_server.flushAcks();
+		_server.tick();
+		if(!_manageTime.isElapsed(1000000))
+			return;
+		_manageTime.update();
 		_server.manage();
 	}
-	RTMFPServer& _server;
+	RTMFPServer&	_server;
+	Timestamp		_manageTime;
 };
 
 
@@ -115,6 +122,35 @@ void RTMFPServer::start(RTMFPServerParams& params) {
 
 	(UInt32&)keepAliveServer = params.keepAliveServer<5 ? 5000 : params.keepAliveServer*1000;
 	(UInt32&)keepAlivePeer = params.keepAlivePeer<5 ? 5000 : params.keepAlivePeer*1000;
+	(UInt32&)fanOutThreshold = params.fanOutThreshold;
+	if(fanOutThreshold>0)
+		NOTE("Publication fan-out splitted on worker threads every %u listeners",fanOutThreshold);
+	(UInt32&)reorderWindow = params.reorderWindow==0 ? 1 : params.reorderWindow;
+	(UInt32&)ackPackets = params.ackPackets==0 ? 1 : params.ackPackets;
+	(UInt32&)ackDelay = params.ackDelay>=1000 ? 999 : params.ackDelay;
+	if(ackPackets==1 || ackDelay==0)
+		(UInt32&)ackPackets = 1;
+	else
+		NOTE("Acknowledgments delayed until %u packets or %u ms",ackPackets,ackDelay);
+	(UInt32&)receiveBuffer = (params.receiveBuffer==0 ? 1 : params.receiveBuffer)*1024;
+	(UInt32&)writerBudget = params.writerBudget*1024;
+	(UInt32&)sessionBudget = params.sessionBudget*1024;
+	(UInt64&)memoryCeiling = ((UInt64)params.memoryCeiling)*1024*1024;
+	(FlowWriter::OverflowPolicy&)overflowPolicy = params.overflowPolicy;
+	if(memoryCeiling>0)
+		NOTE("Memory of flow writers limited to %u MB",params.memoryCeiling);
+	(UInt32&)audioTimeToLive = params.audioTimeToLive;
+	(UInt32&)videoTimeToLive = params.videoTimeToLive;
+	if(audioTimeToLive>0 || videoTimeToLive>0)
+		NOTE("Audio and video abandoned after %u and %u ms",audioTimeToLive,videoTimeToLive);
+	(UInt16&)mtu = params.mtu>RTMFP_MAX_PACKET_LENGTH ? (params.mtu>RTMFP_MAX_MTU ? RTMFP_MAX_MTU : params.mtu) : RTMFP_MAX_PACKET_LENGTH;
+	if(mtu>RTMFP_MAX_PACKET_LENGTH)
+		NOTE("Path MTU discovery from %u to %u bytes",RTMFP_MAX_PACKET_LENGTH,mtu);
+	(UInt8&)fecLostRate = params.fecLostRate>100 ? 100 : params.fecLostRate;
+	if(fecLostRate>0)
+		NOTE("Media redundancy from %u%% of loss",fecLostRate);
+	(GroupStrategy*&)pGroupStrategy = params.pGroupStrategy ? params.pGroupStrategy : &GroupStrategy::Recent;
+	(UInt16&)groupIntroductions = params.groupIntroductions;
 
 	poolThreads.launch();
 	sockets.launch();
@@ -247,6 +283,32 @@ void RTMFPServer::status_string(std::string & s) {
 			+ " psnd: " + Poco::NumberFormatter::format(psndCnt > 0 ? (psndTm / psndCnt) : 0)
 			+ " peak_psnd: " + Poco::NumberFormatter::format(peakPsnd)
 			+ "\n";
+	s += "\tdata_packets: " + Poco::NumberFormatter::format(dataPackets)
+			+ " acks: " + Poco::NumberFormatter::format(acks)
+			+ " acks_per_packet: " + Poco::NumberFormatter::format(dataPackets>0 ? ((double)acks/dataPackets) : 0.0,2)
+			+ " buffered_bytes: " + Poco::NumberFormatter::format(bufferedBytes)
+			+ " abandoned_messages: " + Poco::NumberFormatter::format(abandonedMessages)
+			+ " abandoned_bytes: " + Poco::NumberFormatter::format(abandonedBytes)
+			+ "\n";
+	s += "\tbuffers:";
+	for(UInt8 i=0;i<BUFFERPOOL_CLASSES;++i)
+		s += " " + Poco::NumberFormatter::format(BufferPool::ClassSize(i))
+			+ ": " + Poco::NumberFormatter::format(BufferPool::Allocations(i))
+			+ "/" + Poco::NumberFormatter::format(BufferPool::Recycled(i))
+			+ "/" + Poco::NumberFormatter::format(BufferPool::Free(i));
+	s += " oversized: " + Poco::NumberFormatter::format(BufferPool::Allocations(BUFFERPOOL_CLASSES))
+			+ " messages: " + Poco::NumberFormatter::format(MessageBuffered::Allocations)
+			+ "/" + Poco::NumberFormatter::format(MessageBuffered::Recycled)
+			+ "\n";
+	Publications::Iterator it;
+	for(it=publications.begin();it!=publications.end();++it) {
+		Publication& publication(*it->second);
+		s += "\tpublication: " + publication.name()
+			+ " listeners: " + Poco::NumberFormatter::format(publication.listeners.count())
+			+ " fanout: " + Poco::NumberFormatter::format(publication.fanOutLatency())
+			+ " peak_fanout: " + Poco::NumberFormatter::format(publication.fanOutPeakLatency())
+			+ "\n";
+	}
 }
 
 void RTMFPServer::handleShellCommand(RTMFPReceiving * received) {
@@ -439,9 +501,24 @@ void RTMFPServer::destroySession(Session& session) {
 	}
 }
 
+void RTMFPServer::delayAcks(Session& session) {
+	_delayedAcks.insert(session.id);
+}
+
+void RTMFPServer::flushAcks() {
+	set<UInt32>::const_iterator it;
+	for(it=_delayedAcks.begin();it!=_delayedAcks.end();++it) {
+		Session* pSession = _sessions.find(*it);
+		if(pSession)
+			pSession->flushAcks();
+	}
+	_delayedAcks.clear();
+}
+
 void RTMFPServer::manage() {
 	_handshake.manage();
 	_sessions.manage();
+	manageMemory();
 
 	--tm_5m;
 	if(tm_5m <= 0) {
@@ -450,7 +527,39 @@ void RTMFPServer::manage() {
 		rcvpTm = 0;
 		psndCnt = 0;
 		psndTm = 0;
+		(UInt64&)acks = 0;
+		(UInt64&)dataPackets = 0;
+		(UInt64&)abandonedMessages = 0;
+		(UInt64&)abandonedBytes = 0;
+	}
+}
+
+void RTMFPServer::manageMemory() {
+	ScopedLock<Mutex> lock(_sessions.mutex);
+	UInt64 total=0;
+	multimap<UInt32,Session*> sessions;
+	Sessions::Iterator it;
+	for(it=_sessions.begin();it!=_sessions.end();++it) {
+		UInt32 bytes = it->second->bufferedBytes();
+		if(bytes==0)
+			continue;
+		total += bytes;
+		if(memoryCeiling>0)
+			sessions.insert(pair<UInt32,Session*>(bytes,it->second));
+	}
+	(UInt64&)bufferedBytes = total;
+	if(memoryCeiling==0 || total<=memoryCeiling)
+		return;
+
+	// sheds the worst offenders first
+	WARN("Memory ceiling exceeded, %s bytes buffered",NumberFormatter::format(total).c_str());
+	UInt64 excess = total-memoryCeiling;
+	multimap<UInt32,Session*>::reverse_iterator itSession;
+	for(itSession=sessions.rbegin();excess>0 && itSession!=sessions.rend();++itSession) {
+		UInt32 shed = itSession->second->shed(excess>itSession->first ? itSession->first : (UInt32)excess);
+		excess = excess>shed ? (excess-shed) : 0;
 	}
+	(UInt64&)bufferedBytes = memoryCeiling+excess;
 }
 
 const Poco::Net::DatagramSocket & RTMFPServer::shellSocket() {
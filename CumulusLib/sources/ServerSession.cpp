@@ -16,6 +16,7 @@
 */
 
 #include "ServerSession.h"
+#include "RTMFPServer.h"
 #include "Util.h"
 #include "Logs.h"
 #include "FlowConnection.h"
@@ -25,6 +26,7 @@
 #include "Poco/Format.h"
 #include "Poco/NumberFormatter.h"
 #include <cstring>
+#include <algorithm>
 
 using namespace std;
 using namespace Poco;
@@ -37,7 +39,8 @@ ServerSession::ServerSession(RTMFPServer & server, UInt32 id,
 				 const Peer& peer,
 				 const UInt8* decryptKey,
 				 const UInt8* encryptKey,
-				 Invoker& invoker) : Session(server, id,farId,peer,decryptKey,encryptKey,invoker),pTarget(NULL),_failed(false),_timesFailed(0),_timeSent(0),_nextFlowWriterId(0),_timesKeepalive(0),_pLastFlowWriter(NULL) {
+				 Invoker& invoker) : Session(server, id,farId,peer,decryptKey,encryptKey,invoker),pTarget(NULL),_failed(false),_timesFailed(0),_timeSent(0),_nextFlowWriterId(0),_timesKeepalive(0),_pLastFlowWriter(NULL),_acksDelayed(false),_bufferedBytes(0),_writing(false),
+				 _mtu(RTMFP_MAX_PACKET_LENGTH),_mtuCeiling(invoker.mtu+1),_mtuProbe(0),_mtuProbeAttempts(0),_mtuProbeId(0),_probingMTU(false) {
 	_pFlowNull = new FlowNull(this->peer,invoker,*this);
 	Session::writer().clear(11);
 }
@@ -117,6 +120,7 @@ void ServerSession::kill() {
 	for(it2=_flowWriters.begin();it2!=_flowWriters.end();++it2)
 		delete it2->second;
 	_flowWriters.clear();
+	_flowWritersScheduled.clear();
 }
 
 void ServerSession::manage() {
@@ -148,7 +152,13 @@ void ServerSession::manage() {
 	if(_recvTimestamp.isElapsed(120000000) && !keepAlive())
 		return;
 
+	// Probe the path MTU only while the peer answers
+	if(!_failed && peer.connected && _timesKeepalive==0 && invoker.mtu>RTMFP_MAX_PACKET_LENGTH)
+		manageMTU();
+
 	// Raise FlowWriter
+	_bufferedBytes=0;
+	UInt32 mediaBytes=0;
 	map<UInt64,FlowWriter*>::iterator it2=_flowWriters.begin();
 	while(it2!=_flowWriters.end()) {
 		try {
@@ -161,19 +171,66 @@ void ServerSession::manage() {
 			continue;
 		}
 		if(it2->second->consumed()) {
+			_flowWritersScheduled.erase(remove(_flowWritersScheduled.begin(),_flowWritersScheduled.end(),it2->second),_flowWritersScheduled.end());
 			delete it2->second;
 			_flowWriters.erase(it2++);
 			continue;
 		}
+		_bufferedBytes += it2->second->bufferedBytes();
+		if(it2->second->media())
+			mediaBytes += it2->second->bufferedBytes();
 		++it2;
 	}
 
+	// only audio and video can be shed, the budget ignores the other writers
+	if(!_failed && invoker.sessionBudget>0 && mediaBytes>invoker.sessionBudget) {
+		WARN("Session %u exceeds its memory budget with %u media bytes buffered",id,mediaBytes);
+		shed(mediaBytes-invoker.sessionBudget);
+	}
+
 	if(!_failed)
 		peer.onManage();
 
 	flush();
 }
 
+UInt32 ServerSession::shed(UInt32 bytes) {
+	// the biggest flow writers first
+	multimap<UInt32,FlowWriter*> writers;
+	map<UInt64,FlowWriter*>::const_iterator it;
+	for(it=_flowWriters.begin();it!=_flowWriters.end();++it) {
+		if(it->second->media() && it->second->bufferedBytes()>0)
+			writers.insert(pair<UInt32,FlowWriter*>(it->second->bufferedBytes(),it->second));
+	}
+	UInt32 freed=0;
+	multimap<UInt32,FlowWriter*>::reverse_iterator itWriter;
+	for(itWriter=writers.rbegin();freed<bytes && itWriter!=writers.rend();++itWriter) {
+		UInt32 excess = bytes-freed;
+		freed += itWriter->second->overflow(itWriter->first>excess ? (itWriter->first-excess) : 0);
+	}
+	_bufferedBytes = _bufferedBytes>freed ? (_bufferedBytes-freed) : 0;
+	return freed;
+}
+
+void ServerSession::writeAcks() {
+	invoker.waitFanOuts();
+	_acksDelayed = false;
+	if(_failed)
+		return;
+	map<UInt64,Flow*>::const_iterator it;
+	for(it=_flows.begin();it!=_flows.end();++it) {
+		if(it->second->acknowledgmentDelayed())
+			it->second->acknowledge();
+	}
+}
+
+void ServerSession::flushAcks() {
+	if(!_acksDelayed || died)
+		return;
+	writeAcks();
+	flush();
+}
+
 bool ServerSession::keepAlive() {
 	if(!peer.connected) {
 		fail("Timeout connection client");
@@ -189,6 +246,54 @@ bool ServerSession::keepAlive() {
 	return true;
 }
 
+void ServerSession::manageMTU() {
+	if(_mtuProbe>0) {
+		// Probe pending
+		if(!_mtuTime.isElapsed(2000000))
+			return;
+		if(++_mtuProbeAttempts<3) {
+			probeMTU();
+			return;
+		}
+		// Probe lost
+		if(_mtuProbe<=_mtu) {
+			WARN("Path MTU of %u bytes lost on session %u, falls back to %u bytes",_mtu,id,RTMFP_MAX_PACKET_LENGTH);
+			_mtu = RTMFP_MAX_PACKET_LENGTH;
+		}
+		_mtuCeiling = _mtuProbe;
+		_mtuProbe = 0;
+		return;
+	}
+
+	if((_mtuCeiling-_mtu)<=16) {
+		// Search finished, checks again the path after 10 mn
+		if(!_mtuTime.isElapsed(600000000))
+			return;
+		_mtuCeiling = invoker.mtu+1;
+		if(_mtu>RTMFP_MAX_PACKET_LENGTH)
+			_mtuProbe = _mtu; // verify first the current size
+	}
+	if(_mtuProbe==0)
+		_mtuProbe = (_mtu+_mtuCeiling)/2;
+	_mtuProbeAttempts = 0;
+	++_mtuProbeId;
+	probeMTU();
+}
+
+void ServerSession::probeMTU() {
+	flush();
+	// Ping padded up to the size probed, its reply (0x41) echoes the identifier
+	writeMessage(0x01,4).write32(_mtuProbeId);
+	_probingMTU = true;
+	PacketWriter& packet = Session::writer();
+	packet.limit(_mtuProbe);
+	while(packet.available()>0)
+		packet.write8(0xFF); // 0xFF ends the message parsing on the receiver side
+	flush();
+	_probingMTU = false;
+	_mtuTime.update();
+}
+
 void ServerSession::eraseHelloAttempt(const string& tag) {
 // clean obsolete helloAttempts
 	map<string,Attempt*>::iterator it=_helloAttempts.find(tag);
@@ -247,9 +352,15 @@ void ServerSession::p2pHandshake(const SocketAddress& address,const std::string&
 }
 
 void ServerSession::flush(UInt8 marker,bool echoTime,AESEngine::Type type) {
-	_pLastFlowWriter=NULL;
-	if(died)
+	// a publication fan-out can write in the flow writers of this session
+	invoker.waitFanOuts();
+	if(died) {
+		_pLastFlowWriter=NULL;
 		return;
+	}
+	if(!_writing && !_flowWritersScheduled.empty())
+		writeFlowWriters();
+	_pLastFlowWriter=NULL;
 
 	PacketWriter& packet(ServerSession::writer());
 	if(packet.length()>=RTMFP_MIN_PACKET_SIZE) {
@@ -283,10 +394,36 @@ PacketWriter& ServerSession::writer() {
 			WARN("Writing packet failed : the writer has certainly exceeded the size set");
 		Session::writer().reset(11);
 	}
-	Session::writer().limit(RTMFP_MAX_PACKET_LENGTH);
+	Session::writer().limit(_probingMTU ? _mtuProbe : _mtu);
 	return Session::writer();
 }
 
+static bool ComparePriority(const FlowWriter* pWriter1,const FlowWriter* pWriter2) {
+	return pWriter1->priority<pWriter2->priority;
+}
+
+void ServerSession::writeFlowWriters() {
+	// Control and RPC first, then audio, video and data,
+	// the writers of a same priority share the packets by deficit round-robin
+	_writing=true;
+	stable_sort(_flowWritersScheduled.begin(),_flowWritersScheduled.end(),ComparePriority);
+	vector<FlowWriter*>::iterator first=_flowWritersScheduled.begin();
+	while(first!=_flowWritersScheduled.end()) {
+		vector<FlowWriter*>::iterator last=first;
+		while(last!=_flowWritersScheduled.end() && (*last)->priority==(*first)->priority)
+			++last;
+		while(first!=last) {
+			vector<FlowWriter*>::iterator it;
+			for(it=first;it!=last;++it) {
+				if(!(*it)->send(FLOWWRITER_QUANTUM))
+					iter_swap(first++,it); // nothing more to send
+			}
+		}
+	}
+	_flowWritersScheduled.clear();
+	_writing=false;
+}
+
 PacketWriter& ServerSession::writeMessage(UInt8 type,UInt16 length,FlowWriter* pFlowWriter) {
 
 	// No sending formated message for a failed session!
@@ -302,7 +439,7 @@ PacketWriter& ServerSession::writeMessage(UInt8 type,UInt16 length,FlowWriter* p
 
 	if(size>Session::writer().available()) {
 		flush(false); // send packet (and without time echo)
-		if(size > Session::writer().available()) {
+		if(size > ServerSession::writer().available()) {
 			CRITIC("Message truncated because exceeds maximum UDP packet size on session %u",id);
 			size = Session::writer().available();
 		}
@@ -352,9 +489,12 @@ void ServerSession::packetHandler(PacketReader& packet) {
 
 	UInt8 type = packet.available()>0 ? packet.read8() : 0xFF;
 	bool answer = false;
+	bool data = false;
 
 	// Can have nested queries
 	while(type!=0xFF) {
+		// acks and flows can touch flow writers that a fan-out of a previous message is writing
+		invoker.waitFanOuts();
 
 		UInt16 size = packet.read16();
 
@@ -376,9 +516,16 @@ void ServerSession::packetHandler(PacketReader& packet) {
 				if(!peer.connected)
 					fail("Timeout connection client");
 				else
-					writeMessage(0x41,0);
+					writeMessage(0x41,message.available()).writeRaw(message.current(),message.available());
+				_timesKeepalive=0;
+				break;
 			case 0x41 :
 				_timesKeepalive=0;
+				if(_mtuProbe>0 && message.available()>=4 && message.read32()==_mtuProbeId) {
+					DEBUG("Path MTU of %u bytes on session %u",_mtuProbe,id);
+					_mtu = _mtuProbe;
+					_mtuProbe = 0;
+				}
 				break;
 
 			case 0x5e : {
@@ -476,6 +623,7 @@ void ServerSession::packetHandler(PacketReader& packet) {
 				// has Header?
 				if(type==0x11)
 					flags = message.read8();
+				data = true;
 
 				// Process request
 				if(pFlow) {
@@ -498,7 +646,10 @@ void ServerSession::packetHandler(PacketReader& packet) {
 
 		// Commit Flow
 		if(pFlow && type!= 0x11) {
-			pFlow->commit();
+			if(pFlow->commit() && !_acksDelayed) {
+				_acksDelayed = true;
+				server().delayAcks(*this);
+			}
 			if(pFlow->consumed()) {
 				_flows.erase(pFlow->id);
 				delete pFlow;
@@ -507,6 +658,11 @@ void ServerSession::packetHandler(PacketReader& packet) {
 		}
 	}
 
+	if(data)
+		++(UInt64&)invoker.dataPackets;
+	// delayed acknowledgments leave with the answer if there is one
+	if(_acksDelayed && ServerSession::writer().length()>=RTMFP_MIN_PACKET_SIZE)
+		writeAcks();
 	flush();
 }
 
@@ -558,6 +714,8 @@ Flow* ServerSession::createFlow(UInt64 id,const string& signature) {
 void ServerSession::initFlowWriter(FlowWriter& flowWriter) {
 	while(++_nextFlowWriterId==0 || _flowWriters.find(_nextFlowWriterId)!=_flowWriters.end());
 	(UInt64&)flowWriter.id = _nextFlowWriterId;
+	(UInt32&)flowWriter.budget = invoker.writerBudget;
+	flowWriter.overflowPolicy = invoker.overflowPolicy;
 	if(_flows.begin()!=_flows.end())
 		(UInt64&)flowWriter.flowId = _flows.begin()->second->id;
 	_flowWriters[_nextFlowWriterId] = &flowWriter;
@@ -17,13 +17,14 @@
 
 #include "Streams.h"
 #include "Logs.h"
+#include <cctype>
 
 using namespace std;
 using namespace Poco;
 
 namespace Cumulus {
 
-Streams::Streams(map<string,Publication*>&	publications) : _nextId(0),_publications(publications) {
+Streams::Streams(map<string,Publication*>&	publications,Invoker& invoker) : _nextId(0),_publications(publications),_invoker(invoker) {
 	
 }
 
@@ -31,6 +32,21 @@ Streams::~Streams() {
 	
 }
 
+#define LAYER_NAME_MAX	16
+
+bool Streams::SimulcastName(const string& name,string& simulcast) {
+	string::size_type separator = name.find_last_of('@');
+	if(separator==string::npos || separator==0 || (name.size()-separator-1)==0 || (name.size()-separator-1)>LAYER_NAME_MAX)
+		return false;
+	for(string::size_type i=separator+1;i<name.size();++i) {
+		char c = name[i];
+		if(!isalnum((unsigned char)c) && c!='_' && c!='-')
+			return false;
+	}
+	simulcast.assign(name,0,separator);
+	return true;
+}
+
 
 Publication& Streams::publish(Peer& peer,UInt32 id,const string& name,FlowWriter* pController) {
 	Publications::Iterator it = createPublication(name);
@@ -38,10 +54,13 @@ Publication& Streams::publish(Peer& peer,UInt32 id,const string& name,FlowWriter
 	try {
 		publication.start(peer,id,pController);
 	} catch(...) {
-		if(publication.publisherId()==0 && publication.listeners.count()==0)
+		if(publication.publisherId()==0 && publication.listeners.count()==0 && publication.layers()==0)
 			destroyPublication(it);
 		throw;
 	}
+	string simulcast;
+	if(SimulcastName(name,simulcast))
+		createPublication(simulcast)->second->addLayer(publication);
 	return publication;
 }
 
@@ -53,7 +72,19 @@ void Streams::unpublish(Peer& peer,UInt32 id,const string& name) {
 	}
 	Publication& publication(*it->second);
 	publication.stop(peer,id);
-	if(publication.publisherId()==0 && publication.listeners.count()==0)
+	if(publication.publisherId()!=0)
+		return;
+	string simulcast;
+	if(SimulcastName(name,simulcast)) {
+		Publications::Iterator itSimulcast = _publications.find(simulcast);
+		if(itSimulcast!=_publications.end()) {
+			Publication& simulcast(*itSimulcast->second);
+			simulcast.removeLayer(publication);
+			if(simulcast.publisherId()==0 && simulcast.listeners.count()==0 && simulcast.layers()==0)
+				destroyPublication(itSimulcast);
+		}
+	}
+	if(publication.listeners.count()==0 && publication.layers()==0)
 		destroyPublication(it);
 }
 
@@ -63,7 +94,7 @@ Listener& Streams::subscribe(Peer& peer,UInt32 id,const string& name,FlowWriter&
 	try {
 		return publication.addListener(peer,id,writer,start==-3000 ? true : false);
 	} catch(...) {
-		if(publication.publisherId()==0 && publication.listeners.count()==0)
+		if(publication.publisherId()==0 && publication.listeners.count()==0 && publication.layers()==0)
 			destroyPublication(it);
 		throw;
 	}
@@ -77,7 +108,7 @@ void Streams::unsubscribe(Peer& peer,UInt32 id,const string& name) {
 	}
 	Publication& publication(*it->second);
 	publication.removeListener(peer,id);
-	if(publication.publisherId()==0 && publication.listeners.count()==0)
+	if(publication.publisherId()==0 && publication.listeners.count()==0 && publication.layers()==0)
 		destroyPublication(it);
 }
 
@@ -99,7 +130,7 @@ Publications::Iterator Streams::createPublication(const string& name) {
 		return it;
 	if(it!=_publications.begin())
 		--it;
-	return _publications.insert(it,pair<string,Publication*>(name,new Publication(name)));
+	return _publications.insert(it,pair<string,Publication*>(name,new Publication(name,_invoker)));
 }
 
 void Streams::destroyPublication(const Publications::Iterator& it) {
@@ -70,6 +70,7 @@ void TaskHandler::giveHandle() {
 	if(!_pTask)
 		return;
 	_pTask->handle();
+	onHandled();
 	_pTask=NULL;
 	_event.set();
 }
@@ -86,6 +87,7 @@ retry:
 		}
 
 		_pTask->handle();
+		onHandled();
 		goto retry;
 	}
 out:
@@ -70,7 +70,9 @@ inline ServerConnection* Broadcaster::operator[](Poco::UInt32 index) {
 }
 
 inline void Broadcaster::broadcast(const std::string& handler,ServerMessage& message) {
+	// the message body is serialized once, and sent on the next flush of each connection
+	Poco::SharedPtr<Poco::Buffer<Poco::UInt8> > pBody = message.body();
 	Iterator it;
 	for(it=begin();it!=end();++it)
-		(*it)->send(handler,message);
+		(*it)->send(handler,pBody);
 }
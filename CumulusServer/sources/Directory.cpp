@@ -0,0 +1,292 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "Directory.h"
+#include "Logs.h"
+#include "Poco/Buffer.h"
+
+using namespace std;
+using namespace Cumulus;
+using namespace Poco;
+
+#define DIRECTORY_RETRY		1000000 // 1 sec before to ask again an unknown peer
+#define DIRECTORY_TIMEOUT	30000000 // 30 sec of validity for a location answered
+
+class DirectoryTask : public Task {
+public:
+	DirectoryTask(Directory& directory,TaskHandler& handler,UInt8 type,const ServerConnection& server,const UInt8* data=NULL,UInt32 size=0) : Task(&handler),_directory(directory),_type(type),_address(server.address),_publicAddress(server.publicAddress),_buffer(size) {
+		if(size>0)
+			memcpy(_buffer.begin(),data,size);
+	}
+
+private:
+	void handle() {
+		PacketReader reader(_buffer.begin(),_buffer.size());
+		try {
+			_directory.handle(_type,_address,_publicAddress,reader);
+		} catch(Exception& ex) {
+			ERROR("Directory from %s server, %s",_address.c_str(),ex.displayText().c_str());
+		}
+		delete this;
+	}
+
+	Directory&		_directory;
+	UInt8			_type;
+	string			_address;
+	string			_publicAddress;
+	Buffer<UInt8>	_buffer;
+};
+
+static UInt32 Hash(const string& node,const string& id) {
+	// FNV-1a
+	UInt32 hash = 2166136261U;
+	string::const_iterator it;
+	for(it=node.begin();it!=node.end();++it)
+		hash = (hash^(UInt8)*it)*16777619U;
+	for(it=id.begin();it!=id.end();++it)
+		hash = (hash^(UInt8)*it)*16777619U;
+	return hash;
+}
+
+
+Directory::Directory(Invoker& invoker,Servers& servers,const string& publicAddress,bool enabled) : _invoker(invoker),_servers(servers),_publicAddress(publicAddress),enabled(enabled && !publicAddress.empty()) {
+	if(this->enabled)
+		NOTE("Peers directory between servers enabled")
+	else if(enabled)
+		WARN("Peers directory between servers disabled, it requires a publicAddress configured on each server");
+}
+
+Directory::~Directory() {
+}
+
+bool Directory::message(ServerConnection& server,const string& handler,PacketReader& reader) {
+	UInt8 type=0;
+	if(handler=="directory.set")
+		type = SET;
+	else if(handler=="directory.del")
+		type = DEL;
+	else if(handler=="directory.get")
+		type = GET;
+	else if(handler=="directory.location")
+		type = LOCATION;
+	else
+		return false;
+	(new DirectoryTask(*this,_invoker,type,server,reader.current(),reader.available()))->waitHandleEx(false);
+	return true;
+}
+
+void Directory::connection(ServerConnection& server) {
+	(new DirectoryTask(*this,_invoker,CONNECTION,server))->waitHandleEx(false);
+}
+
+void Directory::disconnection(const ServerConnection& server) {
+	(new DirectoryTask(*this,_invoker,DISCONNECTION,server))->waitHandleEx(false);
+}
+
+const string* Directory::owner(const string& id) {
+	// rendezvous hashing, the highest score between the servers wins
+	const string* pOwner = NULL;
+	UInt32 best = Hash(_publicAddress,id);
+	map<string,string>::const_iterator it;
+	for(it=_nodes.begin();it!=_nodes.end();++it) {
+		UInt32 score = Hash(it->second,id);
+		if(score>best || (score==best && it->second>_publicAddress)) {
+			best = score;
+			pOwner = &it->first;
+		}
+	}
+	return pOwner;
+}
+
+void Directory::send(const string& address,const string& handler,const string& id,const string* pValue) {
+	Servers::Iterator it;
+	for(it=_servers.begin();it!=_servers.end();++it) {
+		if((*it)->address==address) {
+			ServerMessage message;
+			message.writeRaw(id);
+			if(pValue)
+				message << *pValue;
+			(*it)->send(handler,message);
+			return;
+		}
+	}
+	DEBUG("Directory impossible, server %s unfound",address.c_str());
+}
+
+void Directory::add(const UInt8* id) {
+	if(!enabled)
+		return;
+	string key((const char*)id,ID_SIZE);
+	const string* pOwner = owner(key);
+	if(pOwner) {
+		send(*pOwner,"directory.set",key);
+		_locals[key] = *pOwner;
+	} else {
+		_entries[key].clear();
+		_locals[key].clear();
+	}
+}
+
+void Directory::remove(const UInt8* id) {
+	if(!enabled)
+		return;
+	map<string,string>::iterator it = _locals.find(string((const char*)id,ID_SIZE));
+	if(it==_locals.end())
+		return;
+	if(it->second.empty())
+		_entries.erase(it->first);
+	else
+		send(it->second,"directory.del",it->first);
+	_locals.erase(it);
+}
+
+void Directory::find(const UInt8* id,set<string>& addresses) {
+	if(!enabled || _nodes.empty())
+		return;
+	string key((const char*)id,ID_SIZE);
+
+	map<string,string>::const_iterator itEntry = _entries.find(key);
+	if(itEntry!=_entries.end()) {
+		map<string,string>::const_iterator itNode = _nodes.find(itEntry->second);
+		if(itNode!=_nodes.end())
+			addresses.insert(itNode->second);
+		return;
+	}
+
+	map<string,Location>::iterator it = _locations.lower_bound(key);
+	if(it!=_locations.end() && it->first==key) {
+		if(!it->second.publicAddress.empty()) {
+			if(!it->second.time.isElapsed(DIRECTORY_TIMEOUT)) {
+				addresses.insert(it->second.publicAddress);
+				return;
+			}
+		} else if(!it->second.time.isElapsed(DIRECTORY_RETRY))
+			return; // answer waiting
+	} else {
+		if(it!=_locations.begin())
+			--it;
+		it = _locations.insert(it,pair<string,Location>(key,Location()));
+	}
+
+	const string* pOwner = owner(key);
+	if(!pOwner)
+		return; // owned by this server, so unknown
+	it->second.publicAddress.clear();
+	it->second.time.update();
+	send(*pOwner,"directory.get",key);
+}
+
+void Directory::manage() {
+	map<string,Location>::iterator it=_locations.begin();
+	while(it!=_locations.end()) {
+		if(it->second.time.isElapsed(DIRECTORY_TIMEOUT))
+			_locations.erase(it++);
+		else
+			++it;
+	}
+}
+
+void Directory::rebalance() {
+	// the entries which have changed of owner move to the new one
+	map<string,string>::iterator itEntry=_entries.begin();
+	while(itEntry!=_entries.end()) {
+		if(owner(itEntry->first))
+			_entries.erase(itEntry++);
+		else
+			++itEntry;
+	}
+	map<string,string>::iterator it;
+	for(it=_locals.begin();it!=_locals.end();++it) {
+		const string* pOwner = owner(it->first);
+		if(pOwner ? (*pOwner==it->second) : it->second.empty())
+			continue;
+		if(!it->second.empty() && _nodes.find(it->second)!=_nodes.end())
+			send(it->second,"directory.del",it->first);
+		if(pOwner) {
+			send(*pOwner,"directory.set",it->first);
+			it->second = *pOwner;
+		} else {
+			_entries[it->first].clear();
+			it->second.clear();
+		}
+	}
+}
+
+void Directory::handle(UInt8 type,const string& address,const string& publicAddress,PacketReader& reader) {
+	// the entries are kept even if disabled here, the other servers can own their peers on this one
+	string id;
+	if(type<CONNECTION)
+		reader.readRaw(ID_SIZE,id);
+	switch(type) {
+		case SET:
+			_entries[id] = address;
+			break;
+		case DEL: {
+			map<string,string>::iterator it = _entries.find(id);
+			if(it!=_entries.end() && it->second==address)
+				_entries.erase(it);
+			break;
+		}
+		case GET: {
+			string location;
+			map<string,string>::const_iterator it = _entries.find(id);
+			if(it!=_entries.end()) {
+				if(it->second.empty())
+					location = _publicAddress;
+				else {
+					map<string,string>::const_iterator itNode = _nodes.find(it->second);
+					if(itNode!=_nodes.end())
+						location = itNode->second;
+				}
+			}
+			send(address,"directory.location",id,&location);
+			break;
+		}
+		case LOCATION: {
+			Location& location(_locations[id]);
+			reader >> location.publicAddress;
+			location.time.update();
+			break;
+		}
+		case CONNECTION:
+			_nodes[address] = publicAddress;
+			if(enabled)
+				rebalance();
+			break;
+		case DISCONNECTION: {
+			_nodes.erase(address);
+			// purges the peers of this server
+			map<string,string>::iterator itEntry=_entries.begin();
+			while(itEntry!=_entries.end()) {
+				if(itEntry->second==address)
+					_entries.erase(itEntry++);
+				else
+					++itEntry;
+			}
+			map<string,Location>::iterator itLocation=_locations.begin();
+			while(itLocation!=_locations.end()) {
+				if(itLocation->second.publicAddress==publicAddress)
+					_locations.erase(itLocation++);
+				else
+					++itLocation;
+			}
+			if(enabled)
+				rebalance();
+			break;
+		}
+	}
+}
@@ -0,0 +1,72 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Invoker.h"
+#include "Servers.h"
+
+class Directory {
+	friend class DirectoryTask;
+public:
+	Directory(Cumulus::Invoker& invoker,Servers& servers,const std::string& publicAddress,bool enabled);
+	virtual ~Directory();
+
+	const bool		enabled;
+
+	// Local peers, registered on the server which owns their id (rendezvous hashing of the id between the servers)
+	void			add(const Poco::UInt8* id);
+	void			remove(const Poco::UInt8* id);
+
+	// Peer unfound locally, gives its server address if known, else asks it to the owner for the next rendezvous attempt
+	void			find(const Poco::UInt8* id,std::set<std::string>& addresses);
+	void			manage();
+
+	// Called by the sockets thread, the job is given to the main thread
+	bool			message(ServerConnection& server,const std::string& handler,Cumulus::PacketReader& reader);
+	void			connection(ServerConnection& server);
+	void			disconnection(const ServerConnection& server);
+
+private:
+	enum Type {
+		SET=1,
+		DEL,
+		GET,
+		LOCATION,
+		CONNECTION,
+		DISCONNECTION
+	};
+
+	struct Location {
+		std::string		publicAddress; // empty while unknown
+		Poco::Timestamp	time;
+	};
+
+	void				handle(Poco::UInt8 type,const std::string& address,const std::string& publicAddress,Cumulus::PacketReader& reader);
+	const std::string*	owner(const std::string& id);
+	void				rebalance();
+	void				send(const std::string& address,const std::string& handler,const std::string& id,const std::string* pValue=NULL);
+
+	Cumulus::Invoker&						_invoker;
+	Servers&								_servers;
+	const std::string						_publicAddress;
+
+	std::map<std::string,std::string>		_nodes; // server address -> public address
+	std::map<std::string,std::string>		_locals; // local peer id -> owner server address, empty for this one
+	std::map<std::string,std::string>		_entries; // peer id owned -> server address of the peer, empty for this one
+	std::map<std::string,Location>			_locations; // peer id asked -> public address answered
+};
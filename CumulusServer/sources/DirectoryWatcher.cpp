@@ -0,0 +1,173 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "DirectoryWatcher.h"
+#include "Logs.h"
+#include "Poco/File.h"
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+using namespace std;
+using namespace Poco;
+using namespace Cumulus;
+
+DirectoryWatcher::DirectoryWatcher(TaskHandler& taskHandler,WatcherHandler& handler) : Startable("DirectoryWatcher"),Task(&taskHandler),_handler(handler),_fd(-1) {
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+	stop();
+}
+
+bool DirectoryWatcher::start(const string& root) {
+	stop();
+#if defined(__linux__)
+	_fd = inotify_init();
+	if(_fd<0) {
+		WARN("inotify unavailable (%s), %s files will be polled",strerror(errno),root.c_str());
+		return false;
+	}
+	_root = root;
+	add("");
+	if(_paths.empty()) {
+		stop();
+		return false;
+	}
+	Startable::start();
+	return true;
+#else
+	return false;
+#endif
+}
+
+void DirectoryWatcher::stop() {
+	Startable::stop();
+#if defined(__linux__)
+	if(_fd>=0)
+		close(_fd);
+#endif
+	_fd=-1;
+	_paths.clear();
+	ScopedLock<FastMutex> lock(_mutex);
+	_changes.clear();
+}
+
+void DirectoryWatcher::add(const string& path) {
+#if defined(__linux__)
+	int wd = inotify_add_watch(_fd,(_root+path).c_str(),IN_CREATE|IN_DELETE|IN_CLOSE_WRITE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR);
+	if(wd<0) {
+		WARN("Impossible to watch %s%s (%s)",_root.c_str(),path.c_str(),strerror(errno));
+		return;
+	}
+	_paths[wd] = path;
+	vector<string> files;
+	try {
+		File(_root+path).list(files);
+	} catch(Exception& ex) {
+		WARN("Impossible to list %s%s (%s)",_root.c_str(),path.c_str(),ex.displayText().c_str());
+	}
+	vector<string>::const_iterator it;
+	for(it=files.begin();it!=files.end();++it) {
+		try {
+			if(File(_root+path+"/"+*it).isDirectory())
+				add(path+"/"+*it);
+		} catch(Exception&) {}
+	}
+#endif
+}
+
+void DirectoryWatcher::remove(const string& path) {
+#if defined(__linux__)
+	// the watches of "path" and its subdirectories
+	string prefix(path+"/");
+	map<int,string>::iterator it=_paths.begin();
+	while(it!=_paths.end()) {
+		if(it->second==path || it->second.compare(0,prefix.size(),prefix)==0) {
+			inotify_rm_watch(_fd,it->first);
+			_paths.erase(it++);
+		} else
+			++it;
+	}
+#endif
+}
+
+void DirectoryWatcher::run() {
+#if defined(__linux__)
+	// aligned on inotify_event
+	UInt64 buffer[512];
+	struct pollfd pfd;
+	pfd.fd = _fd;
+	pfd.events = POLLIN;
+	while(running()) {
+		if(poll(&pfd,1,1000)<=0)
+			continue;
+		int size = read(_fd,buffer,sizeof(buffer));
+		if(size<=0)
+			continue;
+		list<Change> changes;
+		char* current = (char*)buffer;
+		char* end = current+size;
+		while(current<end) {
+			inotify_event* pEvent = (inotify_event*)current;
+			current += sizeof(inotify_event)+pEvent->len;
+			if(pEvent->mask&IN_Q_OVERFLOW) {
+				changes.push_back(Change("",true,true));
+				continue;
+			}
+			if(pEvent->mask&IN_IGNORED) {
+				_paths.erase(pEvent->wd);
+				continue;
+			}
+			map<int,string>::const_iterator it = _paths.find(pEvent->wd);
+			if(it==_paths.end() || pEvent->len==0)
+				continue;
+			string path = it->second+"/"+pEvent->name;
+			bool directory = (pEvent->mask&IN_ISDIR)!=0;
+			bool exists = (pEvent->mask&(IN_CREATE|IN_CLOSE_WRITE|IN_MOVED_TO))!=0;
+			// a watch follows its directory when moved, so the watches of a moved directory are dropped
+			// and added again with their new paths if it stays in the tree
+			if(directory && (pEvent->mask&IN_MOVED_FROM))
+				remove(path);
+			if(directory && exists)
+				add(path);
+			changes.push_back(Change(path,directory,exists));
+		}
+		if(changes.empty())
+			continue;
+		{
+			ScopedLock<FastMutex> lock(_mutex);
+			_changes.splice(_changes.end(),changes);
+		}
+		waitHandleEx(false);
+	}
+#endif
+}
+
+void DirectoryWatcher::handle() {
+	list<Change> changes;
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		changes.swap(_changes);
+	}
+	list<Change>::const_iterator it;
+	for(it=changes.begin();it!=changes.end();++it)
+		_handler.onChange(it->path,it->directory,it->exists);
+}
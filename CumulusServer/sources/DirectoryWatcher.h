@@ -0,0 +1,62 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Task.h"
+#include "Startable.h"
+#include "Poco/Mutex.h"
+#include <list>
+#include <map>
+
+class WatcherHandler {
+public:
+	// path is relative to the watched root ("/app/main.lua"), an empty path means that everything can have changed
+	virtual void onChange(const std::string& path,bool directory,bool exists)=0;
+};
+
+// Watches recursively a directory with inotify on its own thread, and posts changes to the main thread
+class DirectoryWatcher : private Cumulus::Startable, private Cumulus::Task {
+public:
+	DirectoryWatcher(Cumulus::TaskHandler& taskHandler,WatcherHandler& handler);
+	virtual ~DirectoryWatcher();
+
+	// return false if the file system can't be watched, files have to be polled then
+	bool	start(const std::string& root);
+	void	stop();
+
+private:
+	class Change {
+	public:
+		Change(const std::string& path,bool directory,bool exists) : path(path),directory(directory),exists(exists) {}
+		std::string	path;
+		bool		directory;
+		bool		exists;
+	};
+
+	void	run();
+	void	handle();
+	void	add(const std::string& path);
+	void	remove(const std::string& path);
+
+	WatcherHandler&				_handler;
+	std::string					_root;
+	int							_fd;
+	std::map<int,std::string>	_paths;
+	Poco::FastMutex				_mutex;
+	std::list<Change>			_changes;
+};
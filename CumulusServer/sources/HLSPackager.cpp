@@ -0,0 +1,408 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+
+#include "HLSPackager.h"
+#include "TSWriter.h"
+#include "Message.h"
+#include "Logs.h"
+#include "Poco/File.h"
+#include "Poco/FileStream.h"
+#include "Poco/Format.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/Buffer.h"
+#include <deque>
+#include <vector>
+
+using namespace std;
+using namespace Cumulus;
+using namespace Poco;
+
+static const UInt8 StartCode[] = {0x00,0x00,0x00,0x01};
+
+class HLSStream : public RefCountedObject {
+public:
+	HLSStream(const string& directory,const string& name,UInt32 duration,UInt32 segments) : name(name),_path(directory),_duration(duration*1000),_segments(segments),
+		pThread(NULL),dropping(false),video(false),_pending(0),_pFile(NULL),_sequence(0),_segmentTime(0),_lastTime(0),_segmentDiscontinuity(false),_discontinuity(false),_failed(false),_warned(false),_nalLengthSize(4),_audioConfig(false) {
+		// publication name can be everything, keep only the safe characters for a directory name
+		string::const_iterator it;
+		for(it=name.begin();it!=name.end();++it)
+			_path += (isalnum(*it) || *it=='-' || *it=='_') ? *it : '_';
+		_path += '/';
+	}
+	virtual ~HLSStream() {
+		if(_pFile)
+			delete _pFile;
+	}
+
+	const string	name;
+
+	// main thread part
+	PoolThread*		pThread;
+	bool			dropping;
+	bool			video;
+
+	UInt32 pending() {
+		ScopedLock<FastMutex> lock(_mutex);
+		return _pending;
+	}
+	void reserve(UInt32 size) {
+		ScopedLock<FastMutex> lock(_mutex);
+		_pending += size;
+	}
+	void release(UInt32 size) {
+		ScopedLock<FastMutex> lock(_mutex);
+		_pending -= size;
+	}
+
+	// packaging thread part
+	void write(UInt8 type,UInt32 time,const UInt8* data,UInt32 size,bool discontinuity) {
+		if(_failed)
+			return;
+		if(discontinuity)
+			_discontinuity = true;
+		try {
+			if(type==Message::VIDEO)
+				writeVideo(time,data,size);
+			else if(type==Message::AUDIO)
+				writeAudio(time,data,size);
+			else
+				close();
+		} catch(Exception& ex) {
+			ERROR("HLS packaging of %s publication stopped, %s",name.c_str(),ex.displayText().c_str());
+			_failed = true;
+		}
+	}
+
+private:
+	struct Segment {
+		Segment(UInt32 sequence,double duration,bool discontinuity) : sequence(sequence),duration(duration),discontinuity(discontinuity) {}
+		UInt32	sequence;
+		double	duration;
+		bool	discontinuity;
+	};
+
+	void writeVideo(UInt32 time,const UInt8* data,UInt32 size) {
+		if(size<5 || (data[0]&0x0F)!=7) {
+			if(!_warned)
+				WARN("HLS packaging of %s publication, only H.264 video is supported",name.c_str());
+			_warned = true;
+			return;
+		}
+		if(data[1]==0) {
+			readAVCConfig(data+5,size-5);
+			return;
+		}
+		if(data[1]!=1 || _sps.empty())
+			return;
+
+		bool keyFrame = (data[0]>>4)==1;
+		if(keyFrame)
+			cut(time);
+		if(!_pFile)
+			return;
+
+		Int32 compositionTime = (data[2]<<16) | (data[3]<<8) | data[4];
+		if(compositionTime&0x800000)
+			compositionTime |= 0xFF000000;
+		if(compositionTime<0)
+			compositionTime = 0;
+
+		static const UInt8 AccessUnitDelimiter[] = {0x00,0x00,0x00,0x01,0x09,0xF0};
+		_frame.assign(AccessUnitDelimiter,AccessUnitDelimiter+sizeof(AccessUnitDelimiter));
+		if(keyFrame)
+			_frame.insert(_frame.end(),_sps.begin(),_sps.end());
+		data += 5;
+		size -= 5;
+		while(size>_nalLengthSize) {
+			UInt32 length = 0;
+			for(UInt8 i=0;i<_nalLengthSize;++i)
+				length = (length<<8) | data[i];
+			data += _nalLengthSize;
+			size -= _nalLengthSize;
+			if(length>size)
+				length = size;
+			if(length>0 && (data[0]&0x1F)!=9) {
+				_frame.insert(_frame.end(),StartCode,StartCode+sizeof(StartCode));
+				_frame.insert(_frame.end(),data,data+length);
+			}
+			data += length;
+			size -= length;
+		}
+		UInt64 dts = ((UInt64)time)*90;
+		_writer.writeVideo(*_pFile,dts+((UInt64)compositionTime)*90,dts,keyFrame,&_frame[0],_frame.size());
+		_lastTime = time;
+	}
+
+	void readAVCConfig(const UInt8* data,UInt32 size) {
+		if(size<6)
+			return;
+		_nalLengthSize = (data[4]&0x03)+1;
+		_sps.clear();
+		UInt32 pos = 5;
+		// SPS then PPS
+		for(UInt8 set=0;set<2 && pos<size;++set) {
+			UInt8 count = data[pos++];
+			if(set==0)
+				count &= 0x1F;
+			while(count-->0 && pos+2<=size) {
+				UInt16 length = (data[pos]<<8) | data[pos+1];
+				pos += 2;
+				if(pos+length>size)
+					return;
+				_sps.insert(_sps.end(),StartCode,StartCode+sizeof(StartCode));
+				_sps.insert(_sps.end(),data+pos,data+pos+length);
+				pos += length;
+			}
+		}
+	}
+
+	void writeAudio(UInt32 time,const UInt8* data,UInt32 size) {
+		if(size<2 || (data[0]>>4)!=10) {
+			if(!_warned)
+				WARN("HLS packaging of %s publication, only AAC audio is supported",name.c_str());
+			_warned = true;
+			return;
+		}
+		if(data[1]==0) {
+			if(size<4)
+				return;
+			_objectType = data[2]>>3;
+			_sampleRateIndex = ((data[2]&0x07)<<1) | (data[3]>>7);
+			_channels = (data[3]>>3)&0x0F;
+			_audioConfig = true;
+			return;
+		}
+		if(!_audioConfig)
+			return;
+		if(_sps.empty()) // audio only
+			cut(time);
+		if(!_pFile)
+			return;
+
+		data += 2;
+		size -= 2;
+		UInt32 length = size+7;
+		UInt8 adts[7];
+		adts[0] = 0xFF;
+		adts[1] = 0xF1;
+		adts[2] = (((_objectType-1)&0x03)<<6) | (_sampleRateIndex<<2) | (_channels>>2);
+		adts[3] = ((_channels&0x03)<<6) | (UInt8)(length>>11);
+		adts[4] = (UInt8)(length>>3);
+		adts[5] = (UInt8)((length&0x07)<<5) | 0x1F;
+		adts[6] = 0xFC;
+		_frame.assign(adts,adts+sizeof(adts));
+		_frame.insert(_frame.end(),data,data+size);
+		_writer.writeAudio(*_pFile,((UInt64)time)*90,&_frame[0],_frame.size());
+		_lastTime = time;
+	}
+
+	void cut(UInt32 time) {
+		if(_pFile) {
+			if(!_discontinuity && (Int32)(time-_segmentTime)<(Int32)_duration)
+				return;
+			closeSegment(time);
+		} else if(_sequence==0)
+			File(_path).createDirectories();
+
+		string path(_path+NumberFormatter::format(_sequence)+".ts");
+		_pFile = new FileOutputStream(path,ios::out | ios::binary | ios::trunc);
+		_writer.writeTables(*_pFile,!_sps.empty());
+		if(!_pFile->good())
+			throw Exception("impossible to write "+path);
+		_segmentTime = _lastTime = time;
+		_segmentDiscontinuity = _discontinuity;
+		_discontinuity = false;
+	}
+
+	void closeSegment(UInt32 time) {
+		_pFile->close();
+		delete _pFile;
+		_pFile = NULL;
+
+		Int32 duration = (Int32)(time-_segmentTime);
+		_playlist.push_back(Segment(_sequence++,duration>0 ? (duration/1000.0) : 0,_segmentDiscontinuity));
+		while(_playlist.size()>_segments) {
+			File file(_path+NumberFormatter::format(_playlist.front().sequence)+".ts");
+			if(file.exists())
+				file.remove();
+			_playlist.pop_front();
+		}
+		writePlaylist(false);
+	}
+
+	void close() {
+		if(!_pFile)
+			return;
+		closeSegment(_lastTime);
+		writePlaylist(true);
+	}
+
+	void writePlaylist(bool end) {
+		UInt32 target = 1;
+		deque<Segment>::const_iterator it;
+		for(it=_playlist.begin();it!=_playlist.end();++it) {
+			UInt32 duration = (UInt32)(it->duration+0.999);
+			if(duration>target)
+				target = duration;
+		}
+		string content(format("#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%u\n#EXT-X-MEDIA-SEQUENCE:%u\n",target,_playlist.empty() ? _sequence : _playlist.front().sequence));
+		for(it=_playlist.begin();it!=_playlist.end();++it) {
+			if(it->discontinuity)
+				content += "#EXT-X-DISCONTINUITY\n";
+			content += format("#EXTINF:%.3f,\n%u.ts\n",it->duration,it->sequence);
+		}
+		if(end)
+			content += "#EXT-X-ENDLIST\n";
+
+		// rename to never expose a partial playlist
+		string path(_path+"index.m3u8");
+		{
+			FileOutputStream file(path+".tmp",ios::out | ios::trunc);
+			file.write(content.c_str(),content.size());
+		}
+		File(path+".tmp").renameTo(path);
+	}
+
+	Poco::FastMutex		_mutex;
+	UInt32				_pending;
+
+	string				_path;
+	UInt32				_duration;
+	UInt32				_segments;
+	TSWriter			_writer;
+	FileOutputStream*	_pFile;
+	UInt32				_sequence;
+	UInt32				_segmentTime;
+	bool				_segmentDiscontinuity;
+	UInt32				_lastTime;
+	deque<Segment>		_playlist;
+	bool				_discontinuity;
+	bool				_failed;
+	bool				_warned;
+
+	vector<UInt8>		_frame;
+	vector<UInt8>		_sps;
+	UInt8				_nalLengthSize;
+	bool				_audioConfig;
+	UInt8				_objectType;
+	UInt8				_sampleRateIndex;
+	UInt8				_channels;
+};
+
+class HLSJob : public WorkThread {
+public:
+	HLSJob(AutoPtr<HLSStream>& pStream,UInt8 type,UInt32 time,const UInt8* data,UInt32 size,bool discontinuity) : _pStream(pStream),_type(type),_time(time),_buffer(size),_discontinuity(discontinuity) {
+		priority = Thread::PRIO_LOW;
+		if(size>0)
+			memcpy(_buffer.begin(),data,size);
+	}
+
+	void run() {
+		_pStream->write(_type,_time,_buffer.begin(),_buffer.size(),_discontinuity);
+		_pStream->release(_buffer.size());
+	}
+
+private:
+	AutoPtr<HLSStream>	_pStream;
+	UInt8				_type;
+	UInt32				_time;
+	Buffer<UInt8>		_buffer;
+	bool				_discontinuity;
+};
+
+
+HLSPackager::HLSPackager(const string& directory,UInt32 duration,UInt32 segments,UInt32 bufferSize,UInt32 threads) : enabled(!directory.empty()),
+	_directory(directory),_duration(duration==0 ? 1 : duration),_segments(segments<3 ? 3 : segments),_bufferSize(bufferSize),_threads(threads==0 ? 1 : threads) {
+	if(!enabled)
+		return;
+	if(_directory[_directory.size()-1]!='/')
+		_directory += '/';
+	NOTE("HLS packaging in %s, segments of %u seconds",_directory.c_str(),_duration);
+}
+
+HLSPackager::~HLSPackager() {
+	stop();
+}
+
+void HLSPackager::start() {
+	if(enabled)
+		_threads.launch();
+}
+
+void HLSPackager::stop() {
+	_threads.clear();
+	_streams.clear();
+}
+
+void HLSPackager::pushAudioPacket(const Publication& publication,UInt32 time,PacketReader& packet) {
+	push(publication,Message::AUDIO,time,packet);
+}
+
+void HLSPackager::pushVideoPacket(const Publication& publication,UInt32 time,PacketReader& packet) {
+	push(publication,Message::VIDEO,time,packet);
+}
+
+void HLSPackager::unpublish(const Publication& publication) {
+	map<string,AutoPtr<HLSStream> >::iterator it = _streams.find(publication.name());
+	if(it==_streams.end())
+		return;
+	try {
+		_threads.enqueue(AutoPtr<WorkThread>(new HLSJob(it->second,Message::EMPTY,0,NULL,0,false)),it->second->pThread);
+	} catch(Exception& ex) {
+		WARN("HLS packaging of %s publication not finalized, %s",publication.name().c_str(),ex.displayText().c_str());
+	}
+	_streams.erase(it);
+}
+
+void HLSPackager::push(const Publication& publication,UInt8 type,UInt32 time,PacketReader& packet) {
+	if(!enabled)
+		return;
+	AutoPtr<HLSStream>& pStream = _streams[publication.name()];
+	if(pStream.isNull())
+		pStream = new HLSStream(_directory,publication.name(),_duration,_segments);
+
+	const UInt8* data = packet.current();
+	UInt32 size = packet.available();
+	if(type==Message::VIDEO)
+		pStream->video = true;
+
+	// codec configurations are never dropped
+	bool discontinuity = false;
+	if(size>1 && data[1]!=0) {
+		if(pStream->dropping) {
+			bool keyFrame = type==Message::VIDEO ? ((data[0]>>4)==1) : !pStream->video;
+			if(!keyFrame || pStream->pending()>_bufferSize/2)
+				return;
+			pStream->dropping = false;
+			discontinuity = true;
+			NOTE("HLS packaging of %s publication resumed",publication.name().c_str());
+		} else if(pStream->pending()+size>_bufferSize) {
+			pStream->dropping = true;
+			WARN("HLS packaging of %s publication late, %u bytes pending, packets dropped until the next key frame",publication.name().c_str(),pStream->pending());
+			return;
+		}
+	}
+
+	pStream->reserve(size);
+	try {
+		pStream->pThread = _threads.enqueue(AutoPtr<WorkThread>(new HLSJob(pStream,type,time,data,size,discontinuity)),pStream->pThread);
+	} catch(Exception& ex) {
+		pStream->release(size);
+		WARN("HLS packaging of %s publication, %s",publication.name().c_str(),ex.displayText().c_str());
+	}
+}
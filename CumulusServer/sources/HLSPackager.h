@@ -0,0 +1,53 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+
+#pragma once
+
+#include "Publication.h"
+#include "PoolThreads.h"
+#include "Poco/AutoPtr.h"
+#include <map>
+
+class HLSStream;
+
+// Remuxes the H.264/AAC publications in MPEG2-TS segments and m3u8 playlists,
+// the work is done by its own threads to never delay the publications fan-out
+class HLSPackager {
+public:
+	HLSPackager(const std::string& directory,Poco::UInt32 duration,Poco::UInt32 segments,Poco::UInt32 bufferSize,Poco::UInt32 threads);
+	virtual ~HLSPackager();
+
+	const bool			enabled;
+
+	void				start();
+	void				stop();
+
+	void				pushAudioPacket(const Cumulus::Publication& publication,Poco::UInt32 time,Cumulus::PacketReader& packet);
+	void				pushVideoPacket(const Cumulus::Publication& publication,Poco::UInt32 time,Cumulus::PacketReader& packet);
+	void				unpublish(const Cumulus::Publication& publication);
+
+private:
+	void				push(const Cumulus::Publication& publication,Poco::UInt8 type,Poco::UInt32 time,Cumulus::PacketReader& packet);
+
+	std::string										_directory;
+	Poco::UInt32									_duration;
+	Poco::UInt32									_segments;
+	Poco::UInt32									_bufferSize;
+	Cumulus::PoolThreads							_threads;
+	std::map<std::string,Poco::AutoPtr<HLSStream> >	_streams;
+};
@@ -56,6 +56,12 @@ int LUAByteReader::Get(lua_State *pState) {
 			SCRIPT_WRITE_FUNCTION(&LUAByteReader::ReadUTF)
 		else if(name=="readUTFBytes")
 			SCRIPT_WRITE_FUNCTION(&LUAByteReader::ReadUTFBytes)
+		else if(name=="skip")
+			SCRIPT_WRITE_FUNCTION(&LUAByteReader::Skip)
+		else if(name=="pointer") // for ffi.cast("const uint8_t*",reader.pointer), valid only during the callback
+			lua_pushlightuserdata(pState,reader.reader.current());
+		else if(name=="available")
+			SCRIPT_WRITE_NUMBER(reader.reader.available())
 	SCRIPT_CALLBACK_RETURN
 }
 
@@ -163,3 +169,9 @@ int	LUAByteReader::ReadUTFBytes(lua_State *pState) {
 		SCRIPT_WRITE_BINARY(value.c_str(),value.size())
 	SCRIPT_CALLBACK_RETURN
 }
+
+int	LUAByteReader::Skip(lua_State *pState) {
+	SCRIPT_CALLBACK(AMFReader,LUAByteReader,reader)
+		reader.reader.next(SCRIPT_READ_UINT(0));
+	SCRIPT_CALLBACK_RETURN
+}
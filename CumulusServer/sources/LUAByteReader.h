@@ -44,6 +44,7 @@ private:
 	static int	ReadUnsignedShort(lua_State *pState);
 	static int	ReadUTF(lua_State *pState);
 	static int	ReadUTFBytes(lua_State *pState);
+	static int	Skip(lua_State *pState);
 };
 
 
@@ -24,8 +24,10 @@ using namespace std;
 using namespace Cumulus;
 
 const char*		LUAClient::Name="Cumulus::Client";
+set<Client*>	LUAClient::Managed;
 
 void LUAClient::Clear(lua_State* pState,const Client& client){
+	Managed.erase((Client*)&client);
 	Script::ClearPersistentObject<FlowWriter,LUAFlowWriter>(pState,((Client&)client).writer());
 	Script::ClearPersistentObject<Client,LUAClient>(pState,client);
 }
@@ -63,6 +65,12 @@ int LUAClient::Get(lua_State *pState) {
 int LUAClient::Set(lua_State *pState) {
 	SCRIPT_CALLBACK(Client,LUAClient,client)
 		string name = SCRIPT_READ_STRING("");
+		if(name=="onManage") {
+			if(lua_isfunction(pState,3))
+				Managed.insert(&client);
+			else
+				Managed.erase(&client);
+		}
 		lua_rawset(pState,1); // consumes key and value
 	SCRIPT_CALLBACK_RETURN
 }
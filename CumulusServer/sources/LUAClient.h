@@ -19,6 +19,7 @@
 
 #include "Script.h"
 #include "Client.h"
+#include <set>
 
 class LUAClient {
 public:
@@ -30,5 +31,8 @@ public:
 
 	static void ID(std::string& id){}
 
+	// clients which have defined a onManage member
+	static std::set<Cumulus::Client*> Managed;
+
 };
 
@@ -26,6 +26,7 @@ using namespace Poco;
 class NewWriter : public FlowWriter {
 public:
 	NewWriter(const string& signature,BandWriter& band) : FlowWriter(signature,band),pState(NULL) {
+		priority=DATA;
 	}
 	virtual ~NewWriter(){
 		Script::ClearPersistentObject<NewWriter,LUAFlowWriter>(pState,*this);
@@ -64,6 +65,10 @@ int LUAFlowWriter::Get(lua_State *pState) {
 		string name = SCRIPT_READ_STRING("");
 		if(name=="reliable") {
 			SCRIPT_WRITE_BOOL(writer.reliable)
+		} else if(name=="priority") {
+			SCRIPT_WRITE_NUMBER(writer.priority)
+		} else if(name=="weight") {
+			SCRIPT_WRITE_NUMBER(writer.weight)
 		} else if(name=="flush") {
 			SCRIPT_WRITE_FUNCTION(&LUAFlowWriter::Flush)
 		} else if(name=="writeAMFResult") {
@@ -85,7 +90,14 @@ int LUAFlowWriter::Set(lua_State *pState) {
 		string name = SCRIPT_READ_STRING("");
 		if(name=="reliable")
 			writer.reliable = lua_toboolean(pState,-1)==0 ? false : true;
-		else
+		else if(name=="priority") {
+			// 0=control, 1=audio, 2=video, 3=data
+			lua_Integer priority = lua_tointeger(pState,-1);
+			writer.priority = priority<=FlowWriter::CONTROL ? FlowWriter::CONTROL : (priority>=FlowWriter::DATA ? FlowWriter::DATA : (FlowWriter::Priority)priority);
+		} else if(name=="weight") {
+			lua_Integer weight = lua_tointeger(pState,-1);
+			writer.weight = weight<1 ? 1 : (weight>255 ? 255 : (UInt8)weight);
+		} else
 			lua_rawset(pState,1); // consumes key and value
 	SCRIPT_CALLBACK_RETURN
 }
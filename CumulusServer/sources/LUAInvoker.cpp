@@ -24,6 +24,7 @@
 #include "LUATCPServer.h"
 #include "LUAUDPSocket.h"
 #include "LUAMail.h"
+#include "LUAWork.h"
 #include "LUAServers.h"
 #include "Server.h"
 #include <openssl/evp.h>
@@ -172,6 +173,28 @@ int	LUAInvoker::SendMail(lua_State* pState) {
 	SCRIPT_CALLBACK_RETURN
 }
 
+int	LUAInvoker::Work(lua_State* pState) {
+	SCRIPT_CALLBACK(Invoker,LUAInvoker,invoker)
+		string key = SCRIPT_READ_STRING("");
+		string name = SCRIPT_READ_STRING("");
+		Workers& workers = ((Server&)invoker).workers;
+		if(workers.count()==0) {
+			SCRIPT_ERROR("No Lua worker, see 'workers' configuration")
+			SCRIPT_WRITE_NIL
+		} else {
+			BinaryStream stream;
+			Cumulus::BinaryWriter rawWriter(stream);
+			AMFWriter writer(rawWriter);
+			SCRIPT_READ_AMF(writer)
+
+			LUAWork* pWork = new LUAWork(pState);
+			workers.post(key,name,stream.data(),stream.size(),pWork);
+
+			SCRIPT_WRITE_PERSISTENT_OBJECT(LUAWork,LUAWork,*pWork)
+		}
+	SCRIPT_CALLBACK_RETURN
+}
+
 int	LUAInvoker::AddToBlacklist(lua_State* pState) {
 	SCRIPT_CALLBACK(Invoker,LUAInvoker,invoker)	
 		while(SCRIPT_CAN_READ) {
@@ -238,6 +261,8 @@ int LUAInvoker::Get(lua_State *pState) {
 			SCRIPT_WRITE_FUNCTION(&LUAInvoker::Sha256)
 		} else if(name=="sendMail") {
 			SCRIPT_WRITE_FUNCTION(&LUAInvoker::SendMail)
+		} else if(name=="work") {
+			SCRIPT_WRITE_FUNCTION(&LUAInvoker::Work)
 		} else if(name=="addToBlacklist") {
 			SCRIPT_WRITE_FUNCTION(&LUAInvoker::AddToBlacklist)
 		} else if(name=="removeFromBlacklist") {
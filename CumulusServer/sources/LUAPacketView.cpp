@@ -0,0 +1,214 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "LUAPacketView.h"
+
+using namespace std;
+using namespace Poco;
+
+const char*		LUAPacketView::Name="Cumulus::PacketView";
+
+
+int LUAPacketView::Write(lua_State* pState,const UInt8* data,UInt32 size) {
+	View* pView = (View*)lua_newuserdata(pState,sizeof(View));
+	pView->data = data;
+	pView->size = size;
+
+	// shared metatable
+	lua_getfield(pState,LUA_REGISTRYINDEX,Name);
+	if(!lua_istable(pState,-1)) {
+		lua_pop(pState,1);
+		lua_newtable(pState);
+		lua_pushcfunction(pState,&LUAPacketView::Index);
+		lua_setfield(pState,-2,"__index");
+		lua_pushcfunction(pState,&LUAPacketView::Length);
+		lua_setfield(pState,-2,"__len");
+		lua_pushcfunction(pState,&LUAPacketView::ToString);
+		lua_setfield(pState,-2,"__tostring");
+		lua_pushstring(pState,"change metatable of this object is prohibited");
+		lua_setfield(pState,-2,"__metatable");
+		lua_pushvalue(pState,-1);
+		lua_setfield(pState,LUA_REGISTRYINDEX,Name);
+	}
+	lua_setmetatable(pState,-2);
+
+	// referenced until Clear, to invalidate it even if the script doesn't keep it
+	lua_pushvalue(pState,-1);
+	return luaL_ref(pState,LUA_REGISTRYINDEX);
+}
+
+void LUAPacketView::Clear(lua_State* pState,int reference) {
+	if(reference==LUA_NOREF || reference==LUA_REFNIL)
+		return;
+	lua_rawgeti(pState,LUA_REGISTRYINDEX,reference);
+	View* pView = (View*)lua_touserdata(pState,-1);
+	if(pView) {
+		pView->data = NULL;
+		pView->size = 0;
+	}
+	lua_pop(pState,1);
+	luaL_unref(pState,LUA_REGISTRYINDEX,reference);
+}
+
+LUAPacketView::View* LUAPacketView::Get(lua_State* pState,int index) {
+	void* pView = lua_touserdata(pState,index);
+	if(!pView || !lua_getmetatable(pState,index))
+		return NULL;
+	lua_getfield(pState,LUA_REGISTRYINDEX,Name);
+	bool isView = lua_rawequal(pState,-1,-2)!=0;
+	lua_pop(pState,2);
+	return isView ? (View*)pView : NULL;
+}
+
+const UInt8* LUAPacketView::Read(lua_State* pState,int index,UInt32& size) {
+	View* pView = Get(pState,index);
+	if(!pView || !Valid(pState,*pView))
+		return NULL;
+	size = pView->size;
+	return pView->data;
+}
+
+bool LUAPacketView::Valid(lua_State* pState,View& view) {
+	if(view.data)
+		return true;
+	SCRIPT_BEGIN(pState)
+		SCRIPT_ERROR("Packet view used outside of its callback, copy it to keep it")
+	SCRIPT_END
+	return false;
+}
+
+LUAPacketView::View* LUAPacketView::This(lua_State* pState) {
+	View* pView = Get(pState,1);
+	if(pView)
+		return pView;
+	SCRIPT_BEGIN(pState)
+		SCRIPT_ERROR("bad 'this' argument, call method with ':' colon operator")
+	SCRIPT_END
+	return NULL;
+}
+
+int LUAPacketView::Index(lua_State* pState) {
+	View* pView = Get(pState,1);
+	const char* name = lua_tostring(pState,2);
+	if(!pView || !name)
+		return 0;
+	if(strcmp(name,"byte")==0)
+		lua_pushcfunction(pState,&LUAPacketView::Byte);
+	else if(strcmp(name,"copy")==0 || strcmp(name,"sub")==0)
+		lua_pushcfunction(pState,&LUAPacketView::Copy);
+	else if(strcmp(name,"size")==0)
+		lua_pushnumber(pState,pView->size);
+	else if(strcmp(name,"pointer")==0) { // for ffi.cast("const uint8_t*",packet.pointer)
+		if(pView->data)
+			lua_pushlightuserdata(pState,(void*)pView->data);
+		else
+			lua_pushnil(pState);
+	} else {
+		// other string methods (find, match, len...) work on a copy
+		lua_getglobal(pState,"string");
+		if(!lua_istable(pState,-1)) {
+			lua_pop(pState,1);
+			return 0;
+		}
+		lua_getfield(pState,-1,name);
+		if(!lua_isfunction(pState,-1)) {
+			lua_pop(pState,2);
+			return 0;
+		}
+		lua_pushcclosure(pState,&LUAPacketView::StringFunction,1);
+		lua_replace(pState,-2);
+	}
+	return 1;
+}
+
+int LUAPacketView::StringFunction(lua_State* pState) {
+	View* pView = This(pState);
+	if(!pView || !Valid(pState,*pView))
+		return 0;
+	int top = lua_gettop(pState);
+	lua_pushvalue(pState,lua_upvalueindex(1));
+	lua_pushlstring(pState,(const char*)pView->data,pView->size);
+	for(int i=2;i<=top;++i)
+		lua_pushvalue(pState,i);
+	lua_call(pState,top,LUA_MULTRET);
+	return lua_gettop(pState)-top;
+}
+
+int LUAPacketView::Length(lua_State* pState) {
+	View* pView = This(pState);
+	lua_pushnumber(pState,pView ? pView->size : 0);
+	return 1;
+}
+
+int LUAPacketView::ToString(lua_State* pState) {
+	View* pView = This(pState);
+	if(!pView || !Valid(pState,*pView))
+		lua_pushnil(pState);
+	else
+		lua_pushlstring(pState,(const char*)pView->data,pView->size);
+	return 1;
+}
+
+// same arguments as string.sub and string.byte: 1-based, negative from the end, bounded to the packet
+bool LUAPacketView::Range(lua_State* pState,View& view,UInt32& first,UInt32& last) {
+	if(!Valid(pState,view))
+		return false;
+	Int32 size = view.size;
+	Int32 i = luaL_optinteger(pState,2,1);
+	Int32 j = luaL_optinteger(pState,3,i);
+	if(i<0)
+		i += size+1;
+	if(j<0)
+		j += size+1;
+	if(i<1)
+		i = 1;
+	if(j>size)
+		j = size;
+	if(i>j)
+		return false;
+	first = i-1;
+	last = j;
+	return true;
+}
+int LUAPacketView::Byte(lua_State* pState) {
+	View* pView = This(pState);
+	UInt32 first,last;
+	if(!pView || !Range(pState,*pView,first,last))
+		return 0;
+	luaL_checkstack(pState,last-first,"packet view, too many bytes asked");
+	for(UInt32 i=first;i<last;++i)
+		lua_pushinteger(pState,pView->data[i]);
+	return last-first;
+}
+
+int LUAPacketView::Copy(lua_State* pState) {
+	View* pView = This(pState);
+	if(pView && lua_gettop(pState)<3) { // copy() = whole, copy(i) = from i to the end
+		lua_settop(pState,2);
+		lua_pushinteger(pState,-1);
+	}
+	UInt32 first,last;
+	if(!pView || !Range(pState,*pView,first,last)) {
+		if(pView && pView->data)
+			lua_pushliteral(pState,"");
+		else
+			lua_pushnil(pState);
+		return 1;
+	}
+	lua_pushlstring(pState,(const char*)pView->data+first,last-first);
+	return 1;
+}
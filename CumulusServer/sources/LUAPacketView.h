@@ -0,0 +1,50 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+#pragma once
+
+#include "Script.h"
+
+// Non-owning view on a packet given to a script callback, valid only during this callback:
+// no payload copy, and a view kept after its callback raises an error instead of reading another packet.
+// Accepted by functions which take binary data (pushAudioPacket, send...), tostring(view) copies it.
+class LUAPacketView {
+public:
+	static const char* Name;
+
+	// pushes a new view, returns a reference to give to Clear after the callback
+	static int					Write(lua_State* pState,const Poco::UInt8* data,Poco::UInt32 size);
+	static void					Clear(lua_State* pState,int reference);
+	// data of the view at index, NULL if it's not a valid view
+	static const Poco::UInt8*	Read(lua_State* pState,int index,Poco::UInt32& size);
+
+private:
+	struct View {
+		const Poco::UInt8*	data;
+		Poco::UInt32		size;
+	};
+	static View*	Get(lua_State* pState,int index);
+	static View*	This(lua_State* pState);
+	static bool		Valid(lua_State* pState,View& view);
+
+	static int		Index(lua_State* pState);
+	static int		Length(lua_State* pState);
+	static int		ToString(lua_State* pState);
+	static int		Byte(lua_State* pState);
+	static int		Copy(lua_State* pState);
+	static int		StringFunction(lua_State* pState);
+	static bool		Range(lua_State* pState,View& view,Poco::UInt32& first,Poco::UInt32& last);
+};
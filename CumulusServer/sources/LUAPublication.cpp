@@ -50,6 +50,7 @@ int	LUAPublication::Close(lua_State *pState) {
 int	LUAPublication::Flush(lua_State *pState) {
 	SCRIPT_CALLBACK(Publication,LUAPublication,publication)
 		publication.flush();
+		publication.waitFanOut(); // the script can write to the listeners then
 	SCRIPT_CALLBACK_RETURN
 }
 
@@ -61,6 +62,7 @@ int	LUAPublication::PushAudioPacket(lua_State *pState) {
 			PacketReader reader(pData,size);
 			reader.next(SCRIPT_READ_UINT(0)); // offset
 			publication.pushAudioPacket(time,reader,SCRIPT_READ_UINT(0));
+			publication.waitFanOut();
 		}
 	SCRIPT_CALLBACK_RETURN
 }
@@ -73,6 +75,7 @@ int	LUAPublication::PushVideoPacket(lua_State *pState) {
 			PacketReader reader(pData,size);
 			reader.next(SCRIPT_READ_UINT(0)); // offset
 			publication.pushVideoPacket(time,reader,SCRIPT_READ_UINT(0));
+			publication.waitFanOut();
 		}
 	SCRIPT_CALLBACK_RETURN
 }
@@ -85,6 +88,7 @@ int	LUAPublication::PushDataPacket(lua_State *pState) {
 			PacketReader reader(pData,size);
 			reader.next(SCRIPT_READ_UINT(0)); // offset
 			publication.pushDataPacket(name,reader);
+			publication.waitFanOut();
 		}
 	SCRIPT_CALLBACK_RETURN
 }
@@ -103,6 +107,10 @@ int LUAPublication::Get(lua_State *pState) {
 			SCRIPT_WRITE_PERSISTENT_OBJECT(QualityOfService,LUAQualityOfService,publication.audioQOS())
 		} else if(name=="videoQOS") {
 			SCRIPT_WRITE_PERSISTENT_OBJECT(QualityOfService,LUAQualityOfService,publication.videoQOS())
+		} else if(name=="fanOutLatency") {
+			SCRIPT_WRITE_NUMBER(publication.fanOutLatency())
+		} else if(name=="fanOutPeakLatency") {
+			SCRIPT_WRITE_NUMBER(publication.fanOutPeakLatency())
 		} else if(name=="close") {
 			SCRIPT_WRITE_FUNCTION(&LUAPublication::Close)
 		} else if(name=="pushAudioPacket") {
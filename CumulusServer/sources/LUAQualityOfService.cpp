@@ -37,6 +37,8 @@ int LUAQualityOfService::Get(lua_State *pState) {
 			SCRIPT_WRITE_NUMBER(qos.latency)
 		} else if(name=="droppedFrames") {
 			SCRIPT_WRITE_NUMBER(qos.droppedFrames)
+		} else if(name=="recoveredFragments") {
+			SCRIPT_WRITE_NUMBER(qos.recoveredFragments)
 		}
 	SCRIPT_CALLBACK_RETURN
 }
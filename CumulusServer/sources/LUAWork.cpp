@@ -0,0 +1,60 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "LUAWork.h"
+#include "Service.h"
+
+using namespace std;
+using namespace Poco;
+using namespace Cumulus;
+
+
+const char*		LUAWork::Name="LUAWork";
+
+LUAWork::LUAWork(lua_State* pState) : _pState(pState) {
+}
+
+LUAWork::~LUAWork() {
+}
+
+void LUAWork::onDone(AMFReader& results,const char* error){
+	SCRIPT_BEGIN(_pState)
+		if(error) {
+			SCRIPT_MEMBER_FUNCTION_BEGIN(LUAWork,LUAWork,*this,"onError")
+				SCRIPT_WRITE_STRING(error)
+				SCRIPT_FUNCTION_CALL
+			SCRIPT_FUNCTION_END
+		} else {
+			SCRIPT_MEMBER_FUNCTION_BEGIN(LUAWork,LUAWork,*this,"onResult")
+				SCRIPT_WRITE_AMF(results,0)
+				SCRIPT_FUNCTION_CALL
+			SCRIPT_FUNCTION_END
+		}
+	SCRIPT_END
+	Script::ClearPersistentObject<LUAWork,LUAWork>(_pState,*this);
+	delete this;
+}
+
+int LUAWork::Get(lua_State* pState) {
+	// no property, onResult and onError are raw fields of the object
+	return 0;
+}
+
+int LUAWork::Set(lua_State* pState) {
+	lua_rawset(pState,1); // consumes key and value
+	return 0;
+}
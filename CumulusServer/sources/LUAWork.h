@@ -0,0 +1,37 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Script.h"
+#include "Workers.h"
+
+class LUAWork : public WorkHandler {
+public:
+	LUAWork(lua_State* pState);
+	virtual ~LUAWork();
+
+	static const char* Name;
+
+	static int Get(lua_State* pState);
+	static int Set(lua_State* pState);
+
+	static void ID(std::string& id){}
+private:
+	void		onDone(Cumulus::AMFReader& results,const char* error);
+	lua_State*			_pState;
+};
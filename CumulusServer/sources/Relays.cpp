@@ -0,0 +1,277 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+
+#include "Relays.h"
+#include "Logs.h"
+#include "Message.h"
+#include "Poco/Buffer.h"
+
+using namespace std;
+using namespace Cumulus;
+using namespace Poco;
+
+class RelayTask : public Task {
+public:
+	RelayTask(Relays& relays,TaskHandler& handler,UInt8 type,const string& address,const UInt8* data=NULL,UInt32 size=0) : Task(&handler),_relays(relays),_type(type),_address(address),_buffer(size) {
+		if(size>0)
+			memcpy(_buffer.begin(),data,size);
+	}
+
+private:
+	void handle() {
+		PacketReader reader(_buffer.begin(),_buffer.size());
+		try {
+			_relays.handle(_type,_address,reader);
+		} catch(Exception& ex) {
+			ERROR("Relay from %s server, %s",_address.c_str(),ex.displayText().c_str());
+		}
+		delete this;
+	}
+
+	Relays&			_relays;
+	UInt8			_type;
+	string			_address;
+	Buffer<UInt8>	_buffer;
+};
+
+
+Relays::Relays(Invoker& invoker,Servers& servers,bool enabled) : _invoker(invoker),_servers(servers),enabled(enabled) {
+	if(enabled)
+		NOTE("Publications relay between servers enabled");
+}
+
+Relays::~Relays() {
+}
+
+bool Relays::message(ServerConnection& server,const string& handler,PacketReader& reader) {
+	UInt8 type=0;
+	if(handler=="relay.packet")
+		type = PACKET;
+	else if(handler=="relay.pull")
+		type = PULL;
+	else if(handler=="relay.stop")
+		type = STOP;
+	else
+		return false;
+	(new RelayTask(*this,_invoker,type,server.address,reader.current(),reader.available()))->waitHandleEx(false);
+	return true;
+}
+
+void Relays::connection(ServerConnection& server) {
+	(new RelayTask(*this,_invoker,CONNECTION,server.address))->waitHandleEx(false);
+}
+
+void Relays::disconnection(const ServerConnection& server) {
+	(new RelayTask(*this,_invoker,DISCONNECTION,server.address))->waitHandleEx(false);
+}
+
+void Relays::send(const string& address,const string& handler,ServerMessage& message) {
+	Servers::Iterator it;
+	for(it=_servers.begin();it!=_servers.end();++it) {
+		if((*it)->address==address) {
+			(*it)->send(handler,message);
+			return;
+		}
+	}
+	DEBUG("Relay impossible, server %s unfound",address.c_str());
+}
+
+void Relays::stop(const string& address,const string& name) {
+	ServerMessage message;
+	message << name;
+	if(address.empty())
+		_servers.broadcast("relay.stop",message);
+	else
+		send(address,"relay.stop",message);
+}
+
+void Relays::pull(const string& name) {
+	if(!enabled || _servers.count()==0)
+		return;
+	map<string,string>::iterator it = _pulls.lower_bound(name);
+	if(it!=_pulls.end() && it->first==name)
+		return;
+	if(it!=_pulls.begin())
+		--it;
+	_pulls.insert(it,pair<string,string>(name,""));
+	DEBUG("Publication %s unfound locally, pulled from %u servers",name.c_str(),_servers.count());
+	ServerMessage message;
+	message << name;
+	_servers.broadcast("relay.pull",message);
+}
+
+void Relays::manage() {
+	// releases the pulls without listener
+	map<string,string>::iterator it=_pulls.begin();
+	while(it!=_pulls.end()) {
+		Publications::Iterator itPub = _invoker.publications(it->first);
+		if(itPub!=_invoker.publications.end() && itPub->second->listeners.count()>0) {
+			++it;
+			continue;
+		}
+		DEBUG("Pull of the %s publication released",it->first.c_str());
+		stop(it->second,it->first);
+		unpublishLocal(it->first);
+		_pulls.erase(it++);
+	}
+}
+
+void Relays::unpublishLocal(const string& name) {
+	map<string,Publication*>::iterator it = _publications.find(name);
+	if(it==_publications.end())
+		return;
+	Publication* pPublication = it->second;
+	_publications.erase(it);
+	_invoker.unpublish(*pPublication);
+}
+
+void Relays::push(const Publication& publication,UInt8 type,UInt32 time,const string& name,PacketReader& packet) {
+	map<string,set<string> >::const_iterator it = _subscribers.find(publication.name());
+	if(it==_subscribers.end())
+		return;
+	ServerMessage message;
+	message << publication.name();
+	message.write8(type);
+	if(type==Message::AMF)
+		message << name;
+	else if(type!=Message::EMPTY)
+		message.write32(time);
+	message.writeRaw(packet.current(),packet.available());
+	set<string>::const_iterator itAddress;
+	for(itAddress=it->second.begin();itAddress!=it->second.end();++itAddress)
+		send(*itAddress,"relay.packet",message);
+}
+
+void Relays::unpublish(const Publication& publication) {
+	PacketReader empty(NULL,0);
+	push(publication,Message::EMPTY,0,publication.name(),empty);
+}
+
+void Relays::handle(UInt8 type,const string& address,PacketReader& reader) {
+	switch(type) {
+		case PACKET:
+			receive(address,reader);
+			break;
+		case PULL: {
+			string name;
+			reader >> name;
+			DEBUG("Publication %s pulled by the %s server",name.c_str(),address.c_str());
+			_subscribers[name].insert(address);
+			break;
+		}
+		case STOP: {
+			string name;
+			reader >> name;
+			map<string,set<string> >::iterator it = _subscribers.find(name);
+			if(it==_subscribers.end())
+				break;
+			it->second.erase(address);
+			if(it->second.empty())
+				_subscribers.erase(it);
+			break;
+		}
+		case CONNECTION: {
+			// asks to the new server the publications pulled without origin
+			map<string,string>::const_iterator it;
+			for(it=_pulls.begin();it!=_pulls.end();++it) {
+				if(!it->second.empty())
+					continue;
+				ServerMessage message;
+				message << it->first;
+				send(address,"relay.pull",message);
+			}
+			break;
+		}
+		case DISCONNECTION: {
+			map<string,set<string> >::iterator itSub=_subscribers.begin();
+			while(itSub!=_subscribers.end()) {
+				itSub->second.erase(address);
+				if(itSub->second.empty())
+					_subscribers.erase(itSub++);
+				else
+					++itSub;
+			}
+			map<string,string>::iterator it;
+			for(it=_pulls.begin();it!=_pulls.end();++it) {
+				if(it->second!=address)
+					continue;
+				// origin lost, pulls it again from the other servers
+				it->second.clear();
+				unpublishLocal(it->first);
+				ServerMessage message;
+				message << it->first;
+				_servers.broadcast("relay.pull",message);
+			}
+			break;
+		}
+	}
+}
+
+void Relays::receive(const string& address,PacketReader& reader) {
+	string name;
+	reader >> name;
+	UInt8 type = reader.read8();
+
+	map<string,string>::iterator it = _pulls.find(name);
+	if(it==_pulls.end()) {
+		stop(address,name);
+		return;
+	}
+	// the first origin which answers is kept
+	if(it->second.empty())
+		it->second = address;
+	else if(it->second!=address) {
+		stop(address,name);
+		return;
+	}
+
+	if(type==Message::EMPTY) {
+		it->second.clear();
+		unpublishLocal(name);
+		return;
+	}
+
+	Publication* pPublication = NULL;
+	map<string,Publication*>::const_iterator itPub = _publications.find(name);
+	if(itPub==_publications.end()) {
+		try {
+			pPublication = &_invoker.publish(name);
+		} catch(Exception& ex) {
+			WARN("Relay of the %s publication from %s server impossible, %s",name.c_str(),address.c_str(),ex.displayText().c_str());
+			stop(address,name);
+			_pulls.erase(it);
+			return;
+		}
+		_publications[name] = pPublication;
+		NOTE("Publication %s relayed from %s server",name.c_str(),address.c_str());
+	} else
+		pPublication = itPub->second;
+
+	if(type==Message::AMF) {
+		string dataName;
+		reader >> dataName;
+		pPublication->pushDataPacket(dataName,reader);
+	} else {
+		UInt32 time = reader.read32();
+		if(type==Message::AUDIO)
+			pPublication->pushAudioPacket(time,reader);
+		else if(type==Message::VIDEO)
+			pPublication->pushVideoPacket(time,reader);
+	}
+	pPublication->flush();
+}
@@ -0,0 +1,66 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+
+#pragma once
+
+#include "Invoker.h"
+#include "Servers.h"
+
+class Relays {
+	friend class RelayTask;
+public:
+	Relays(Cumulus::Invoker& invoker,Servers& servers,bool enabled);
+	virtual ~Relays();
+
+	const bool		enabled;
+
+	// Edge side, pulls a publication unfound locally from the origin servers
+	void			pull(const std::string& name);
+	void			manage();
+
+	// Origin side, pushes the publication packets to the edge servers which have pulled it
+	void			push(const Cumulus::Publication& publication,Poco::UInt8 type,Poco::UInt32 time,const std::string& name,Cumulus::PacketReader& packet);
+	void			unpublish(const Cumulus::Publication& publication);
+
+	// Called by the sockets thread, the job is given to the main thread
+	bool			message(ServerConnection& server,const std::string& handler,Cumulus::PacketReader& reader);
+	void			connection(ServerConnection& server);
+	void			disconnection(const ServerConnection& server);
+
+private:
+	enum Type {
+		PULL=1,
+		STOP,
+		PACKET,
+		CONNECTION,
+		DISCONNECTION
+	};
+
+	void			handle(Poco::UInt8 type,const std::string& address,Cumulus::PacketReader& reader);
+	void			receive(const std::string& address,Cumulus::PacketReader& reader);
+	void			unpublishLocal(const std::string& name);
+	void			stop(const std::string& address,const std::string& name);
+	void			send(const std::string& address,const std::string& handler,ServerMessage& message);
+
+	Cumulus::Invoker&								_invoker;
+	Servers&										_servers;
+
+	std::map<std::string,std::string>				_pulls; // publication name -> origin server address
+	std::map<std::string,Cumulus::Publication*>		_publications;
+	std::map<std::string,std::set<std::string> >	_subscribers; // publication name -> edge server addresses
+};
@@ -20,19 +20,26 @@
 #include "Util.h"
 #include "LUAByteReader.h"
 #include "LUAByteWriter.h"
+#include "LUAPacketView.h"
 #include "Service.h"
 #include "Poco/DateTime.h"
 #include "Poco/Timezone.h"
 #include <math.h>
 extern "C" {
+#if defined(CUMULUS_LUA51)
+	#include "lua5.1/lualib.h"
+#else
 	#include "luajit-2.0/lualib.h"
+#endif
 }
 
 using namespace std;
 using namespace Poco;
 using namespace Cumulus;
 
-lua_Debug	Script::LuaDebug;
+ThreadLocal<lua_Debug>	Script::LuaDebug;
+UInt32					Script::Generation(0);
+UInt32					Script::Calls(0);
 
 const char* Script::LastError(lua_State *pState) {
 	const char* error = lua_tostring(pState,-1);
@@ -41,6 +48,15 @@ const char* Script::LastError(lua_State *pState) {
 	return error;
 }
 
+const UInt8* Script::ReadBinary(lua_State *pState,int index,UInt32& size) {
+	if(lua_isstring(pState,index)) {
+		const UInt8* data = (const UInt8*)lua_tostring(pState,index);
+		size = lua_objlen(pState,index);
+		return data;
+	}
+	return LUAPacketView::Read(pState,index,size);
+}
+
 int Script::Error(lua_State *pState) {
 #undef SCRIPT_LOG_NAME_DISABLED
 #define SCRIPT_LOG_NAME_DISABLED true
@@ -313,10 +329,8 @@ void Script::WriteAMF(lua_State *pState,AMF::Type type,AMFReader& reader) {
 				lua_pushvalue(pState,-2);
 				// reader
 				SCRIPT_WRITE_OBJECT(AMFReader,LUAByteReader,reader)
-				Service::StartVolatileObjectsRecording(pState);
 				if(lua_pcall(pState,2,0,0)!=0)
 					SCRIPT_ERROR("%s",Script::LastError(pState))
-				Service::StopVolatileObjectsRecording(pState);
 				break;
 			}
 			
@@ -436,10 +450,8 @@ void Script::ReadAMF(lua_State* pState,AMFWriter& writer,UInt32 count,map<UInt64
 						lua_pushvalue(pState,args);
 						// type argument
 						SCRIPT_WRITE_OBJECT(AMFWriter,LUAByteWriter,writer)
-						Service::StartVolatileObjectsRecording(pState);
 						if(lua_pcall(pState,2,0,0)!=0)
 							SCRIPT_ERROR("%s",Script::LastError(pState))
-						Service::StopVolatileObjectsRecording(pState);
 						writer.endExternalizableObject();
 						it->second = writer.lastReference;
 						lua_pop(pState,1);
@@ -613,5 +625,9 @@ void Script::AddObjectDestructor(lua_State *pState,lua_CFunction destructor) {
 
 	lua_setfield(pState, -2, "__gcThis"); // userdata in metatable
 
+	// owned by the script now, not volatile
+	lua_pushnil(pState);
+	lua_setfield(pState,-2,"//generation");
+
 	lua_pop(pState,1);
 }
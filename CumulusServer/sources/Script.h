@@ -23,30 +23,36 @@
 #include "Logs.h"
 #include "Poco/Format.h"
 #include "Poco/NumberFormatter.h"
+#include "Poco/ThreadLocal.h"
 #include <cstring>
 
 
 extern "C" {
+#if defined(CUMULUS_LUA51)
+	#include "lua5.1/lua.h"
+	#include "lua5.1/lauxlib.h"
+#else
 	#include "luajit-2.0/lua.h"
 	#include "luajit-2.0/lauxlib.h"
+#endif
 }
 
 
-#define SCRIPT_FILE(DEFAULT)					(strlen(Script::LuaDebug.short_src)>0 && strcmp(Script::LuaDebug.short_src,"[C]")!=0) ? Script::LuaDebug.short_src : DEFAULT
-#define SCRIPT_LINE(DEFAULT)					Script::LuaDebug.currentline>0 ? Script::LuaDebug.currentline : DEFAULT
+#define SCRIPT_FILE(DEFAULT)					(strlen(Script::LuaDebug->short_src)>0 && strcmp(Script::LuaDebug->short_src,"[C]")!=0) ? Script::LuaDebug->short_src : DEFAULT
+#define SCRIPT_LINE(DEFAULT)					Script::LuaDebug->currentline>0 ? Script::LuaDebug->currentline : DEFAULT
 
-#define SCRIPT_LOG(PRIO,FILE,LINE,FMT, ...)		{ if(lua_getstack(__pState,0,&Script::LuaDebug)==1) lua_getinfo(__pState, "n", &Script::LuaDebug); \
-												if(lua_getstack(__pState,1,&Script::LuaDebug)==1) lua_getinfo(__pState, "Sl", &Script::LuaDebug); \
-												if(!SCRIPT_LOG_NAME_DISABLED && Script::LuaDebug.name) { \
-													if(Script::LuaDebug.namewhat) { \
-														LOG(PRIO,SCRIPT_FILE(FILE),SCRIPT_LINE(LINE),"(%s '%s') "FMT,Script::LuaDebug.namewhat,Script::LuaDebug.name,## __VA_ARGS__) \
+#define SCRIPT_LOG(PRIO,FILE,LINE,FMT, ...)		{ if(lua_getstack(__pState,0,&Script::LuaDebug.get())==1) lua_getinfo(__pState, "n", &Script::LuaDebug.get()); \
+												if(lua_getstack(__pState,1,&Script::LuaDebug.get())==1) lua_getinfo(__pState, "Sl", &Script::LuaDebug.get()); \
+												if(!SCRIPT_LOG_NAME_DISABLED && Script::LuaDebug->name) { \
+													if(Script::LuaDebug->namewhat) { \
+														LOG(PRIO,SCRIPT_FILE(FILE),SCRIPT_LINE(LINE),"(%s '%s') "FMT,Script::LuaDebug->namewhat,Script::LuaDebug->name,## __VA_ARGS__) \
 													} else { \
-														LOG(PRIO,SCRIPT_FILE(FILE),SCRIPT_LINE(LINE),"('%s') "FMT,Script::LuaDebug.name,## __VA_ARGS__)} \
+														LOG(PRIO,SCRIPT_FILE(FILE),SCRIPT_LINE(LINE),"('%s') "FMT,Script::LuaDebug->name,## __VA_ARGS__)} \
 												} else \
 													LOG(PRIO,SCRIPT_FILE(FILE),SCRIPT_LINE(LINE),FMT,## __VA_ARGS__) \
-												Script::LuaDebug.name = Script::LuaDebug.namewhat = NULL; \
-												if(Script::LuaDebug.short_src) Script::LuaDebug.short_src[0]='\0'; \
-												Script::LuaDebug.currentline=0;}
+												Script::LuaDebug->name = Script::LuaDebug->namewhat = NULL; \
+												if(Script::LuaDebug->short_src) Script::LuaDebug->short_src[0]='\0'; \
+												Script::LuaDebug->currentline=0;}
 
 #define SCRIPT_LOG_NAME_DISABLED	false
 #define SCRIPT_FATAL(FMT, ...)		SCRIPT_LOG(Cumulus::Logger::PRIO_FATAL,__FILE__,__LINE__,FMT, ## __VA_ARGS__)
@@ -87,15 +93,16 @@ extern "C" {
 
 #define SCRIPT_MEMBER_FUNCTION_BEGIN(TYPE,LUATYPE,OBJ,MEMBER)	{ if(lua_getmetatable(__pState,LUA_GLOBALSINDEX)!=0) { lua_getfield(__pState,-1,"__pointers");if(!lua_isnil(__pState,-1)) {lua_replace(__pState,-2);std::string __id;Script::GetObjectID<TYPE,LUATYPE>(OBJ,__id);lua_getfield(__pState,-1,__id.c_str());if(!lua_isnil(__pState,-1)) {lua_getfield(__pState,-1,MEMBER);lua_replace(__pState,-3);}}} else {lua_pushnil(__pState);lua_pushnil(__pState);}if(!lua_isfunction(__pState,-2))lua_pop(__pState,2);else {int __top=lua_gettop(__pState)-1;std::string __name = #TYPE;__name += ".";__name += MEMBER;
 #define SCRIPT_FUNCTION_BEGIN(NAME)								{ bool __env=false; if(lua_getmetatable(__pState,LUA_GLOBALSINDEX)!=0) { lua_getfield(__pState,-1,"//env"); lua_replace(__pState,-2); if(!lua_isnil(__pState,-1)) { lua_getfield(__pState,-1,NAME); __env=true;} } else lua_getglobal(__pState,NAME); if(!lua_isfunction(__pState,-1)) lua_pop(__pState,__env ? 2 : 1); else { if(__env) { lua_pushvalue(__pState,-2); lua_setfenv(__pState,-2); lua_replace(__pState,-2); }	int __top=lua_gettop(__pState); string __name = NAME;
-#define SCRIPT_FUNCTION_CALL									Service::StartVolatileObjectsRecording(__pState);if(lua_pcall(__pState,lua_gettop(__pState)-__top,LUA_MULTRET,0)!=0) { __error = lua_tostring(__pState,-1);SCRIPT_ERROR("%s",Script::LastError(__pState))} else {--__top;int __results=lua_gettop(__pState);int __args=__top;
+#define SCRIPT_EVENT_BEGIN(SERVICE,EVENT)						{ if((SERVICE).push(Service::EVENT)) { int __top=lua_gettop(__pState); string __name = Service::EventNames[Service::EVENT];
+#define SCRIPT_FUNCTION_CALL									++Script::Calls;int __failed=lua_pcall(__pState,lua_gettop(__pState)-__top,LUA_MULTRET,0);if(--Script::Calls==0) ++Script::Generation;if(__failed!=0) { __error = lua_tostring(__pState,-1);SCRIPT_ERROR("%s",Script::LastError(__pState))} else {--__top;int __results=lua_gettop(__pState);int __args=__top;
 #define SCRIPT_FUNCTION_NULL_CALL								{ lua_pop(__pState,lua_gettop(__pState)-__top+1);--__top;int __results=lua_gettop(__pState);int __args=__top;
-#define SCRIPT_FUNCTION_END										Service::StopVolatileObjectsRecording(__pState);lua_pop(__pState,__results-__top);__args = __results-__args; if(__args>0) SCRIPT_WARN("%d arguments not required on '%s' results",__args,__name.c_str()) else if(__args<0) SCRIPT_WARN("%d missing arguments on '%s' results",-__args,__name.c_str()) } } }
+#define SCRIPT_FUNCTION_END										lua_pop(__pState,__results-__top);__args = __results-__args; if(__args>0) SCRIPT_WARN("%d arguments not required on '%s' results",__args,__name.c_str()) else if(__args<0) SCRIPT_WARN("%d missing arguments on '%s' results",-__args,__name.c_str()) } } }
 
 #define SCRIPT_CAN_READ											(__results-__args)>0
 #define SCRIPT_NEXT_TYPE										(SCRIPT_CAN_READ ? lua_type(__pState,__args+1) : LUA_TNIL)
 #define SCRIPT_READ_BOOL(DEFAULT)								((__results-(__args++))<=0 ? DEFAULT : (lua_toboolean(__pState,__args)==0 ? false : true))
 #define SCRIPT_READ_STRING(DEFAULT)								((__results-(__args++))<=0 ? DEFAULT : (lua_isstring(__pState,__args) ? lua_tostring(__pState,__args) : DEFAULT))
-#define SCRIPT_READ_BINARY(VALUE,SIZE)							Poco::UInt32 SIZE = 0;const Poco::UInt8* VALUE = NULL;if((__results-(__args++))>0 && lua_isstring(__pState,__args)) { VALUE = (const Poco::UInt8*)lua_tostring(__pState,__args);SIZE = lua_objlen(__pState,__args);}
+#define SCRIPT_READ_BINARY(VALUE,SIZE)							Poco::UInt32 SIZE = 0;const Poco::UInt8* VALUE = NULL;if((__results-(__args++))>0) VALUE = Script::ReadBinary(__pState,__args,SIZE);
 #define SCRIPT_READ_UINT(DEFAULT)								(UInt32)((__results-(__args++))<=0 ? DEFAULT : (lua_isnumber(__pState,__args) ? (Poco::UInt32)lua_tonumber(__pState,__args) : DEFAULT))
 #define SCRIPT_READ_INT(DEFAULT)								(Int32)((__results-(__args++))<=0 ? DEFAULT : (lua_isnumber(__pState,__args) ? (Poco::Int32)lua_tointeger(__pState,__args) : DEFAULT))
 #define SCRIPT_READ_DOUBLE(DEFAULT)								(double)((__results-(__args++))<=0 ? DEFAULT : (lua_isnumber(__pState,__args) ? lua_tonumber(__pState,__args) : DEFAULT))
@@ -115,6 +122,8 @@ public:
 
 	static void			WriteAMF(lua_State *pState,Cumulus::AMFReader& reader,Poco::UInt32 count);
 	static void			ReadAMF(lua_State *pState,Cumulus::AMFWriter& writer,Poco::UInt32 count);
+	// string or packet view, NULL otherwise
+	static const Poco::UInt8*	ReadBinary(lua_State *pState,int index,Poco::UInt32& size);
 
 	static void			CloseState(lua_State* pState);
 	static lua_State*	CreateState();
@@ -186,6 +195,11 @@ public:
 		}
 		CreateObject<Type,LUAType>(pState,object);
 		lua_replace(pState,-2);
+		// volatile object, valid only until the end of the current script call
+		lua_getmetatable(pState,-1);
+		lua_pushnumber(pState,Generation);
+		lua_setfield(pState,-2,"//generation");
+		lua_pop(pState,1);
 	}
 
 	template<class Type,class LUAType>
@@ -281,6 +295,17 @@ public:
 		Type* pThis = (Type*) lua_touserdata(pState, -1);
 		lua_pop(pState,1);
 
+		// volatile object kept after its call?
+		lua_getfield(pState,-1,"//generation");
+		if(lua_isnumber(pState,-1) && (Poco::UInt32)lua_tonumber(pState,-1)!=Generation) {
+			lua_pop(pState,2);
+			SCRIPT_BEGIN(pState)
+				SCRIPT_ERROR("object used after the end of the call which has given it")
+			SCRIPT_END
+			return NULL;
+		}
+		lua_pop(pState,1);
+
 		// persistent checking to avoid to use a Cumulus object deleted!
 		lua_getfield(pState,-1,"//running");
 		if(!lua_isnil(pState,-1) && lua_getmetatable(pState,LUA_GLOBALSINDEX)!=0) {
@@ -306,7 +331,10 @@ public:
 		return pThis;
 	}
 
-	static lua_Debug	LuaDebug;
+	static Poco::ThreadLocal<lua_Debug>	LuaDebug;
+	// incremented at the end of every outermost script call, invalidates volatile objects
+	static Poco::UInt32					Generation;
+	static Poco::UInt32					Calls;
 
 private:
 	static const char* ToString(lua_State* pState,std::string& out);
@@ -27,6 +27,7 @@
 #include "LUAGroup.h"
 #include "LUAServer.h"
 #include "LUAServers.h"
+#include "LUAPacketView.h"
 
 using namespace std;
 using namespace Poco;
@@ -35,12 +36,32 @@ using namespace Cumulus;
 
 const string Server::WWWPath;
 
-Server::Server(ApplicationKiller& applicationKiller,const Util::AbstractConfiguration& configurations) : RTMFPServer(configurations.getInt("threads",0)),_pState(Script::CreateState()),_applicationKiller(applicationKiller),_pService(NULL),
-	servers(configurations.getInt("servers.port",0),*this,sockets,configurations.getString("servers.targets","")),
-	_publicAddress(configurations.getString("publicAddress","")),
+Server::Server(ApplicationKiller& applicationKiller,const Util::AbstractConfiguration& configurations) : RTMFPServer(configurations.getInt("threads",0)),_pState(Script::CreateState()),_applicationKiller(applicationKiller),_pService(NULL),_watcher(*this,*this),
+	servers(configurations.getInt("servers.port",0),*this,sockets,*this,configurations.getString("servers.targets","")),
+	relays(*this,servers,configurations.getBool("servers.relay",true)),
+	directory(*this,servers,configurations.getString("publicAddress",""),configurations.getBool("servers.directory",true)),
+	hls(configurations.getString("hls.directory",""),configurations.getInt("hls.duration",10),configurations.getInt("hls.segments",5),configurations.getInt("hls.buffer",4096)*1024,configurations.getInt("hls.threads",1)),
+	workers(*this,configurations.getString("application.dir","./")+"www/worker.lua",configurations.getInt("workers",0)),
+	_clientsManaged(0),_publicAddress(configurations.getString("publicAddress","")),
+	_gcBudget(configurations.getInt("gc.budget",0)),_gcCeiling(configurations.getInt("gc.ceiling",0)*1024),_gcCycleMemory(0),_gcPause(0),_gcPeakPause(0),
 	mails(*this,configurations.getString("smtp.host","localhost"),configurations.getInt("smtp.port",SMTPSession::SMTP_PORT),configurations.getInt("smtp.timeout",60)) {
 	
 	File((string&)WWWPath = configurations.getString("application.dir","./")+"www").createDirectory();
+	// Lua GC tuning
+	int gcPause = configurations.getInt("gc.pause",0);
+	if(gcPause>0)
+		lua_gc(_pState,LUA_GCSETPAUSE,gcPause);
+	int gcStepMul = configurations.getInt("gc.stepmul",0);
+	if(gcStepMul>0)
+		lua_gc(_pState,LUA_GCSETSTEPMUL,gcStepMul);
+	if(_gcBudget>0) {
+		// collected only by manage, in its time budget
+		lua_gc(_pState,LUA_GCSTOP,0);
+		NOTE("Lua GC runs every second in %u ms at most",_gcBudget);
+	}
+	if(_gcCeiling>0)
+		NOTE("Lua memory beyond %u MB is fully collected",_gcCeiling/1024);
+
 	Service::InitGlobalTable(_pState);
 	SCRIPT_BEGIN(_pState)
 		SCRIPT_CREATE_PERSISTENT_OBJECT(Invoker,LUAInvoker,*this)
@@ -83,7 +104,7 @@ Server::~Server() {
 }
 
 void Server::addServiceFunction(Service& service,const std::string& name) {
-	if(name=="onManage" || name=="onRendezVousUnknown" || name=="onServerConnection" || name=="onServerDisconnection")
+	if(name=="onManage" || name=="onManageClients" || name=="onRendezVousUnknown" || name=="onServerConnection" || name=="onServerDisconnection")
 		_scriptEvents[name].insert(&service);
 }
 void Server::startService(Service& service) {
@@ -124,8 +145,11 @@ void Server::clearService(Service& service) {
 }
 
 void Server::onStart() {
+	Service::Watched = _watcher.start(WWWPath);
 	_pService = new Service(_pState,"",*this);
 	servers.start();
+	hls.start();
+	workers.start();
 }
 void Server::onStop() {
 	// delete service before servers.stop() to avoid a crash bug
@@ -133,12 +157,23 @@ void Server::onStop() {
 		delete _pService;
 		_pService=NULL;
 	}
+	_watcher.stop();
+	Service::Watched = false;
 	servers.stop();
+	hls.stop();
+	workers.stop();
 	_applicationKiller.kill();
 }
 
+void Server::onChange(const string& path,bool directory,bool exists) {
+	if(_pService)
+		_pService->notify(path,directory,exists);
+}
+
 
 void Server::manage() {
+	// before sessions manage to flush what onManage writes
+	manageClients();
 	RTMFPServer::manage();
 	_pService->refresh();
 	set<Service*>& events = _scriptEvents["onManage"];
@@ -151,6 +186,53 @@ void Server::manage() {
 		SCRIPT_END
 	}
 	servers.manage();
+	relays.manage();
+	directory.manage();
+	manageGC();
+}
+
+void Server::manageGC() {
+	Timestamp start;
+	if(_gcBudget==0) {
+		// automatic collector, measures the pause of one of its incremental steps
+		if(lua_gc(_pState,LUA_GCSTEP,0)==1)
+			_gcCycleMemory = lua_gc(_pState,LUA_GCCOUNT,0);
+	} else {
+		// incremental steps until the end of the cycle or the budget
+		while(!start.isElapsed(_gcBudget*1000)) {
+			if(lua_gc(_pState,LUA_GCSTEP,0)==1) {
+				_gcCycleMemory = lua_gc(_pState,LUA_GCCOUNT,0);
+				break;
+			}
+		}
+	}
+	// the steps don't keep up with the allocations: full collection beyond the ceiling,
+	// with a budget it's by default twice the memory at the end of the last cycle
+	UInt32 memory = lua_gc(_pState,LUA_GCCOUNT,0);
+	if(_gcCycleMemory==0)
+		_gcCycleMemory = memory;
+	UInt32 ceiling = _gcCeiling>0 ? _gcCeiling : (_gcBudget>0 ? 2*_gcCycleMemory : 0);
+	if(ceiling>0 && memory>ceiling) {
+		if(_gcBudget>0)
+			WARN("Lua memory of %u KB exceeds %u KB, gc.budget of %u ms is too short",memory,ceiling,_gcBudget);
+		lua_gc(_pState,LUA_GCCOLLECT,0);
+		_gcCycleMemory = lua_gc(_pState,LUA_GCCOUNT,0);
+	}
+	// steps and full collections rearm the automatic collector
+	if(_gcBudget>0)
+		lua_gc(_pState,LUA_GCSTOP,0);
+	_gcPause = (UInt32)start.elapsed();
+	if(_gcPause>_gcPeakPause)
+		_gcPeakPause = _gcPause;
+}
+
+void Server::status_string(string& s) {
+	RTMFPServer::status_string(s);
+	s += "\tlua: memory: " + NumberFormatter::format(lua_gc(_pState,LUA_GCCOUNT,0)) + "KB"
+		+ " gc_pause: " + NumberFormatter::format(_gcPause)
+		+ " peak_gc_pause: " + NumberFormatter::format(_gcPeakPause)
+		+ " workers: " + NumberFormatter::format(workers.count())
+		+ "\n";
 }
 
 void Server::readLUAAddresses(set<string>& addresses) {
@@ -186,6 +268,7 @@ void Server::readLUAAddress(set<string>& addresses) {
 
 
 void Server::onRendezVousUnknown(const UInt8* id,set<string>& addresses) {
+	directory.find(id,addresses);
 	set<Service*>& events = _scriptEvents["onRendezVousUnknown"];
 	set<Service*>::const_iterator it;
 	for(it=events.begin();it!=events.end();++it) {
@@ -206,8 +289,8 @@ void Server::onHandshake(const SocketAddress& address,const string& path,const m
 	Service* pService = _pService->get(path);
 	if(!pService)
 		return;
-	SCRIPT_BEGIN(pService->open())
-		SCRIPT_FUNCTION_BEGIN("onHandshake")
+	SCRIPT_BEGIN(pService->open(Service::ON_HANDSHAKE))
+		SCRIPT_EVENT_BEGIN(*pService,ON_HANDSHAKE)
 			SCRIPT_WRITE_STRING(address.toString().c_str())
 			SCRIPT_WRITE_STRING(path.c_str())
 			lua_newtable(_pState);
@@ -236,8 +319,8 @@ bool Server::onConnection(Client& client,AMFReader& parameters,AMFObjectWriter&
 		return false;
 	}
 
-	SCRIPT_BEGIN(pService->open())
-		SCRIPT_FUNCTION_BEGIN("onConnection")
+	SCRIPT_BEGIN(pService->open(Service::ON_CONNECTION))
+		SCRIPT_EVENT_BEGIN(*pService,ON_CONNECTION)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 			SCRIPT_WRITE_AMF(parameters,0)
 			SCRIPT_FUNCTION_CALL
@@ -268,6 +351,7 @@ bool Server::onConnection(Client& client,AMFReader& parameters,AMFObjectWriter&
 		}
 		client.pinObject<Service>(*pService);
 		++pService->count;
+		directory.add(client.id);
 		return true;
 	}
 	return false;
@@ -275,8 +359,9 @@ bool Server::onConnection(Client& client,AMFReader& parameters,AMFObjectWriter&
 
 void Server::onFailed(const Client& client,const string& error) {
 	WARN("Client failed : %s",error.c_str());
-	SCRIPT_BEGIN(client.object<Service>()->open())
-		SCRIPT_FUNCTION_BEGIN("onFailed")
+	Service& service = *client.object<Service>();
+	SCRIPT_BEGIN(service.open(Service::ON_FAILED))
+		SCRIPT_EVENT_BEGIN(service,ON_FAILED)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 			SCRIPT_WRITE_STRING(error.c_str())
 			SCRIPT_FUNCTION_CALL
@@ -285,9 +370,10 @@ void Server::onFailed(const Client& client,const string& error) {
 }
 
 void Server::onDisconnection(const Client& client) {
+	directory.remove(client.id);
 	Service& service = *client.object<Service>();
-	SCRIPT_BEGIN(service.open())
-		SCRIPT_FUNCTION_BEGIN("onDisconnection")
+	SCRIPT_BEGIN(service.open(Service::ON_DISCONNECTION))
+		SCRIPT_EVENT_BEGIN(service,ON_DISCONNECTION)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 			SCRIPT_FUNCTION_CALL
 		SCRIPT_FUNCTION_END
@@ -302,6 +388,7 @@ bool Server::onMessage(Client& client,const string& name,AMFReader& reader) {
 	bool result = false;
 
 	SCRIPT_BEGIN(client.object<Service>()->open())
+		waitFanOuts(); // the script can write to the listeners of a publication
 		SCRIPT_MEMBER_FUNCTION_BEGIN(Client,LUAClient,client,name.c_str())
 			SCRIPT_WRITE_AMF(reader,0)
 			result = true;
@@ -324,8 +411,9 @@ bool Server::onPublish(Client& client,const Publication& publication,string& err
 		return true;
 
 	bool result=true;
-	SCRIPT_BEGIN(client.object<Service>()->open())
-		SCRIPT_FUNCTION_BEGIN("onPublish")
+	Service& service = *client.object<Service>();
+	SCRIPT_BEGIN(service.open(Service::ON_PUBLISH))
+		SCRIPT_EVENT_BEGIN(service,ON_PUBLISH)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Publication,LUAPublication,publication)
 			SCRIPT_FUNCTION_CALL
@@ -344,22 +432,26 @@ bool Server::onPublish(Client& client,const Publication& publication,string& err
 
 void Server::onUnpublish(Client& client,const Publication& publication) {
 	if(client != this->id) {
-		SCRIPT_BEGIN(client.object<Service>()->open())
-			SCRIPT_FUNCTION_BEGIN("onUnpublish")
+		Service& service = *client.object<Service>();
+		SCRIPT_BEGIN(service.open(Service::ON_UNPUBLISH))
+			SCRIPT_EVENT_BEGIN(service,ON_UNPUBLISH)
 				SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 				SCRIPT_WRITE_PERSISTENT_OBJECT(Publication,LUAPublication,publication)
 				SCRIPT_FUNCTION_CALL
 			SCRIPT_FUNCTION_END
 		SCRIPT_END
+		relays.unpublish(publication);
 	}
+	hls.unpublish(publication);
 	if(publication.listeners.count()==0)
 		LUAPublication::Clear(_pState,publication);
 }
 
 bool Server::onSubscribe(Client& client,const Listener& listener,string& error) { 
 	bool result=true;
-	SCRIPT_BEGIN(client.object<Service>()->open())
-		SCRIPT_FUNCTION_BEGIN("onSubscribe")
+	Service& service = *client.object<Service>();
+	SCRIPT_BEGIN(service.open(Service::ON_SUBSCRIBE))
+		SCRIPT_EVENT_BEGIN(service,ON_SUBSCRIBE)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Listener,LUAListener,listener)
 			SCRIPT_FUNCTION_CALL
@@ -373,12 +465,15 @@ bool Server::onSubscribe(Client& client,const Listener& listener,string& error)
 		if(!result)
 			LUAListener::Clear(_pState,listener);
 	SCRIPT_END
+	if(result && listener.publication.publisherId()==0 && listener.publication.layers()==0)
+		relays.pull(listener.publication.name());
 	return result;
 }
 
 void Server::onUnsubscribe(Client& client,const Listener& listener) {
-	SCRIPT_BEGIN(client.object<Service>()->open())
-		SCRIPT_FUNCTION_BEGIN("onUnsubscribe")
+	Service& service = *client.object<Service>();
+	SCRIPT_BEGIN(service.open(Service::ON_UNSUBSCRIBE))
+		SCRIPT_EVENT_BEGIN(service,ON_UNSUBSCRIBE)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Listener,LUAListener,listener)
 			SCRIPT_FUNCTION_CALL
@@ -390,38 +485,53 @@ void Server::onUnsubscribe(Client& client,const Listener& listener) {
 }
 
 void Server::onAudioPacket(Client& client,const Publication& publication,UInt32 time,PacketReader& packet) {
+	hls.pushAudioPacket(publication,time,packet);
 	if(client == this->id)
 		return;
-	SCRIPT_BEGIN(client.object<Service>()->open())
-		SCRIPT_FUNCTION_BEGIN("onAudioPacket")
+	relays.push(publication,Message::AUDIO,time,publication.name(),packet);
+	Service& service = *client.object<Service>();
+	SCRIPT_BEGIN(service.open(Service::ON_AUDIOPACKET))
+		waitFanOuts();
+		int view = LUA_NOREF;
+		SCRIPT_EVENT_BEGIN(service,ON_AUDIOPACKET)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Publication,LUAPublication,publication)
 			SCRIPT_WRITE_NUMBER(time)
-			SCRIPT_WRITE_BINARY(packet.current(),packet.available())
+			view = LUAPacketView::Write(_pState,packet.current(),packet.available());
 			SCRIPT_FUNCTION_CALL
 		SCRIPT_FUNCTION_END
+		LUAPacketView::Clear(_pState,view);
 	SCRIPT_END
 }
 
 void Server::onVideoPacket(Client& client,const Publication& publication,UInt32 time,PacketReader& packet) {
+	hls.pushVideoPacket(publication,time,packet);
 	if(client == this->id)
 		return;
-	SCRIPT_BEGIN(client.object<Service>()->open())
-		SCRIPT_FUNCTION_BEGIN("onVideoPacket")
+	relays.push(publication,Message::VIDEO,time,publication.name(),packet);
+	Service& service = *client.object<Service>();
+	SCRIPT_BEGIN(service.open(Service::ON_VIDEOPACKET))
+		waitFanOuts();
+		int view = LUA_NOREF;
+		SCRIPT_EVENT_BEGIN(service,ON_VIDEOPACKET)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Publication,LUAPublication,publication)
 			SCRIPT_WRITE_NUMBER(time)
-			SCRIPT_WRITE_BINARY(packet.current(),packet.available())
+			view = LUAPacketView::Write(_pState,packet.current(),packet.available());
 			SCRIPT_FUNCTION_CALL
 		SCRIPT_FUNCTION_END
+		LUAPacketView::Clear(_pState,view);
 	SCRIPT_END
 }
 
 void Server::onDataPacket(Client& client,const Publication& publication,const string& name,PacketReader& packet) {
 	if(client == this->id)
 		return;
-	SCRIPT_BEGIN(client.object<Service>()->open())
-		SCRIPT_FUNCTION_BEGIN("onDataPacket")
+	relays.push(publication,Message::AMF,0,name,packet);
+	Service& service = *client.object<Service>();
+	SCRIPT_BEGIN(service.open(Service::ON_DATAPACKET))
+		waitFanOuts();
+		SCRIPT_EVENT_BEGIN(service,ON_DATAPACKET)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Publication,LUAPublication,publication)
 			SCRIPT_WRITE_STRING(name.c_str())
@@ -432,8 +542,9 @@ void Server::onDataPacket(Client& client,const Publication& publication,const st
 }
 
 void Server::onJoinGroup(Client& client,Group& group) {
-	SCRIPT_BEGIN(client.object<Service>()->open())
-		SCRIPT_FUNCTION_BEGIN("onJoinGroup")
+	Service& service = *client.object<Service>();
+	SCRIPT_BEGIN(service.open(Service::ON_JOINGROUP))
+		SCRIPT_EVENT_BEGIN(service,ON_JOINGROUP)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Group,LUAGroup,group)
 			SCRIPT_FUNCTION_CALL
@@ -442,8 +553,9 @@ void Server::onJoinGroup(Client& client,Group& group) {
 }
 
 void Server::onUnjoinGroup(Client& client,Group& group) {
-	SCRIPT_BEGIN(client.object<Service>()->open())
-		SCRIPT_FUNCTION_BEGIN("onUnjoinGroup")
+	Service& service = *client.object<Service>();
+	SCRIPT_BEGIN(service.open(Service::ON_UNJOINGROUP))
+		SCRIPT_EVENT_BEGIN(service,ON_UNJOINGROUP)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,client)
 			SCRIPT_WRITE_PERSISTENT_OBJECT(Group,LUAGroup,group)
 			SCRIPT_FUNCTION_CALL
@@ -453,16 +565,82 @@ void Server::onUnjoinGroup(Client& client,Group& group) {
 		Script::ClearPersistentObject<Group,LUAGroup>(_pState,group);
 }
 
-void Server::onManage(Client& client) {
-	SCRIPT_BEGIN(client.object<Service>()->open())
-		SCRIPT_MEMBER_FUNCTION_BEGIN(Client,LUAClient,client,"onManage")
-			SCRIPT_FUNCTION_CALL
-		SCRIPT_FUNCTION_END
-	SCRIPT_END
+void Server::manageClients() {
+	// client.onManage, only for clients which define it
+	// on a copy: an onManage can add or remove any client, so a client is still checked before to be called
+	vector<Client*> managed(LUAClient::Managed.begin(),LUAClient::Managed.end());
+	vector<Client*>::const_iterator it;
+	for(it=managed.begin();it!=managed.end();++it) {
+		if(LUAClient::Managed.find(*it)==LUAClient::Managed.end())
+			continue;
+		Client& client = **it;
+		Service* pService = client.object<Service>();
+		if(!pService)
+			continue;
+		SCRIPT_BEGIN(pService->open())
+			SCRIPT_MEMBER_FUNCTION_BEGIN(Client,LUAClient,client,"onManage")
+				SCRIPT_FUNCTION_CALL
+			SCRIPT_FUNCTION_END
+		SCRIPT_END
+	}
+
+	// onManageClients(clients), the clients of every service which defines it are spread across the ticks of the second,
+	// what the last ticks have not reached is given now
+	manageClients(_clientsToManage.size()-_clientsManaged);
+	_clientsToManage.clear();
+	_clientsManaged = 0;
+	set<Service*>& events = _scriptEvents["onManageClients"];
+	if(events.empty())
+		return;
+	Entities<Client>::Iterator itClient;
+	for(itClient=clients.begin();itClient!=clients.end();++itClient) {
+		Service* pService = itClient->second->object<Service>();
+		if(pService && events.find(pService)!=events.end())
+			_clientsToManage.push_back(string((const char*)itClient->first,ID_SIZE));
+	}
+}
+
+void Server::tick() {
+	UInt32 ticks = (ackPackets>1 && ackDelay>0) ? (1000/ackDelay) : 1;
+	manageClients((_clientsToManage.size()+ticks-1)/ticks);
+}
+
+void Server::manageClients(UInt32 count) {
+	// onManageClients(clients), one call by service with its clients among the "count" next ones
+	if(count==0)
+		return;
+	set<Service*>& events = _scriptEvents["onManageClients"];
+	map<Service*,vector<Client*> > batches;
+	for(;count>0 && _clientsManaged<_clientsToManage.size();--count) {
+		// the client can have been disconnected since
+		Client* pClient = clients((const UInt8*)_clientsToManage[_clientsManaged++].c_str());
+		if(!pClient)
+			continue;
+		Service* pService = pClient->object<Service>();
+		if(pService && events.find(pService)!=events.end())
+			batches[pService].push_back(pClient);
+	}
+	map<Service*,vector<Client*> >::iterator itBatch;
+	for(itBatch=batches.begin();itBatch!=batches.end();++itBatch) {
+		vector<Client*>& batch = itBatch->second;
+		SCRIPT_BEGIN(itBatch->first->open())
+			SCRIPT_FUNCTION_BEGIN("onManageClients")
+				lua_createtable(_pState,batch.size(),0);
+				for(UInt32 i=0;i<batch.size();++i) {
+					SCRIPT_WRITE_PERSISTENT_OBJECT(Client,LUAClient,*batch[i])
+					lua_rawseti(_pState,-2,i+1);
+				}
+				SCRIPT_FUNCTION_CALL
+			SCRIPT_FUNCTION_END
+		SCRIPT_END
+	}
 }
 
 
 void Server::connection(ServerConnection& server) {
+	relays.connection(server);
+	directory.connection(server);
+
 	// sends actual services online to every connected servers
 	set<Service*>::const_iterator it;
 	ServerMessage message;
@@ -483,6 +661,8 @@ void Server::connection(ServerConnection& server) {
 }
 
 void Server::message(ServerConnection& server,const std::string& handler,Cumulus::PacketReader& reader) {
+	if(relays.message(server,handler,reader) || directory.message(server,handler,reader))
+		return;
 	if(handler==".") {
 		while(reader.available()) {
 			string path;
@@ -504,6 +684,9 @@ void Server::disconnection(const ServerConnection& server,const char* error) {
 	if(error)
 		ERROR("Servers error, %s",error)
 
+	relays.disconnection(server);
+	directory.disconnection(server);
+
 	set<Service*>& events = _scriptEvents["onServerDisconnection"];
 	set<Service*>::const_iterator it;
 	for(it=events.begin();it!=events.end();++it) {
@@ -23,9 +23,14 @@
 #include "SMTPSession.h"
 #include "TCPServer.h"
 #include "Servers.h"
+#include "Relays.h"
+#include "Directory.h"
+#include "HLSPackager.h"
+#include "Workers.h"
+#include "DirectoryWatcher.h"
 
 
-class Server : public Cumulus::RTMFPServer, private ServiceRegistry, private ServerHandler {
+class Server : public Cumulus::RTMFPServer, private ServiceRegistry, private ServerHandler, private WatcherHandler {
 public:
 	Server(ApplicationKiller& applicationKiller,const Poco::Util::AbstractConfiguration& configurations);
 	virtual ~Server();
@@ -33,15 +38,25 @@ public:
 	static const std::string				WWWPath;
 	SMTPSession								mails;
 	Servers									servers;
+	Relays									relays;
+	Directory								directory;
+	HLSPackager								hls;
+	Workers									workers;
 
 private:
 	Poco::UInt16			port();
 	void					manage();
+	void					manageClients();
+	void					manageClients(Poco::UInt32 count);
+	void					tick();
+	void					manageGC();
+	void					status_string(std::string& s);
 	bool					readNextConfig(lua_State* pState,const Poco::Util::AbstractConfiguration& configurations,const std::string& root);
 
 	//events
 	void					onStart();
 	void					onStop();
+	void					onChange(const std::string& path,bool directory,bool exists);
 
 	void					onRendezVousUnknown(const Poco::UInt8* id,std::set<std::string>& addresses);
 	void					onHandshake(const Poco::Net::SocketAddress& address,const std::string& path,const std::map<std::string,std::string>& properties,Poco::UInt32 attempts,std::set<std::string>& addresses);
@@ -64,8 +79,6 @@ private:
 	bool					onSubscribe(Cumulus::Client& client,const Cumulus::Listener& listener,std::string& error);
 	void					onUnsubscribe(Cumulus::Client& client,const Cumulus::Listener& listener);
 
-	void					onManage(Cumulus::Client& client);
-
 	// ServiceRegistry implementation
 	void					addServiceFunction(Service& service,const std::string& name);
 	void					clearService(Service& service);
@@ -85,11 +98,22 @@ private:
 	lua_State*				_pState;
 	ApplicationKiller&		_applicationKiller;
 	Service*				_pService;
+	DirectoryWatcher		_watcher;
 
 	std::set<Service*>							_servicesRunning;
 	std::map<std::string,std::set<Service*> >	_scriptEvents;
 
+	// raw ids of the clients given to onManageClients during the current second, a batch by tick
+	std::vector<std::string>	_clientsToManage;
+	Poco::UInt32				_clientsManaged;
+
 	std::string					_publicAddress;
+
+	Poco::UInt32				_gcBudget;
+	Poco::UInt32				_gcCeiling;
+	Poco::UInt32				_gcCycleMemory;
+	Poco::UInt32				_gcPause;
+	Poco::UInt32				_gcPeakPause;
 };
 
 inline const std::string& Server::publicAddress() {
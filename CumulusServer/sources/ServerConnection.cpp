@@ -16,6 +16,7 @@
 */
 
 #include "ServerConnection.h"
+#include "PacketWriter.h"
 #include "Util.h"
 #include "Logs.h"
 #include "Poco/Format.h"
@@ -26,7 +27,7 @@ using namespace Poco;
 using namespace Poco::Net;
 
 
-ServerConnection::ServerConnection(const string& target,SocketManager& socketManager,ServerHandler& handler,ServersHandler& serversHandler) : address(target),_size(0),_handler(handler),TCPClient(socketManager),_connected(false),_serversHandler(serversHandler),isTarget(true) {
+ServerConnection::ServerConnection(const string& target,SocketManager& socketManager,ServerHandler& handler,ServersHandler& serversHandler) : address(target),_size(0),_handler(handler),TCPClient(socketManager),_connected(false),_queued(false),_serversHandler(serversHandler),isTarget(true) {
 	size_t found = target.find("?");
 	if(found!=string::npos) {
 		Util::UnpackQuery(target.substr(found+1),(map<string,string>&)properties);
@@ -34,7 +35,7 @@ ServerConnection::ServerConnection(const string& target,SocketManager& socketMan
 	}
 }
 
-ServerConnection::ServerConnection(const StreamSocket& socket,SocketManager& socketManager,ServerHandler& handler,ServersHandler& serversHandler) : address(socket.peerAddress().toString()),_size(0),_handler(handler),TCPClient(socket,socketManager),_connected(false),_serversHandler(serversHandler),isTarget(false) {
+ServerConnection::ServerConnection(const StreamSocket& socket,SocketManager& socketManager,ServerHandler& handler,ServersHandler& serversHandler) : address(socket.peerAddress().toString()),_size(0),_handler(handler),TCPClient(socket,socketManager),_connected(false),_queued(false),_serversHandler(serversHandler),isTarget(false) {
 	sendPublicAddress();
 }
 
@@ -69,6 +70,10 @@ void ServerConnection::connect() {
 }
 
 void ServerConnection::send(const string& handler,ServerMessage& message) {
+	send(handler,message.body());
+}
+
+void ServerConnection::send(const string& handler,const SharedPtr<Buffer<UInt8> >& pBody) {
 	string handlerName(handler);
 	if(handlerName.size()>255) {
 		handlerName.resize(255);
@@ -79,6 +84,7 @@ void ServerConnection::send(const string& handler,ServerMessage& message) {
 	UInt32 handlerRef=0;
 	bool   writeRef = false;
 	if(!handlerName.empty()) {
+		ScopedLock<FastMutex> lock(_mutex);
 		map<string,UInt32>::iterator it = _sendingRefs.lower_bound(handlerName);
 		if(it!=_sendingRefs.end() && it->first==handlerName) {
 			handlerRef = it->second;
@@ -92,23 +98,37 @@ void ServerConnection::send(const string& handler,ServerMessage& message) {
 		}
 	}
 
-	UInt16 shift = handlerName.empty() ? Util::Get7BitValueSize(handlerRef) : handlerName.size();
-	shift = 300-(shift+5);
-
-	BinaryStream& stream = message._stream;
-	stream.resetReading(shift);
-	UInt32 size = stream.size();
-	stream.resetWriting(shift);
-	message.write32(size-4);
-	message.writeString8(handlerName);
+	// only the header depends on the connection (handler references), the body is shared
+	UInt8 header[260];
+	PacketWriter writer(header,sizeof(header));
+	writer.write32(0);
+	writer.writeString8(handlerName);
 	if(writeRef)
-		message.write7BitEncoded(handlerRef);
+		writer.write7BitEncoded(handlerRef);
 	else if(handlerName.empty())
-		message.write8(0);
-	stream.resetWriting(size+shift);
+		writer.write8(0);
+	UInt32 size = writer.position();
+	writer.clear();
+	writer.write32(size-4+pBody->size());
+
+	DUMP_MIDDLE(pBody->begin(),pBody->size(),format("To %s server",address).c_str());
+	if(!TCPClient::queue(header,size,pBody))
+		return;
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		if(_queued)
+			return;
+		_queued = true;
+	}
+	_serversHandler.queued(*this);
+}
 
-	DUMP_MIDDLE(stream.data()+4,stream.size()-4,format("To %s server",address).c_str());
-	TCPClient::send(stream.data(),stream.size());
+void ServerConnection::flush() {
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		_queued = false;
+	}
+	TCPClient::flush();
 }
 
 
@@ -168,13 +188,15 @@ UInt32 ServerConnection::onReception(const UInt8* data,UInt32 size) {
 }
 
 void ServerConnection::onDisconnection(){
-	_sendingRefs.clear();
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		_queued=false;
+		_sendingRefs.clear();
+	}
 	_receivingRefs.clear();
 	if(_connected) {
 		_connected=false;
-		bool autoDelete = _serversHandler.disconnection(*this);
+		_serversHandler.disconnection(*this);
 		_handler.disconnection(*this,error());
-		if(autoDelete)
-			delete this;
 	}
 }
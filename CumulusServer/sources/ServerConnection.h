@@ -35,7 +35,9 @@ public:
 class ServersHandler {
 public:
 	virtual void connection(ServerConnection& server)=0;
-	virtual bool disconnection(ServerConnection& server)=0;
+	// the connection is deleted by the handler if it doesn't reconnect
+	virtual void disconnection(ServerConnection& server)=0;
+	virtual void queued(ServerConnection& server)=0;
 };
 
 
@@ -52,7 +54,11 @@ public:
 
 	void			connect();
 
+	// queued, see flush
 	void			send(const std::string& handler,ServerMessage& message);
+	// body can be shared with other connections, so must stay unchanged
+	void			send(const std::string& handler,const Poco::SharedPtr<Poco::Buffer<Poco::UInt8> >& pBody);
+	void			flush();
 
 private:
 	void			sendPublicAddress();
@@ -67,4 +73,7 @@ private:
 
 	Poco::UInt32						_size;
 	bool								_connected;
+	// protects _sendingRefs and _queued, never held while taking the TCPClient lock
+	Poco::FastMutex						_mutex;
+	bool								_queued;
 };
@@ -16,12 +16,19 @@
 */
 
 #include "ServerMessage.h"
+#include <cstring>
 
-char ServerMessage::_ShiftData[300];
+using namespace Poco;
 
 ServerMessage::ServerMessage() : Cumulus::BinaryWriter(_stream) {
-	_stream.write(_ShiftData,sizeof(_ShiftData));
 }
 ServerMessage::~ServerMessage() {
 }
 
+SharedPtr<Buffer<UInt8> > ServerMessage::body() {
+	SharedPtr<Buffer<UInt8> > pBody(new Buffer<UInt8>(_stream.size()));
+	if(_stream.size()>0)
+		memcpy(pBody->begin(),_stream.data(),_stream.size());
+	return pBody;
+}
+
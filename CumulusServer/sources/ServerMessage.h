@@ -19,13 +19,18 @@
 
 #include "BinaryWriter.h"
 #include "BinaryStream.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Buffer.h"
 
 class ServerMessage : public Cumulus::BinaryWriter {
 	friend class ServerConnection;
+	friend class Broadcaster;
 public:
 	ServerMessage();
 	virtual ~ServerMessage();
 private:
+	// copy of what is written, shareable by every connection which sends it
+	Poco::SharedPtr<Poco::Buffer<Poco::UInt8> >	body();
+
 	Cumulus::BinaryStream	_stream;
-	static char				_ShiftData[300];
 };
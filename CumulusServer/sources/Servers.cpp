@@ -25,7 +25,7 @@ using namespace Poco;
 using namespace Poco::Net;
 
 
-Servers::Servers(UInt16 port,ServerHandler& handler,SocketManager& manager,const string& targets) : TCPServer(manager),_port(port),_handler(handler),_manageTimes(1) {
+Servers::Servers(UInt16 port,ServerHandler& handler,SocketManager& manager,TaskHandler& taskHandler,const string& targets) : TCPServer(manager),Task(&taskHandler),_port(port),_handler(handler),_manageTimes(1) {
 	if(port>0)
 		NOTE("Servers incoming connection enabled on port %hu",port)
 	else if(!_targets.empty())
@@ -66,6 +66,7 @@ void Servers::stop() {
 	TCPServer::stop();
 
 	ScopedLock<Mutex> lock(mutex());
+	_queued.clear();
 	_connections.clear();
 	targets._connections.clear();
 	initiators._connections.clear();
@@ -73,6 +74,9 @@ void Servers::stop() {
 	for(it=_clients.begin();it!=_clients.end();++it)
 		delete (*it);
 	_clients.clear();
+	for(it=_disconnected.begin();it!=_disconnected.end();++it)
+		delete (*it);
+	_disconnected.clear();
 }
 
 void Servers::connection(ServerConnection& server) {
@@ -85,16 +89,42 @@ void Servers::connection(ServerConnection& server) {
 	NOTE("Connection established with %s server ",server.publicAddress.c_str())
 }
 
-bool Servers::disconnection(ServerConnection& server) {
+void Servers::disconnection(ServerConnection& server) {
 	ScopedLock<Mutex> lock(mutex());
 	_connections.erase(&server);
 	_clients.erase(&server);
+	_queued.erase(&server);
 	if(server.isTarget)
 		targets._connections.erase(&server);
 	else
 		initiators._connections.erase(&server);
 	NOTE("Disconnection from %s server ",server.publicAddress.c_str())
-	if(_targets.find(&server)==_targets.end())
-		return true;
-	return false;
+	if(_targets.find(&server)!=_targets.end())
+		return;
+	// deleted on the main thread, after a possible flush in progress
+	_disconnected.insert(&server);
+	if(_queued.size()+_disconnected.size()==1)
+		waitHandleEx(false);
+}
+
+void Servers::queued(ServerConnection& server) {
+	ScopedLock<Mutex> lock(mutex());
+	_queued.insert(&server);
+	if(_queued.size()+_disconnected.size()==1)
+		waitHandleEx(false);
+}
+
+void Servers::handle() {
+	set<ServerConnection*> queued,disconnected;
+	{
+		ScopedLock<Mutex> lock(mutex());
+		queued.swap(_queued);
+		disconnected.swap(_disconnected);
+	}
+	// without the servers lock, the sockets thread holds the connection lock to call connection/disconnection
+	set<ServerConnection*>::const_iterator it;
+	for(it=queued.begin();it!=queued.end();++it)
+		(*it)->flush();
+	for(it=disconnected.begin();it!=disconnected.end();++it)
+		delete (*it);
 }
@@ -19,11 +19,12 @@
 
 #include "TCPServer.h"
 #include "Broadcaster.h"
+#include "Task.h"
 #include "Poco/Mutex.h"
 
-class Servers : private TCPServer, private ServersHandler, public Broadcaster {
+class Servers : private TCPServer, private ServersHandler, private Cumulus::Task, public Broadcaster {
 public:
-	Servers(Poco::UInt16 port,ServerHandler& handler,Cumulus::SocketManager& manager,const std::string& targets);
+	Servers(Poco::UInt16 port,ServerHandler& handler,Cumulus::SocketManager& manager,Cumulus::TaskHandler& taskHandler,const std::string& targets);
 	virtual ~Servers();
 	
 	void manage();
@@ -39,13 +40,18 @@ private:
 
 	void				clientHandler(Poco::Net::StreamSocket& socket);
 	void				connection(ServerConnection& server);
-	bool				disconnection(ServerConnection& server);
+	void				disconnection(ServerConnection& server);
+	void				queued(ServerConnection& server);
+	// flushes the queued messages once by connection, and deletes the disconnected connections
+	void				handle();
 
 
 	Poco::UInt8								_manageTimes;
 
 	std::set<ServerConnection*>				_targets;
 	std::set<ServerConnection*>				_clients;
+	std::set<ServerConnection*>				_queued;
+	std::set<ServerConnection*>				_disconnected;
 
 	ServerHandler&							_handler;
 	Poco::UInt16							_port;
@@ -23,10 +23,16 @@ using namespace std;
 using namespace Poco;
 using namespace Cumulus;
 
-Thread* Service::_PVolatileObjectsThreadRecording(NULL);
-bool	Service::_VolatileObjectsRecording(false);
+UInt32	Service::_Generation(1);
+bool	Service::Watched(false);
 
-Service::Service(lua_State* pState,const string& path,ServiceRegistry& registry) : path(path),_registry(registry),_pState(pState), FileWatcher(Server::WWWPath+path+"/main.lua"),_packages("www"+path,"/",StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM),_running(false),_deleting(false),count(0) {
+const char* Service::EventNames[] = {"onHandshake","onConnection","onFailed","onDisconnection","onPublish","onUnpublish","onSubscribe","onUnsubscribe","onAudioPacket","onVideoPacket","onDataPacket","onJoinGroup","onUnjoinGroup"};
+
+Service::Service(lua_State* pState,const string& path,ServiceRegistry& registry) : path(path),_registry(registry),_pState(pState), FileWatcher(Server::WWWPath+path+"/main.lua"),_packages("www"+path,"/",StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM),_running(false),_deleting(false),count(0),_events(0),_environment(LUA_NOREF),_generation(0),_changed(true) {
+	for(int i=0;i<EVENTS_COUNT;++i)
+		_references[i] = LUA_NOREF;
+	if(Watched)
+		invalidate();
 	if(!refresh()) {
 		open(true); // open even if no file
 		lua_pop(_pState,1);
@@ -62,8 +68,13 @@ Service* Service::get(const string& path) {
 	name = name.substr(0,pos);
 	
 	// Folder exists?
-	File file(Path(FileWatcher::path).parent().toString()+name);
-	bool exists = (file.exists() && file.isDirectory());
+	bool exists;
+	if(Watched)
+		exists = _folders.find(name)!=_folders.end();
+	else {
+		File file(Path(FileWatcher::path).parent().toString()+name);
+		exists = (file.exists() && file.isDirectory());
+	}
 
 	map<string,Service*>::iterator it = _services.lower_bound(name);
 	
@@ -91,6 +102,68 @@ Service* Service::get(const string& path) {
 	return pService->get(nextPath);
 }
 
+// return NULL if the service is not created
+Service* Service::find(const string& path) {
+	Service* pService = this;
+	StringTokenizer names(path,"/",StringTokenizer::TOK_IGNORE_EMPTY);
+	StringTokenizer::Iterator it;
+	for(it=names.begin();it!=names.end();++it) {
+		map<string,Service*>::const_iterator itService = pService->_services.find(*it);
+		if(itService==pService->_services.end())
+			return NULL;
+		pService = itService->second;
+	}
+	return pService;
+}
+
+// reload the folders cache, and force the next refresh to check the script
+void Service::invalidate() {
+	_changed = true;
+	_folders.clear();
+	if(Watched) {
+		string folder = Path(FileWatcher::path).parent().toString();
+		vector<string> files;
+		try {
+			File(folder).list(files);
+		} catch(Exception&) {}
+		vector<string>::const_iterator it;
+		for(it=files.begin();it!=files.end();++it) {
+			try {
+				if(File(folder+*it).isDirectory())
+					_folders.insert(*it);
+			} catch(Exception&) {}
+		}
+	}
+	map<string,Service*>::const_iterator it;
+	for(it=_services.begin();it!=_services.end();++it)
+		it->second->invalidate();
+}
+
+void Service::notify(const string& path,bool directory,bool exists) {
+	if(path.empty()) {
+		invalidate();
+		return;
+	}
+	size_t pos = path.rfind('/');
+	string name = path.substr(pos+1);
+	Service* pService = find(path.substr(0,pos));
+	if(!pService)
+		return; // will be loaded on creation
+	if(!directory) {
+		if(name=="main.lua")
+			pService->_changed = true;
+		return;
+	}
+	if(exists) {
+		pService->_folders.insert(name);
+		return;
+	}
+	pService->_folders.erase(name);
+	// a removed folder deletes its service on next get
+	pService = pService->find("/"+name);
+	if(pService)
+		pService->invalidate();
+}
 
 int Service::Index(lua_State *pState) {
 	string key = lua_tostring(pState,2);
@@ -146,88 +219,15 @@ int Service::NewIndex(lua_State *pState) {
 			if(lua_islightuserdata(pState,-1)) {
 				Service* pService = (Service*)lua_touserdata(pState,-1);
 				pService->_registry.addServiceFunction(*pService,key);
+				++_Generation; // handlers can be inherited by children services
 			}
 			lua_pop(pState,1);
 		}
-		if(_VolatileObjectsRecording && _PVolatileObjectsThreadRecording==Thread::current()) {
-			if(lua_getmetatable(pState,3)!=0) { // stay
-				// Is Cumulus object?
-				lua_getfield(pState,-1,"__this"); // stay
-				if(!lua_isnil(pState,-1)) {
-
-					// persistent?
-					lua_getfield(pState,-2,"//running"); // stay
-					if(lua_isnil(pState,-1)) {
-
-						lua_getfield(pState,-3,"__gcThis"); // has destructor?
-						if(lua_isnil(pState,-1)) {
-
-							// volatile object 
-							lua_getmetatable(pState,LUA_GLOBALSINDEX); // stay
-							lua_getfield(pState,-1,"//volatileObjects"); // stay
-
-							lua_pushvalue(pState,1); // environment
-							lua_rawget(pState,-2); // search environment key in "volatileObjects"
-							if(lua_isnil(pState,-1)) {
-								lua_pop(pState,1);
-								lua_newtable(pState); // stay
-								lua_pushvalue(pState,1);
-								lua_pushvalue(pState,-2);
-								lua_rawset(pState,-4); // add environment key in "volatileObjects"
-							}
-							lua_pushvalue(pState,2); // key
-							lua_pushnumber(pState,1); // value, useless
-							lua_rawset(pState,-3);
-							lua_pop(pState,3);
-						}
-						lua_pop(pState,1);
-					}
-					lua_pop(pState,1);
-
-				}
-				lua_pop(pState,2);
-			}
-		}
 	}
 	lua_rawset(pState,1); // consumes key and value
 	return 0;
 }
 
-void Service::StartVolatileObjectsRecording(lua_State* pState) {
-	_VolatileObjectsRecording = true;
-	_PVolatileObjectsThreadRecording = Poco::Thread::current();
-	InitGlobalTable(pState,true);
-	lua_newtable(pState);
-	lua_setfield(pState,-2,"//volatileObjects");
-	lua_pop(pState,1);
-}
-
-void Service::StopVolatileObjectsRecording(lua_State* pState) {
-	if(_VolatileObjectsRecording) {
-		_VolatileObjectsRecording = false;
-		// get volatile objects
-		lua_getmetatable(pState,LUA_GLOBALSINDEX); // stay
-		lua_getfield(pState,-1,"//volatileObjects"); // stay
-		// erase volatile objects
-		lua_pushnil(pState);  // first key 
-		while (lua_next(pState, -2) != 0) {
-			// key = environment (-2), value = keys (-1)
-			lua_pushnil(pState);  // first key 
-			while (lua_next(pState, -2) != 0) {
-				// key = key (-2), value = useless (-1)
-				lua_pushnil(pState);
-				lua_setfield(pState,-5,lua_tostring(pState,-3));
-				lua_pop(pState,1);
-			}
-			lua_pop(pState,1);
-		}
-		lua_pop(pState,1);
-		lua_pushnil(pState);
-		lua_setfield(pState,-2,"//volatileObjects");
-		lua_pop(pState,1);
-	}
-}
-
 void Service::InitGlobalTable(lua_State* pState,bool pushMetatable) {
 	// metatable of _G
 	if(lua_getmetatable(pState,LUA_GLOBALSINDEX)!=0) {
@@ -265,6 +265,83 @@ lua_State* Service::open() {
 	return result ? _pState : NULL;
 }
 
+lua_State* Service::open(Event event) {
+	if(!_running)
+		return NULL;
+	if(_generation!=_Generation)
+		resolve();
+	if(!(_events&(1<<event)))
+		return NULL;
+
+	InitGlobalTable(_pState,true);
+	lua_rawgeti(_pState,LUA_REGISTRYINDEX,_environment);
+	lua_setfield(_pState,-2,"//env");
+	lua_pop(_pState,1);
+	return _pState;
+}
+
+bool Service::push(Event event) {
+	if(!(_events&(1<<event)))
+		return false;
+	lua_rawgeti(_pState,LUA_REGISTRYINDEX,_references[event]);
+	lua_rawgeti(_pState,LUA_REGISTRYINDEX,_environment);
+
+	// __newindex doesn't see a handler reassigned or set to nil, so the resolved one is checked before the call:
+	// directly in the environment first, then through the parents for an inherited one
+	lua_pushstring(_pState,EventNames[event]);
+	lua_rawget(_pState,-2);
+	bool stale = lua_rawequal(_pState,-1,-3)==0;
+	lua_pop(_pState,1);
+	if(stale) {
+		lua_getfield(_pState,-1,EventNames[event]);
+		stale = lua_rawequal(_pState,-1,-3)==0;
+		lua_pop(_pState,1);
+	}
+	if(stale) {
+		lua_pop(_pState,2);
+		++_Generation; // children services can inherit it
+		resolve();
+		if(!(_events&(1<<event)))
+			return false;
+		lua_rawgeti(_pState,LUA_REGISTRYINDEX,_references[event]);
+		lua_rawgeti(_pState,LUA_REGISTRYINDEX,_environment);
+	}
+
+	lua_setfenv(_pState,-2);
+	return true;
+}
+
+void Service::resolve() {
+	release();
+	_generation = _Generation;
+
+	open(true);
+	lua_pushvalue(_pState,-1);
+	_environment = luaL_ref(_pState,LUA_REGISTRYINDEX);
+
+	// search handlers now rather than on every event (lookup goes through parents and services folders)
+	for(int i=0;i<EVENTS_COUNT;++i) {
+		lua_getfield(_pState,-1,EventNames[i]);
+		if(!lua_isfunction(_pState,-1)) {
+			lua_pop(_pState,1);
+			continue;
+		}
+		_references[i] = luaL_ref(_pState,LUA_REGISTRYINDEX);
+		_events |= (1<<i);
+	}
+	lua_pop(_pState,1);
+}
+
+void Service::release() {
+	for(int i=0;i<EVENTS_COUNT;++i) {
+		luaL_unref(_pState,LUA_REGISTRYINDEX,_references[i]);
+		_references[i] = LUA_NOREF;
+	}
+	luaL_unref(_pState,LUA_REGISTRYINDEX,_environment);
+	_environment = LUA_NOREF;
+	_events = 0;
+}
+
 bool Service::open(bool create) {
 
 	lua_pushvalue(_pState,LUA_GLOBALSINDEX); // _G
@@ -321,7 +398,7 @@ bool Service::open(bool create) {
 			lua_pushstring(_pState,"change metatable of environment is prohibited");
 			lua_setfield(_pState,-2,"__metatable");
 
-			// to manage volatile objects
+			// to detect handlers definition
 			lua_pushcfunction(_pState,&Service::NewIndex);
 			lua_setfield(_pState,-2,"__newindex");
 
@@ -386,6 +463,7 @@ void Service::load() {
 	SCRIPT_END
 
 	lua_pop(_pState,1);
+	++_Generation;
 }
 
 
@@ -441,5 +519,7 @@ void Service::clear() {
 	}
 	lua_pop(_pState,1);
 	_registry.clearService(*this);
+	release();
+	++_Generation;
 	lua_gc(_pState, LUA_GCCOLLECT, 0);
 }
@@ -20,6 +20,7 @@
 #include "FileWatcher.h"
 #include "Script.h"
 #include "Poco/StringTokenizer.h"
+#include <set>
 
 class Service;
 class ServiceRegistry {
@@ -33,17 +34,41 @@ public:
 
 class Service : public FileWatcher {
 public:
+	enum Event {
+		ON_HANDSHAKE=0,
+		ON_CONNECTION,
+		ON_FAILED,
+		ON_DISCONNECTION,
+		ON_PUBLISH,
+		ON_UNPUBLISH,
+		ON_SUBSCRIBE,
+		ON_UNSUBSCRIBE,
+		ON_AUDIOPACKET,
+		ON_VIDEOPACKET,
+		ON_DATAPACKET,
+		ON_JOINGROUP,
+		ON_UNJOINGROUP,
+		EVENTS_COUNT
+	};
+	static const char*	EventNames[EVENTS_COUNT];
+
 	Service(lua_State* pState,const std::string& path,ServiceRegistry& registry);
 	virtual ~Service();
 
 	static void InitGlobalTable(lua_State *pState);
-	static void StartVolatileObjectsRecording(lua_State* pState);
-	static void StopVolatileObjectsRecording(lua_State* pState);
+
+	// true when file system changes are notified (see notify), else folders and scripts are polled
+	static bool	Watched;
 
 	Service*	get(const std::string& path);
+	// path is relative to the www folder, an empty path invalidates every service
+	void		notify(const std::string& path,bool directory,bool exists);
 
 	bool		refresh();
 	lua_State*	open();
+	// return NULL if the script doesn't define this event handler
+	lua_State*	open(Event event);
+	bool		push(Event event);
 
 	const std::string	path;
 	Poco::UInt32		count;
@@ -53,6 +78,10 @@ private:
 	bool		open(bool create);
 	void		load();
 	void		clear();
+	void		resolve();
+	void		release();
+	Service*	find(const std::string& path);
+	void		invalidate();
 
 	static void	InitGlobalTable(lua_State* pState,bool pushMetatable);
 	static int	Index(lua_State* pState);
@@ -64,10 +93,15 @@ private:
 	Poco::StringTokenizer	_packages;
 
 	std::map<std::string,Service*>	_services;
+	std::set<std::string>			_folders;
+	bool							_changed;
 	ServiceRegistry&				_registry;
 
-	static bool						_VolatileObjectsRecording;
-	static Poco::Thread*			_PVolatileObjectsThreadRecording;
+	Poco::UInt32					_events;
+	int								_references[EVENTS_COUNT];
+	int								_environment;
+	Poco::UInt32					_generation;
+	static Poco::UInt32				_Generation;
 };
 
 inline void Service::InitGlobalTable(lua_State* pState) {
@@ -75,5 +109,8 @@ inline void Service::InitGlobalTable(lua_State* pState) {
 }
 
 inline bool Service::refresh() {
+	if(Watched && !_changed)
+		return false;
+	_changed = false;
 	return FileWatcher::watch();
 }
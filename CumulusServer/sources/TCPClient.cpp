@@ -20,6 +20,14 @@
 #include "Logs.h"
 #include "Poco/Format.h"
 #include <cstring>
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <limits.h>
+#endif
+#if !defined(IOV_MAX)
+#define IOV_MAX 16
+#endif
 
 
 using namespace std;
@@ -129,6 +137,8 @@ void TCPClient::disconnect() {
 	_connected = false;
 	_recvBuffer.clear();
 	_sendBuffer.clear();
+	_queuedData.clear();
+	_queue.clear();
 	onDisconnection();
 }
 
@@ -142,6 +152,12 @@ bool TCPClient::send(const UInt8* data,UInt32 size) {
 	}
 	if(size==0)
 		return true;
+	// keep the order with the queued data
+	flushIntern();
+	if(!_sendBuffer.empty()) {
+		_sendBuffer.insert(_sendBuffer.end(),data,data+size);
+		return true;
+	}
 	int sent = sendIntern(data,size);
 	if(sent<size) {	
 		size -= sent;
@@ -151,3 +167,105 @@ bool TCPClient::send(const UInt8* data,UInt32 size) {
 	}
 	return true;
 }
+
+bool TCPClient::queue(const UInt8* data,UInt32 size,const SharedPtr<Buffer<UInt8> >& pBody) {
+	ScopedLock<Mutex> lock(_mutex);
+
+	if(!_connected) {
+		if(!error())
+			error("TCPClient not connected");
+		return false;
+	}
+	_queuedData.insert(_queuedData.end(),data,data+size);
+	_queue.push_back(Queued(size,pBody));
+	return true;
+}
+
+void TCPClient::flush() {
+	ScopedLock<Mutex> lock(_mutex);
+	flushIntern();
+}
+
+void TCPClient::flushIntern() {
+	if(_queue.empty())
+		return;
+	if(!_connected) {
+		_queuedData.clear();
+		_queue.clear();
+		return;
+	}
+	UInt32 sent=0;
+	vector<Queued>::const_iterator it;
+#if defined(POCO_OS_FAMILY_UNIX)
+	if(_sendBuffer.empty()) {
+		vector<iovec> buffers;
+		buffers.reserve(_queue.size()*2);
+		UInt8* data = _queuedData.empty() ? NULL : &_queuedData[0];
+		for(it=_queue.begin();it!=_queue.end();++it) {
+			iovec buffer;
+			if(it->size>0) {
+				buffer.iov_base = data;
+				buffer.iov_len = it->size;
+				buffers.push_back(buffer);
+				data += it->size;
+			}
+			if(!it->pBody.isNull() && it->pBody->size()>0) {
+				buffer.iov_base = it->pBody->begin();
+				buffer.iov_len = it->pBody->size();
+				buffers.push_back(buffer);
+			}
+		}
+		for(UInt32 i=0;i<buffers.size();i+=IOV_MAX) {
+			msghdr message;
+			memset(&message,0,sizeof(message));
+			message.msg_iov = &buffers[i];
+			message.msg_iovlen = min<size_t>(buffers.size()-i,IOV_MAX);
+			size_t size=0;
+			for(size_t j=0;j<message.msg_iovlen;++j)
+				size += message.msg_iov[j].iov_len;
+#if defined(MSG_NOSIGNAL)
+			ssize_t result = ::sendmsg(_pSocket->impl()->sockfd(),&message,MSG_NOSIGNAL);
+#else
+			ssize_t result = ::sendmsg(_pSocket->impl()->sockfd(),&message,0);
+#endif
+			if(result<=0)
+				break;
+			sent += result;
+			if(result<size)
+				break;
+		}
+	}
+#endif
+	// buffer what has not been sent, onWritable sends it
+#if !defined(POCO_OS_FAMILY_UNIX)
+	bool wasEmpty = _sendBuffer.empty();
+#endif
+	const UInt8* data = _queuedData.empty() ? NULL : &_queuedData[0];
+	for(it=_queue.begin();it!=_queue.end();++it) {
+		UInt32 size = it->size;
+		if(sent>=size)
+			sent -= size;
+		else {
+			_sendBuffer.insert(_sendBuffer.end(),data+sent,data+size);
+			sent = 0;
+		}
+		data += it->size;
+		if(it->pBody.isNull())
+			continue;
+		size = it->pBody->size();
+		if(sent>=size)
+			sent -= size;
+		else {
+			_sendBuffer.insert(_sendBuffer.end(),it->pBody->begin()+sent,it->pBody->begin()+size);
+			sent = 0;
+		}
+	}
+	_queuedData.clear();
+	_queue.clear();
+#if !defined(POCO_OS_FAMILY_UNIX)
+	if(wasEmpty && !_sendBuffer.empty()) {
+		sent = sendIntern(&_sendBuffer[0],_sendBuffer.size());
+		_sendBuffer.erase(_sendBuffer.begin(),_sendBuffer.begin()+sent);
+	}
+#endif
+}
@@ -22,6 +22,8 @@
 #include "Task.h"
 #include "Poco/Net/StreamSocket.h"
 #include "Poco/Mutex.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Buffer.h"
 
 
 class TCPClient : private Cumulus::SocketHandler {
@@ -35,6 +37,9 @@ public:
 	void					 disconnect();
 
 	bool					 send(const Poco::UInt8* data,Poco::UInt32 size);
+	// data is copied and body is referenced (so must stay unchanged), both are written by the next flush in one call with everything queued before
+	bool					 queue(const Poco::UInt8* data,Poco::UInt32 size,const Poco::SharedPtr<Poco::Buffer<Poco::UInt8> >& pBody);
+	void					 flush();
 
 	Poco::Net::SocketAddress address();
 	Poco::Net::SocketAddress peerAddress();
@@ -53,11 +58,21 @@ private:
 	void						error(const std::string& error);
 
 	int							sendIntern(const Poco::UInt8* data,Poco::UInt32 size);
+	void						flushIntern();
+
+	class Queued {
+	public:
+		Queued(Poco::UInt32 size,const Poco::SharedPtr<Poco::Buffer<Poco::UInt8> >& pBody) : size(size),pBody(pBody) {}
+		Poco::UInt32									size;
+		Poco::SharedPtr<Poco::Buffer<Poco::UInt8> >	pBody;
+	};
 
 	std::string					_error;
 	Poco::Net::StreamSocket		*_pSocket;
 	std::vector<Poco::UInt8>	_recvBuffer;
 	std::vector<Poco::UInt8>	_sendBuffer;
+	std::vector<Poco::UInt8>	_queuedData;
+	std::vector<Queued>			_queue;
 	bool						_connected;
 	Cumulus::SocketManager&		_manager;
 	Poco::Mutex	_mutex;
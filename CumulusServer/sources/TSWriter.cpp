@@ -0,0 +1,188 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+
+#include "TSWriter.h"
+#include <cstring>
+
+using namespace std;
+using namespace Poco;
+
+#define TS_PACKET_SIZE	188
+
+static UInt32 CRC32(const UInt8* data,UInt32 size) {
+	UInt32 crc = 0xFFFFFFFF;
+	for(UInt32 i=0;i<size;++i) {
+		crc ^= ((UInt32)data[i])<<24;
+		for(UInt8 j=0;j<8;++j)
+			crc = (crc&0x80000000) ? ((crc<<1)^0x04C11DB7) : (crc<<1);
+	}
+	return crc;
+}
+
+static void WriteTimestamp(UInt8* data,UInt8 prefix,UInt64 time) {
+	data[0] = (prefix<<4) | (UInt8)(((time>>30)&0x07)<<1) | 0x01;
+	data[1] = (UInt8)(time>>22);
+	data[2] = (UInt8)(((time>>15)&0x7F)<<1) | 0x01;
+	data[3] = (UInt8)(time>>7);
+	data[4] = (UInt8)((time&0x7F)<<1) | 0x01;
+}
+
+
+TSWriter::TSWriter() : _patCounter(0),_pmtCounter(0),_videoCounter(0),_audioCounter(0),_pcrPID(VIDEO_PID) {
+}
+
+TSWriter::~TSWriter() {
+}
+
+void TSWriter::writeSection(ostream& out,UInt16 pid,UInt8& counter,UInt8* section,UInt32 size) {
+	// section has 4 bytes at the end for the CRC
+	UInt32 crc = CRC32(section,size-4);
+	section[size-4] = (UInt8)(crc>>24);
+	section[size-3] = (UInt8)(crc>>16);
+	section[size-2] = (UInt8)(crc>>8);
+	section[size-1] = (UInt8)crc;
+
+	UInt8 packet[TS_PACKET_SIZE];
+	memset(packet,0xFF,sizeof(packet));
+	packet[0] = 0x47;
+	packet[1] = 0x40 | ((pid>>8)&0x1F);
+	packet[2] = (UInt8)pid;
+	packet[3] = 0x10 | (counter++ & 0x0F);
+	packet[4] = 0; // pointer field
+	memcpy(packet+5,section,size);
+	out.write((const char*)packet,sizeof(packet));
+}
+
+void TSWriter::writeTables(ostream& out,bool video) {
+	UInt8 pat[] = {
+		0x00, 0xB0, 13, 0x00, 0x01, 0xC1, 0x00, 0x00,
+		0x00, 0x01, 0xE0 | (PMT_PID>>8), PMT_PID&0xFF,
+		0, 0, 0, 0
+	};
+	writeSection(out,0,_patCounter,pat,sizeof(pat));
+
+	_pcrPID = video ? VIDEO_PID : AUDIO_PID;
+	UInt8 pmt[] = {
+		0x02, 0xB0, 23, 0x00, 0x01, 0xC1, 0x00, 0x00,
+		0xE0 | (_pcrPID>>8), _pcrPID&0xFF, 0xF0, 0x00,
+		0x1B, 0xE0 | (VIDEO_PID>>8), VIDEO_PID&0xFF, 0xF0, 0x00, // H.264
+		0x0F, 0xE0 | (AUDIO_PID>>8), AUDIO_PID&0xFF, 0xF0, 0x00, // AAC ADTS
+		0, 0, 0, 0
+	};
+	UInt32 size = sizeof(pmt);
+	if(!video) {
+		// audio only, the H.264 stream is removed
+		memmove(pmt+12,pmt+17,size-17);
+		size -= 5;
+		pmt[2] -= 5;
+	}
+	writeSection(out,PMT_PID,_pmtCounter,pmt,size);
+}
+
+void TSWriter::writeVideo(ostream& out,UInt64 pts,UInt64 dts,bool keyFrame,const UInt8* data,UInt32 size) {
+	writePES(out,VIDEO_PID,_videoCounter,0xE0,pts,dts,keyFrame,data,size);
+}
+
+void TSWriter::writeAudio(ostream& out,UInt64 pts,const UInt8* data,UInt32 size) {
+	writePES(out,AUDIO_PID,_audioCounter,0xC0,pts,pts,false,data,size);
+}
+
+void TSWriter::writePES(ostream& out,UInt16 pid,UInt8& counter,UInt8 streamId,UInt64 pts,UInt64 dts,bool keyFrame,const UInt8* data,UInt32 size) {
+	pts &= 0x1FFFFFFFFLL;
+	dts &= 0x1FFFFFFFFLL;
+	bool withDTS = dts!=pts;
+
+	UInt8 header[19];
+	header[0] = 0x00;
+	header[1] = 0x00;
+	header[2] = 0x01;
+	header[3] = streamId;
+	header[6] = 0x80;
+	header[7] = withDTS ? 0xC0 : 0x80;
+	header[8] = withDTS ? 10 : 5;
+	WriteTimestamp(header+9,withDTS ? 0x03 : 0x02,pts);
+	if(withDTS)
+		WriteTimestamp(header+14,0x01,dts);
+	UInt32 headerSize = 9+header[8];
+	// unbounded length for video
+	UInt32 length = streamId==0xE0 ? 0 : (headerSize-6+size);
+	if(length>0xFFFF)
+		length = 0;
+	header[4] = (UInt8)(length>>8);
+	header[5] = (UInt8)length;
+
+	UInt8 packet[TS_PACKET_SIZE];
+	UInt32 headerPos = 0;
+	bool first = true;
+	while(headerPos<headerSize || size>0) {
+		bool withPCR = first && pid==_pcrPID;
+		bool randomAccess = first && (keyFrame || pid==AUDIO_PID);
+
+		// adaptation field length, -1 means no adaptation field
+		int adaptation = (withPCR || randomAccess) ? (1+(withPCR ? 6 : 0)) : -1;
+		UInt32 capacity = TS_PACKET_SIZE-4-(adaptation>=0 ? (adaptation+1) : 0);
+		UInt32 remaining = headerSize-headerPos+size;
+		if(remaining<capacity) {
+			// stuffing
+			adaptation += capacity-remaining;
+			capacity = remaining;
+		}
+
+		packet[0] = 0x47;
+		packet[1] = (first ? 0x40 : 0x00) | ((pid>>8)&0x1F);
+		packet[2] = (UInt8)pid;
+		packet[3] = (adaptation>=0 ? 0x30 : 0x10) | (counter++ & 0x0F);
+		UInt8* pCurrent = packet+4;
+		if(adaptation>=0) {
+			UInt8* pEnd = pCurrent+1+adaptation;
+			*pCurrent++ = (UInt8)adaptation;
+			if(adaptation>0) {
+				*pCurrent++ = (randomAccess ? 0x40 : 0x00) | (withPCR ? 0x10 : 0x00);
+				if(withPCR) {
+					pCurrent[0] = (UInt8)(dts>>25);
+					pCurrent[1] = (UInt8)(dts>>17);
+					pCurrent[2] = (UInt8)(dts>>9);
+					pCurrent[3] = (UInt8)(dts>>1);
+					pCurrent[4] = (UInt8)((dts&0x01)<<7) | 0x7E;
+					pCurrent[5] = 0x00;
+					pCurrent += 6;
+				}
+				while(pCurrent<pEnd)
+					*pCurrent++ = 0xFF;
+			}
+		}
+
+		if(headerPos<headerSize) {
+			UInt32 count = headerSize-headerPos;
+			if(count>capacity)
+				count = capacity;
+			memcpy(pCurrent,header+headerPos,count);
+			headerPos += count;
+			pCurrent += count;
+			capacity -= count;
+		}
+		if(capacity>size)
+			capacity = size;
+		memcpy(pCurrent,data,capacity);
+		data += capacity;
+		size -= capacity;
+
+		out.write((const char*)packet,sizeof(packet));
+		first = false;
+	}
+}
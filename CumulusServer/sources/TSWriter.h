@@ -0,0 +1,52 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+
+#pragma once
+
+#include "Cumulus.h"
+#include <ostream>
+
+// MPEG2-TS muxer with one H.264 stream and one AAC stream
+class TSWriter {
+public:
+	TSWriter();
+	virtual ~TSWriter();
+
+	enum {
+		PMT_PID=0x1000,
+		VIDEO_PID=0x100,
+		AUDIO_PID=0x101
+	};
+
+	// without video the PCR is carried by the audio PID
+	void	writeTables(std::ostream& out,bool video=true);
+	// data in Annex B format, times in 90kHz units
+	void	writeVideo(std::ostream& out,Poco::UInt64 pts,Poco::UInt64 dts,bool keyFrame,const Poco::UInt8* data,Poco::UInt32 size);
+	// data as ADTS frames, time in 90kHz units
+	void	writeAudio(std::ostream& out,Poco::UInt64 pts,const Poco::UInt8* data,Poco::UInt32 size);
+
+private:
+	void	writeSection(std::ostream& out,Poco::UInt16 pid,Poco::UInt8& counter,Poco::UInt8* section,Poco::UInt32 size);
+	void	writePES(std::ostream& out,Poco::UInt16 pid,Poco::UInt8& counter,Poco::UInt8 streamId,Poco::UInt64 pts,Poco::UInt64 dts,bool keyFrame,const Poco::UInt8* data,Poco::UInt32 size);
+
+	Poco::UInt8		_patCounter;
+	Poco::UInt8		_pmtCounter;
+	Poco::UInt8		_videoCounter;
+	Poco::UInt8		_audioCounter;
+	Poco::UInt16	_pcrPID;
+};
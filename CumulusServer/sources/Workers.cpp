@@ -0,0 +1,209 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "Workers.h"
+#include "BinaryWriter.h"
+#include "PacketReader.h"
+#include "Logs.h"
+#include "Poco/NumberFormatter.h"
+
+using namespace std;
+using namespace Poco;
+using namespace Cumulus;
+
+
+Work::Work(const string& name,const UInt8* arguments,UInt32 size,WorkHandler* pHandler) : name(name),arguments(size),_pHandler(pHandler) {
+	if(size>0)
+		memcpy(this->arguments.begin(),arguments,size);
+}
+
+Work::~Work() {
+	if(!_pHandler)
+		return;
+	PacketReader packet(results.data(),results.size());
+	AMFReader reader(packet);
+	_pHandler->onDone(reader,error.empty() ? NULL : error.c_str());
+}
+
+
+Worker::Worker(Workers& workers,const string& path,UInt32 index) : _workers(workers),FileWatcher(path),Startable("Worker"+NumberFormatter::format(index)),_pState(NULL),_loaded(false) {
+}
+
+Worker::~Worker() {
+	stop();
+}
+
+void Worker::start() {
+	Startable::start();
+}
+
+void Worker::stop() {
+	Startable::stop();
+	ScopedLock<FastMutex> lock(_mutex);
+	list<Work*>::const_iterator it;
+	for(it=_works.begin();it!=_works.end();++it) {
+		(*it)->error = "Worker stopping";
+		delete *it;
+	}
+	_works.clear();
+}
+
+void Worker::post(Work* pWork) {
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		_works.push_back(pWork);
+	}
+	wakeUp();
+}
+
+void Worker::run() {
+	_pState = Script::CreateState();
+	Timestamp watchTime(0);
+	do {
+		// script changes
+		if(watchTime.isElapsed(1000000)) {
+			FileWatcher::watch();
+			watchTime.update();
+		}
+		for(;;) {
+			Work* pWork;
+			{
+				ScopedLock<FastMutex> lock(_mutex);
+				if(_works.empty())
+					break;
+				pWork = _works.front();
+				_works.pop_front();
+			}
+			execute(*pWork);
+			_workers.done(pWork);
+		}
+	} while(sleep(1000)!=STOP);
+	clear();
+	Script::CloseState(_pState);
+	_pState=NULL;
+}
+
+void Worker::load() {
+	if(luaL_dofile(_pState,FileWatcher::path.c_str())!=0) {
+		const char* error = lua_tostring(_pState,-1);
+		ERROR("Worker %s, %s",name().c_str(),error ? error : "unknown error");
+		lua_pop(_pState,1);
+		return;
+	}
+	_loaded = true;
+}
+
+void Worker::clear() {
+	_loaded = false;
+	lua_gc(_pState,LUA_GCCOLLECT,0);
+}
+
+void Worker::execute(Work& work) {
+	if(!_loaded) {
+		work.error = "No worker script " + FileWatcher::path;
+		return;
+	}
+	int top = lua_gettop(_pState);
+	lua_getglobal(_pState,work.name.c_str());
+	if(!lua_isfunction(_pState,-1)) {
+		lua_settop(_pState,top);
+		work.error = "Function '" + work.name + "' unfound in " + FileWatcher::path;
+		return;
+	}
+
+	PacketReader packet(work.arguments.begin(),work.arguments.size());
+	AMFReader reader(packet);
+	Script::WriteAMF(_pState,reader,0);
+
+	if(lua_pcall(_pState,lua_gettop(_pState)-top-1,LUA_MULTRET,0)!=0) {
+		const char* error = lua_tostring(_pState,-1);
+		work.error = error ? error : "Worker error";
+		lua_settop(_pState,top);
+		return;
+	}
+
+	Cumulus::BinaryWriter rawWriter(work.results);
+	AMFWriter writer(rawWriter);
+	Script::ReadAMF(_pState,writer,lua_gettop(_pState)-top);
+	lua_settop(_pState,top);
+}
+
+
+Workers::Workers(TaskHandler& handler,const string& path,UInt32 count) : Task(&handler),_next(0) {
+	for(UInt32 i=0;i<count;++i)
+		_workers.push_back(new Worker(*this,path,i));
+}
+
+Workers::~Workers() {
+	stop();
+	vector<Worker*>::const_iterator it;
+	for(it=_workers.begin();it!=_workers.end();++it)
+		delete *it;
+}
+
+void Workers::start() {
+	vector<Worker*>::const_iterator it;
+	for(it=_workers.begin();it!=_workers.end();++it)
+		(*it)->start();
+	if(!_workers.empty())
+		NOTE("%u Lua workers started",(UInt32)_workers.size());
+}
+
+void Workers::stop() {
+	vector<Worker*>::const_iterator it;
+	for(it=_workers.begin();it!=_workers.end();++it)
+		(*it)->stop();
+	handle();
+}
+
+void Workers::post(const string& key,const string& name,const UInt8* arguments,UInt32 size,WorkHandler* pHandler) {
+	Work* pWork = new Work(name,arguments,size,pHandler);
+	if(_workers.empty()) {
+		pWork->error = "No Lua worker configured";
+		delete pWork;
+		return;
+	}
+	UInt32 index;
+	if(key.empty())
+		index = _next++;
+	else {
+		// FNV-1a
+		index = 2166136261U;
+		for(string::const_iterator it=key.begin();it!=key.end();++it)
+			index = (index^(UInt8)*it)*16777619U;
+	}
+	_workers[index%_workers.size()]->post(pWork);
+}
+
+void Workers::done(Work* pWork) {
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		_done.push_back(pWork);
+	}
+	waitHandleEx(false);
+}
+
+void Workers::handle() {
+	list<Work*> works;
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		works.swap(_done);
+	}
+	list<Work*>::const_iterator it;
+	for(it=works.begin();it!=works.end();++it)
+		delete *it;
+}
@@ -0,0 +1,99 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Task.h"
+#include "Startable.h"
+#include "FileWatcher.h"
+#include "BinaryStream.h"
+#include "Script.h"
+#include "Poco/Buffer.h"
+#include <list>
+#include <vector>
+
+class WorkHandler {
+public:
+	virtual void onDone(Cumulus::AMFReader& results,const char* error)=0;
+};
+
+class Work {
+public:
+	Work(const std::string& name,const Poco::UInt8* arguments,Poco::UInt32 size,WorkHandler* pHandler);
+	virtual ~Work();
+
+	const std::string		name;
+	Poco::Buffer<Poco::UInt8>	arguments;
+	Cumulus::BinaryStream	results;
+	std::string				error;
+private:
+	WorkHandler*			_pHandler;
+};
+
+class Workers;
+class Worker : private Cumulus::Startable, private FileWatcher {
+public:
+	Worker(Workers& workers,const std::string& path,Poco::UInt32 index);
+	virtual ~Worker();
+
+	void	start();
+	void	stop();
+	void	post(Work* pWork);
+
+private:
+	void	run();
+	void	execute(Work& work);
+
+	// FileWatcher implementation
+	void	load();
+	void	clear();
+
+	Workers&			_workers;
+	lua_State*			_pState;
+	bool				_loaded;
+	Poco::FastMutex		_mutex;
+	std::list<Work*>	_works;
+};
+
+// Independent Lua states on their own threads, the main state posts them works by message passing (AMF)
+class Workers : private Cumulus::Task {
+	friend class Worker;
+public:
+	Workers(Cumulus::TaskHandler& handler,const std::string& path,Poco::UInt32 count);
+	virtual ~Workers();
+
+	Poco::UInt32	count() const;
+
+	void			start();
+	void			stop();
+
+	// works with the same key are always executed by the same worker
+	void			post(const std::string& key,const std::string& name,const Poco::UInt8* arguments,Poco::UInt32 size,WorkHandler* pHandler);
+
+private:
+	void			handle();
+	void			done(Work* pWork);
+
+	std::vector<Worker*>	_workers;
+	Poco::UInt32			_next;
+	Poco::FastMutex			_mutex;
+	std::list<Work*>		_done;
+};
+
+inline Poco::UInt32 Workers::count() const {
+	return _workers.size();
+}
@@ -221,6 +221,31 @@ private:
 				_params.udpBufferSize = config().getInt("udpBufferSize",_params.udpBufferSize);
 				_params.keepAliveServer = config().getInt("keepAliveServer",_params.keepAliveServer);
 				_params.keepAlivePeer = config().getInt("keepAlivePeer",_params.keepAlivePeer);
+				_params.fanOutThreshold = config().getInt("fanOutThreshold",_params.fanOutThreshold);
+				_params.reorderWindow = config().getInt("reorderWindow",_params.reorderWindow);
+				_params.ackPackets = config().getInt("ackPackets",_params.ackPackets);
+				_params.ackDelay = config().getInt("ackDelay",_params.ackDelay);
+				_params.receiveBuffer = config().getInt("receiveBuffer",_params.receiveBuffer);
+				_params.writerBudget = config().getInt("writerBudget",_params.writerBudget);
+				_params.sessionBudget = config().getInt("sessionBudget",_params.sessionBudget);
+				_params.memoryCeiling = config().getInt("memoryCeiling",_params.memoryCeiling);
+				_params.audioTimeToLive = config().getInt("audioTimeToLive",_params.audioTimeToLive);
+				_params.videoTimeToLive = config().getInt("videoTimeToLive",_params.videoTimeToLive);
+				_params.mtu = config().getInt("mtu",_params.mtu);
+				_params.fecLostRate = config().getInt("fecLostRate",_params.fecLostRate);
+				string overflow = config().getString("overflow","dropOldest");
+				if(overflow=="keyFrame")
+					_params.overflowPolicy = FlowWriter::DROP_UNTIL_KEYFRAME;
+				else if(overflow=="close")
+					_params.overflowPolicy = FlowWriter::CLOSE_FLOW;
+				else if(overflow!="dropOldest")
+					WARN("Unknown overflow policy '%s', dropOldest is used",overflow.c_str());
+				string groupStrategy = config().getString("groupStrategy","recent");
+				if(groupStrategy=="ring")
+					_params.pGroupStrategy = &GroupStrategy::Ring;
+				else if(groupStrategy!="recent")
+					WARN("Unknown group strategy '%s', recent is used",groupStrategy.c_str());
+				_params.groupIntroductions = config().getInt("groupIntroductions",_params.groupIntroductions);
 
 #if defined(POCO_OS_FAMILY_UNIX)
 				sigset_t sset;
@@ -0,0 +1,186 @@
+-- Churn simulation of the group strategies (groupStrategy, groupIntroductions in CumulusServer.ini).
+-- The recent and ring strategies of CumulusLib are replayed on a simulated group: one member leaves
+-- and one joins every second, the mesh built by the introductions and the repairs is checked every REPORT steps.
+-- Runs when the service starts (copy this folder in www/), or alone with "lua main.lua".
+
+local MEMBERS = 200
+local STEPS = 3000 -- one leave and one join by step, one step by second
+local REPORT = 500
+local INTRODUCTIONS = 30 -- groupIntroductions, introductions by member and by minute, 0 for unlimited
+local RING = 2^31 -- id space
+local FINGERS = 6
+
+local log = NOTE or print
+
+local function newGroup()
+	-- members in joining order, ring sorted by id, links of the mesh
+	return {members={},ring={},links={},introductions={}}
+end
+
+local function link(group,a,b)
+	group.links[a][b] = true
+	group.links[b][a] = true
+end
+
+-- Peer::introduce and the distinct introductions of PeerIntroducer
+local function introducer(group,peer,step)
+	local introduced = {}
+	local count,first = 0,nil
+	return function(member)
+		if member==peer then return false end
+		first = first or member
+		if introduced[member] then return false end
+		if INTRODUCTIONS>0 then
+			local quota = group.introductions[member]
+			if quota.minute~=math.floor(step/60) then quota.minute,quota.count = math.floor(step/60),0 end
+			if quota.count>=INTRODUCTIONS then return false end
+			quota.count = quota.count+1
+		end
+		introduced[member] = true
+		link(group,peer,member)
+		count = count+1
+		return true
+	end,function()
+		-- every member has reached its introductions cap, the newcomer must have at least one neighbor
+		if count==0 and first then link(group,peer,first) end
+	end
+end
+
+local function lowerBound(ring,id)
+	local low,high = 1,#ring+1
+	while low<high do
+		local middle = math.floor((low+high)/2)
+		if ring[middle].id<id then low = middle+1 else high = middle end
+	end
+	return low
+end
+
+local strategies = {}
+
+strategies.recent = {
+	neighbors = function(group,peer,introduce)
+		local count,index = 0,#group.members
+		while index>0 and count<5 do
+			if introduce(group.members[index]) then count = count+1 end
+			index = index-1
+		end
+		if index>0 then introduce(group.members[math.random(#group.members)]) end
+	end,
+	repair = function(group,index,ringIndex)
+		-- the following peer gets the 6th preceding one
+		local target = group.members[index]
+		if target and index>5 then return group.members[index-5],target end
+	end
+}
+
+strategies.ring = {
+	neighbors = function(group,peer,introduce)
+		local ring = group.ring
+		if #ring==0 then return end
+		local following = lowerBound(ring,peer.id)
+		local preceding = following
+		local successors,predecessors,visited = 0,0,0
+		while visited<#ring and (successors<2 or predecessors<2) do
+			if successors<2 then
+				if following>#ring then following = 1 end
+				if introduce(ring[following]) then successors = successors+1 end
+				following = following+1
+				visited = visited+1
+			end
+			if visited<#ring and predecessors<2 then
+				preceding = preceding>1 and preceding-1 or #ring
+				if introduce(ring[preceding]) then predecessors = predecessors+1 end
+				visited = visited+1
+			end
+		end
+		local size = math.floor(#ring/4)
+		local i = 0
+		while i<FINGERS and size>0 do
+			local it = lowerBound(ring,(peer.id+RING/2^(i+1))%RING)
+			for j=1,#ring do
+				if it>#ring then it = 1 end
+				if introduce(ring[it]) then break end
+				it = it+1
+			end
+			i,size = i+1,math.floor(size/2)
+		end
+	end,
+	repair = function(group,index,ringIndex)
+		-- the ring predecessor of the leaving peer gets its ring successor
+		local ring = group.ring
+		if #ring<2 then return end
+		local member = ring[ringIndex<=#ring and ringIndex or 1]
+		return member,ring[ringIndex>1 and ringIndex-1 or #ring]
+	end
+}
+
+local function join(group,strategy,step)
+	local peer = {id=math.random(0,RING-1)}
+	group.links[peer] = {}
+	group.introductions[peer] = {minute=0,count=0}
+	local introduce,done = introducer(group,peer,step)
+	strategy.neighbors(group,peer,introduce)
+	done()
+	table.insert(group.members,peer)
+	table.insert(group.ring,lowerBound(group.ring,peer.id),peer)
+end
+
+local function leave(group,strategy,index)
+	local peer = table.remove(group.members,index)
+	local ringIndex = lowerBound(group.ring,peer.id)
+	while group.ring[ringIndex]~=peer do ringIndex = ringIndex+1 end
+	table.remove(group.ring,ringIndex)
+	for neighbor in pairs(group.links[peer]) do group.links[neighbor][peer] = nil end
+	group.links[peer] = nil
+	group.introductions[peer] = nil
+	local member,target = strategy.repair(group,index,ringIndex)
+	if member and target and member~=target then link(group,member,target) end
+end
+
+local function check(group)
+	-- partitions of the mesh, size of the largest one, and mean degree
+	local seen,partitions,largest,degrees = {},0,0,0
+	for _,peer in ipairs(group.members) do
+		for _ in pairs(group.links[peer]) do degrees = degrees+1 end
+		if not seen[peer] then
+			partitions = partitions+1
+			local size,stack = 0,{peer}
+			seen[peer] = true
+			while #stack>0 do
+				local current = table.remove(stack)
+				size = size+1
+				for neighbor in pairs(group.links[current]) do
+					if not seen[neighbor] then
+						seen[neighbor] = true
+						table.insert(stack,neighbor)
+					end
+				end
+			end
+			if size>largest then largest = size end
+		end
+	end
+	return partitions,largest/#group.members,degrees/#group.members
+end
+
+local function simulate(name)
+	math.randomseed(1)
+	local strategy = strategies[name]
+	local group = newGroup()
+	for i=1,MEMBERS do join(group,strategy,0) end
+	for step=1,STEPS do
+		leave(group,strategy,math.random(#group.members))
+		join(group,strategy,step)
+		if step%REPORT==0 then
+			local partitions,largest,degree = check(group)
+			log(string.format("%s strategy, step %d: %d partition(s), largest %.0f%% of %d members, mean degree %.1f",
+				name,step,partitions,largest*100,#group.members,degree))
+		end
+	end
+end
+
+function onStart(path)
+	simulate("recent")
+	simulate("ring")
+end
+
+if not cumulus then onStart() end
@@ -0,0 +1,53 @@
+-- Loopback audio latency under video load.
+-- Publish a stream with a microphone on rtmfp://localhost/benchmark/latency, and play it from a second client
+-- which plays the "load" stream too: every audio packet received pushes VIDEO_LOAD bytes of video on "load",
+-- so the audio of the listener shares its session with a video flow of VIDEO_LOAD*50 bytes/s (20 ms audio packets).
+-- Each interval logs the audio latency of the listeners, with and then without the load.
+
+local VIDEO_LOAD = 4000 -- bytes of video by audio packet, 200KB/s
+local INTERVAL = 10 -- in seconds, the load is switched on and off at each interval
+
+local load = nil
+local frame = "\23\1"..string.rep("\0",VIDEO_LOAD-2) -- AVC inter frame header, and padding
+local loaded = true
+local samples = {}
+local last = os.time()
+
+function onStart(path)
+	load = cumulus:publish("load")
+end
+
+function onStop(path)
+	if load then load:close() end
+end
+
+function onAudioPacket(client,publication,time,packet)
+	if load and loaded then
+		load:pushVideoPacket(time,frame)
+		load:flush()
+	end
+end
+
+function onManage()
+	-- audioQOS.latency is measured by the acknowledgments of the listener, one sample by onManage
+	for name,publication in cumulus.publications:pairs() do
+		if name~="load" then
+			for id,listener in publication.listeners:ipairs() do
+				local sample = samples[id] or {sum=0,count=0,peak=0}
+				local latency = listener.audioQOS.latency
+				sample.sum = sample.sum+latency
+				sample.count = sample.count+1
+				if latency>sample.peak then sample.peak = latency end
+				samples[id] = sample
+			end
+		end
+	end
+	if os.difftime(os.time(),last)<INTERVAL then return end
+	last = os.time()
+	for id,sample in pairs(samples) do
+		NOTE(string.format("listener %u, %s load: audio latency %.0fms (peak %ums)",
+			id,loaded and "with" or "without",sample.sum/sample.count,sample.peak))
+	end
+	samples = {}
+	loaded = not loaded
+end
@@ -0,0 +1,40 @@
+-- Loss run: fragments recovered by redundancy (fecLostRate) on the audio of the listeners.
+-- Set fecLostRate in CumulusServer.ini, add a loss on the loopback interface, for example
+--   tc qdisc add dev lo root netem loss 5%
+-- then publish and play a stream on rtmfp://localhost/benchmark/loss from two clients.
+-- Each interval logs, per listener, the lost rate measured by the server and the recovered ratio:
+-- fragments recovered by their redundant copy on the audio fragments expected lost (one fragment by audio packet).
+
+local LOSS = 0.05 -- the netem loss rate, to know how many fragments are lost
+local INTERVAL = 10 -- in seconds
+
+local packets = {} -- audio packets by publication name since the last report
+local recovered = {} -- recoveredFragments already reported by listener
+local last = os.time()
+
+function onAudioPacket(client,publication,time,packet)
+	packets[publication.name] = (packets[publication.name] or 0)+1
+end
+
+function onUnsubscribe(client,listener)
+	recovered[listener.id] = nil
+end
+
+function onManage()
+	if os.difftime(os.time(),last)<INTERVAL then return end
+	last = os.time()
+	for name,publication in cumulus.publications:pairs() do
+		local count = packets[name] or 0
+		for id,listener in publication.listeners:ipairs() do
+			local qos = listener.audioQOS
+			local fragments = qos.recoveredFragments-(recovered[id] or 0)
+			-- a reset of the writer restarts the counter
+			if fragments<0 then fragments = qos.recoveredFragments end
+			recovered[id] = qos.recoveredFragments
+			local expected = count*LOSS
+			NOTE(string.format("%s, listener %u: lost rate %.2f%%, %d recovered on %.0f lost (%.0f%%)",
+				name,id,qos.lostRate*100,fragments,expected,expected>0 and fragments*100/expected or 0))
+		end
+		packets[name] = 0
+	end
+end
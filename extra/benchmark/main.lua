@@ -0,0 +1,106 @@
+-- Message handling throughput, to compare LuaJIT and Lua 5.1 builds (make LUA=lua5.1).
+-- Copy this folder in www/ and start CumulusServer: the onMessage results are logged when the service starts,
+-- the onAudioPacket ones every AUDIO_PACKETS packets received by a publication of this service.
+
+local MESSAGES = 100000
+local AUDIO_PACKETS = 5000
+local PAYLOAD = 256
+
+local ok,ffi = pcall(require,"ffi")
+if not ok then ffi = nil end
+
+local function runtime()
+	if jit then return jit.version end
+	return _VERSION
+end
+
+local function report(name,count,elapsed)
+	NOTE(string.format("%s, %s: %d in %.3fs (%.0f/s)",runtime(),name,count,elapsed,elapsed>0 and count/elapsed or 0))
+end
+
+-- Sample is an IExternalizable type: its content is read by __readExternal through a LUAByteReader,
+-- the way it is when it comes in an onMessage call
+local readers = {}
+local keyframes = 0
+
+-- copy through Lua strings
+function readers.string(self,reader)
+	local size = reader:readUnsignedShort()
+	local bytes = reader:readBytes(size)
+	local b1,b2 = bytes:byte(1,2)
+	if b1==23 and b2==1 then keyframes=keyframes+1 end
+	local sum = 0
+	for i=1,size do sum = sum+bytes:byte(i) end
+	self.sum = sum
+end
+
+-- zero-copy, FFI view on reader.pointer then skip (LuaJIT only)
+function readers.ffi(self,reader)
+	local size = reader:readUnsignedShort()
+	if reader.available<size then return end
+	local bytes = ffi.cast("const uint8_t*",reader.pointer)
+	if bytes[0]==23 and bytes[1]==1 then keyframes=keyframes+1 end
+	local sum = 0
+	for i=0,size-1 do sum = sum+bytes[i] end
+	self.sum = sum
+	reader:skip(size)
+end
+
+local mode = "string"
+function onTypedObject(type,object)
+	if type=="Sample" then object.__readExternal = readers[mode] end
+end
+
+function onStart(path)
+	local calls = 0
+	local handlers = {}
+	function handlers.onMessage(name,sample,time)
+		calls = calls+1
+	end
+
+	local sample = {__type="Sample",payload="\23\1"..string.rep("\0",PAYLOAD-2)}
+	function sample:__writeExternal(writer)
+		writer:writeUnsignedShort(#self.payload)
+		writer:writeBytes(self.payload)
+	end
+	local message = cumulus:toAMF("onMessage",sample,os.time())
+
+	-- AMF decoding + __readExternal + dispatch, what every RPC message costs
+	for _,reader in ipairs({"string","ffi"}) do
+		if reader~="ffi" or ffi then
+			mode = reader
+			local start = os.clock()
+			for i=1,MESSAGES do
+				local name,sample,time = cumulus:fromAMF(message)
+				handlers[name](name,sample,time)
+			end
+			report("onMessage "..mode.." reader",MESSAGES,os.clock()-start)
+		end
+	end
+end
+
+-- audio header and content inspection on the packet view given to onAudioPacket,
+-- alternately through a Lua string copy and through FFI
+local audio = {string={count=0,elapsed=0},ffi={count=0,elapsed=0}}
+local useFFI = false
+function onAudioPacket(client,publication,time,packet)
+	useFFI = ffi~=nil and not useFFI
+	local name = useFFI and "ffi" or "string"
+	local stats = audio[name]
+	local start = os.clock()
+	local sum = 0
+	if name=="ffi" then
+		local bytes = ffi.cast("const uint8_t*",packet.pointer)
+		for i=0,packet.size-1 do sum = sum+bytes[i] end
+	else
+		local bytes = packet:copy()
+		for i=1,#bytes do sum = sum+bytes:byte(i) end
+	end
+	stats.elapsed = stats.elapsed+os.clock()-start
+	stats.count = stats.count+1
+	if stats.count==AUDIO_PACKETS then
+		report("onAudioPacket "..name.." view",stats.count,stats.elapsed)
+		stats.count = 0
+		stats.elapsed = 0
+	end
+end
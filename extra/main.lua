@@ -28,6 +28,12 @@ function onManage()
 	--end
 end
 
+--function onManageClients(clients)
+--	for i,client in ipairs(clients) do
+--		NOTE(client.address)
+--	end
+--end
+
 function onConnection(client)
 	NOTE("onConnection ".. client.id .. "--" .. client.address)
 	NOTE("clients "..cumulus.clients.count)
@@ -0,0 +1,11 @@
+-- Loaded by every Lua worker (see 'workers' configuration), each one in its own independent state.
+-- Functions are called from main scripts with cumulus:work(key,"name",...),
+-- works which have the same key (client.id for example) are always executed by the same worker:
+--
+--	local work = cumulus:work(client.id,"authenticate",login,password)
+--	function work:onResult(accepted) end
+--	function work:onError(error) end
+
+function authenticate(login,password)
+	return true
+end